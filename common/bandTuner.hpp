@@ -0,0 +1,87 @@
+#ifndef COMMON_BAND_TUNER_HPP
+#define COMMON_BAND_TUNER_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+//---------------------------------------------------------------------------
+// Band selection from the S-curve
+//---------------------------------------------------------------------------
+// With b bands of r rows, two documents of Jaccard similarity s share at
+// least one bucket with probability 1 - (1 - s^r)^b. The bands are picked
+// to reach a target probability at the similarity threshold (the recall of
+// the pairs right at the threshold; more similar pairs are found more often)
+// as cheaply as possible. A run spends time on two things that move in
+// opposite directions with b:
+//
+//   index     every document is added to every band
+//   verify    every candidate pair has its signatures compared
+//
+// The caller calibrates both on its own data: the similarity histogram of a
+// random sample of pairs gives the expected number of candidates for any
+// (b, r), and timing the sample gives the cost of one verification and one
+// band insertion.
+struct BandCalibration {
+  std::vector<double> histogram;  // histogram[m]: sampled pairs agreeing on
+                                  // m of the t rows
+  double documents = 0;           // Documents in the corpus
+  double pairs = 0;               // Pairs the query stage may compare
+  double verifyNs = 0;            // Cost of verifying one candidate pair
+  double insertNs = 0;            // Cost of adding one document to one band
+};
+
+struct BandChoice {
+  int bands = 0;
+  int rows = 0;
+  double recall = 0;      // Collision probability at the threshold
+  double candidates = 0;  // Expected candidate pairs
+  double cost = 0;        // Expected index + verification time (ns)
+};
+
+inline double collisionProbability(double s, int rows, int bands) {
+  return 1.0 - std::pow(1.0 - std::pow(s, rows), bands);
+}
+
+// Cheapest band count for signatures of t rows (rows per band is t / b,
+// like the bucketing engine splits them) whose collision probability at
+// threshold reaches targetRecall. When no band count reaches it, the one
+// with the highest probability is returned.
+inline BandChoice chooseBands(const BandCalibration &calibration, int t,
+                              double threshold, double targetRecall) {
+  if (t <= 0 || calibration.histogram.size() != static_cast<size_t>(t) + 1) {
+    throw std::invalid_argument("band calibration does not match t");
+  }
+  double sampled = 0;
+  for (double count : calibration.histogram) sampled += count;
+
+  BandChoice best, fallback;
+  for (int b = 1; b <= t; b++) {
+    int r = t / b;
+    BandChoice choice;
+    choice.bands = b;
+    choice.rows = r;
+    choice.recall = collisionProbability(threshold, r, b);
+
+    double hitRate = 0;
+    for (int m = 0; m <= t && sampled > 0; m++) {
+      if (calibration.histogram[m] == 0) continue;
+      hitRate += calibration.histogram[m] *
+                 collisionProbability(static_cast<double>(m) / t, r, b);
+    }
+    if (sampled > 0) hitRate /= sampled;
+    choice.candidates = hitRate * calibration.pairs;
+    choice.cost = calibration.documents * b * calibration.insertNs +
+                  choice.candidates * calibration.verifyNs;
+
+    if (choice.recall >= targetRecall) {
+      if (best.bands == 0 || choice.cost < best.cost) best = choice;
+    } else if (fallback.bands == 0 || choice.recall > fallback.recall) {
+      fallback = choice;
+    }
+  }
+  return best.bands != 0 ? best : fallback;
+}
+
+#endif
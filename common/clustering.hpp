@@ -0,0 +1,117 @@
+#ifndef COMMON_CLUSTERING_HPP
+#define COMMON_CLUSTERING_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "threadPool.hpp"
+#include "unionFind.hpp"
+
+//---------------------------------------------------------------------------
+// Near-duplicate clusters (--clusters)
+//---------------------------------------------------------------------------
+// Connected components of the similar pairs, found by uniting the pairs of
+// a concurrent union-find in parallel. A cluster is represented by the
+// member that comes first by document number (file name when it has none),
+// and clusters are numbered in the order of their representatives, so
+// neither depends on the order the directory was listed in.
+
+// How the CSVs name the documents: the number each tool extracts from the
+// file name, or the file name itself when it has none (-1)
+struct DocumentIds {
+  std::vector<std::string> names;
+  std::vector<int> numbers;
+
+  size_t size() const { return names.size(); }
+
+  std::string id(size_t doc) const {
+    return numbers[doc] != -1 ? std::to_string(numbers[doc]) : names[doc];
+  }
+};
+
+// Position of every document when ordered by document number; documents
+// without one (-1) go after the numbered ones, by file name
+inline std::vector<int> documentRanks(const DocumentIds &ids) {
+  std::vector<unsigned> numbers(ids.size());
+  for (size_t i = 0; i < ids.size(); i++) {
+    numbers[i] = static_cast<unsigned>(ids.numbers[i]);
+  }
+  std::vector<int> order(ids.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](int a, int b) {
+    if (numbers[a] != numbers[b]) return numbers[a] < numbers[b];
+    return ids.names[a] < ids.names[b];
+  });
+  std::vector<int> rank(ids.size());
+  for (size_t r = 0; r < order.size(); r++) rank[order[r]] = r;
+  return rank;
+}
+
+struct Clustering {
+  std::vector<int> cluster;         // Cluster id of every document
+  std::vector<int> representative;  // Position of its representative
+};
+
+inline Clustering clusterDocuments(const DocumentIds &ids,
+                                   const std::vector<std::pair<int, int>> &pairs) {
+  ConcurrentUnionFind sets(ids.size());
+  ThreadPool::instance().parallelFor(
+      0, pairs.size(),
+      [&](size_t p) { sets.unite(pairs[p].first, pairs[p].second); }, 1024);
+
+  std::vector<int> rank = documentRanks(ids);
+  auto before = [&](int a, int b) { return rank[a] < rank[b]; };
+
+  std::vector<int> best(ids.size(), -1);
+  for (size_t i = 0; i < ids.size(); i++) {
+    int &root = best[sets.find(i)];
+    if (root == -1 || before(i, root)) root = i;
+  }
+  std::vector<int> representatives;
+  for (size_t i = 0; i < ids.size(); i++) {
+    if (best[i] != -1) representatives.push_back(best[i]);
+  }
+  std::sort(representatives.begin(), representatives.end(), before);
+  std::vector<int> clusterOf(ids.size(), -1);
+  for (size_t c = 0; c < representatives.size(); c++) {
+    clusterOf[representatives[c]] = c;
+  }
+
+  Clustering clustering;
+  clustering.cluster.resize(ids.size());
+  clustering.representative.resize(ids.size());
+  for (size_t i = 0; i < ids.size(); i++) {
+    int representative = best[sets.find(i)];
+    clustering.representative[i] = representative;
+    clustering.cluster[i] = clusterOf[representative];
+  }
+  return clustering;
+}
+
+// One row per document: Doc,Cluster,Representative. A document with no
+// similar pair is a cluster of its own; dedup keeps the rows where Doc
+// equals Representative.
+inline void writeClustersToCSV(const std::string &filename,
+                               const Clustering &clustering,
+                               const DocumentIds &ids) {
+  std::ofstream file(filename);
+  if (!file.is_open()) {
+    std::cerr << "Error: Unable to open file " << filename << " for writing"
+              << std::endl;
+    return;
+  }
+  file << "Doc,Cluster,Representative\n";
+  for (size_t i = 0; i < ids.size(); i++) {
+    file << ids.id(i) << "," << clustering.cluster[i] << ","
+         << ids.id(clustering.representative[i]) << "\n";
+  }
+  std::cout << "Clusters written to " << filename << std::endl;
+}
+
+#endif
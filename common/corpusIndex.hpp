@@ -0,0 +1,286 @@
+#ifndef COMMON_CORPUS_INDEX_HPP
+#define COMMON_CORPUS_INDEX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//---------------------------------------------------------------------------
+// Incremental corpus index
+//---------------------------------------------------------------------------
+// A directory that remembers, for every document of a corpus, what it looked
+// like when it was signed (size, modification time, content hash) together
+// with its MinHash signature and the key of its bucket in every LSH band.
+// A refresh only has to sign the files whose fingerprint changed.
+//
+//   index.meta   text, one "name value" per line: parameters of the index
+//   index.log    binary records (native byte order), appended by every run
+//
+// A record is a one-byte type, a uint32 path length and the path. An 'A'
+// (add) record follows it with uint64 size, int64 mtime, uint64 content
+// hash, t int32 signature values and b uint64 band keys; it replaces any
+// earlier record of the same path. A 'D' record is a tombstone: the path was
+// removed from the corpus. Replaying the log gives the live documents.
+// Superseded records are dropped by compact(), which the owner calls when
+// they outnumber the live ones. A run that dies mid-append leaves a partial
+// last record, which the next load cuts off.
+struct CorpusIndexInfo {
+  uint32_t k = 0;          // Shingle size
+  uint32_t t = 0;          // Hash functions (signature length)
+  uint32_t b = 0;          // LSH bands (band keys per document)
+  uint64_t seed = 0;       // Seed of the hash coefficients
+  std::string hashFamily;  // How shingles were hashed, e.g. "xxh64-words/..."
+};
+
+struct IndexEntry {
+  std::string path;
+  uint64_t size = 0;
+  int64_t mtime = 0;  // Ticks of the file clock
+  uint64_t contentHash = 0;
+  std::vector<int> signature;      // t values
+  std::vector<uint64_t> bandKeys;  // b values
+};
+
+class CorpusIndex {
+ private:
+  static constexpr uint32_t kVersion = 1;
+  static constexpr char kAdd = 'A';
+  static constexpr char kDelete = 'D';
+
+  std::string dir;
+  CorpusIndexInfo indexInfo;
+  std::vector<IndexEntry> entries;  // Live documents, in log order
+  std::unordered_map<std::string, size_t> byPath;
+  size_t records = 0;   // Records in the log, superseded ones included
+  std::string pending;  // Records not yet appended to the log
+
+  std::string metaPath() const { return dir + "/index.meta"; }
+  std::string logPath() const { return dir + "/index.log"; }
+
+  template <typename T>
+  static void append(std::string &out, const T &value) {
+    out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+  }
+
+  void encodeAdd(std::string &out, const IndexEntry &entry) const {
+    out.push_back(kAdd);
+    append(out, static_cast<uint32_t>(entry.path.size()));
+    out += entry.path;
+    append(out, entry.size);
+    append(out, entry.mtime);
+    append(out, entry.contentHash);
+    for (int value : entry.signature) append(out, static_cast<int32_t>(value));
+    for (uint64_t key : entry.bandKeys) append(out, key);
+  }
+
+  void writeMeta() const {
+    std::ofstream out(metaPath(), std::ios::trunc);
+    if (!out) throw std::runtime_error("cannot create " + metaPath());
+    out << "corpus-index " << kVersion << "\n"
+        << "k " << indexInfo.k << "\n"
+        << "t " << indexInfo.t << "\n"
+        << "b " << indexInfo.b << "\n"
+        << "seed " << indexInfo.seed << "\n"
+        << "hash-family " << indexInfo.hashFamily << "\n";
+    if (!out) throw std::runtime_error("error writing " + metaPath());
+  }
+
+  void readMeta() {
+    std::ifstream in(metaPath());
+    if (!in) throw std::runtime_error(dir + " is not a corpus index");
+    std::string name;
+    uint32_t version = 0;
+    in >> name >> version;
+    if (name != "corpus-index" || version != kVersion) {
+      throw std::runtime_error(metaPath() + " has an unknown format");
+    }
+    while (in >> name) {
+      if (name == "k") in >> indexInfo.k;
+      else if (name == "t") in >> indexInfo.t;
+      else if (name == "b") in >> indexInfo.b;
+      else if (name == "seed") in >> indexInfo.seed;
+      else if (name == "hash-family") in >> indexInfo.hashFamily;
+      else throw std::runtime_error(metaPath() + ": unknown field " + name);
+    }
+    if (indexInfo.t == 0 || indexInfo.b == 0) {
+      throw std::runtime_error(metaPath() + " is incomplete");
+    }
+  }
+
+  // Replays the log; returns the length of its complete records
+  size_t replay(const std::string &log) {
+    const size_t t = indexInfo.t, b = indexInfo.b;
+    const size_t addTail = 3 * sizeof(uint64_t) + t * sizeof(int32_t) +
+                           b * sizeof(uint64_t);
+    std::vector<IndexEntry> all;
+    std::unordered_map<std::string, size_t> latest;
+    size_t pos = 0;
+    while (pos < log.size()) {
+      char type = log[pos];
+      uint32_t length;
+      if (log.size() - pos < 1 + sizeof(length)) break;
+      std::memcpy(&length, log.data() + pos + 1, sizeof(length));
+      size_t body = pos + 1 + sizeof(length);
+      if (log.size() - body < length) break;
+      std::string path(log.data() + body, length);
+      body += length;
+
+      if (type == kDelete) {
+        latest.erase(path);
+      } else if (type == kAdd) {
+        if (log.size() - body < addTail) break;
+        IndexEntry entry;
+        entry.path = path;
+        const char *p = log.data() + body;
+        std::memcpy(&entry.size, p, sizeof(uint64_t));
+        std::memcpy(&entry.mtime, p + 8, sizeof(int64_t));
+        std::memcpy(&entry.contentHash, p + 16, sizeof(uint64_t));
+        p += 24;
+        entry.signature.resize(t);
+        for (size_t i = 0; i < t; i++, p += sizeof(int32_t)) {
+          int32_t value;
+          std::memcpy(&value, p, sizeof(value));
+          entry.signature[i] = value;
+        }
+        entry.bandKeys.resize(b);
+        std::memcpy(entry.bandKeys.data(), p, b * sizeof(uint64_t));
+        body += addTail;
+        latest[path] = all.size();
+        all.push_back(std::move(entry));
+      } else {
+        throw std::runtime_error(logPath() + " is corrupt");
+      }
+      records++;
+      pos = body;
+    }
+
+    // Live entries keep the order of their latest record
+    std::vector<char> isLatest(all.size(), 0);
+    for (const auto &kv : latest) isLatest[kv.second] = 1;
+    for (size_t i = 0; i < all.size(); i++) {
+      if (!isLatest[i]) continue;
+      byPath[all[i].path] = entries.size();
+      entries.push_back(std::move(all[i]));
+    }
+    return pos;
+  }
+
+ public:
+  static bool exists(const std::string &dir) {
+    return std::filesystem::exists(dir + "/index.meta");
+  }
+
+  // Opens the index in dir, creating an empty one with info if there is none
+  CorpusIndex(const std::string &directory, const CorpusIndexInfo &info)
+      : dir(directory), indexInfo(info) {
+    if (!exists(dir)) {
+      std::filesystem::create_directories(dir);
+      writeMeta();
+      std::ofstream(logPath(), std::ios::binary | std::ios::trunc);
+      return;
+    }
+
+    readMeta();
+    std::ifstream in(logPath(), std::ios::binary);
+    if (!in) throw std::runtime_error("cannot open " + logPath());
+    std::string log((std::istreambuf_iterator<char>(in)),
+                    std::istreambuf_iterator<char>());
+    in.close();
+    size_t valid = replay(log);
+    if (valid != log.size()) {
+      std::filesystem::resize_file(logPath(), valid);
+    }
+  }
+
+  CorpusIndex(const CorpusIndex &) = delete;
+  CorpusIndex &operator=(const CorpusIndex &) = delete;
+
+  const CorpusIndexInfo &info() const { return indexInfo; }
+
+  // Live documents; an entry's position is its document id until the next
+  // put or erase of another path
+  const std::vector<IndexEntry> &documents() const { return entries; }
+
+  // Position of path in documents(), or -1
+  long find(const std::string &path) const {
+    auto it = byPath.find(path);
+    return it == byPath.end() ? -1 : static_cast<long>(it->second);
+  }
+
+  // Adds or replaces the document entry.path
+  void put(IndexEntry entry) {
+    if (entry.signature.size() != indexInfo.t ||
+        entry.bandKeys.size() != indexInfo.b) {
+      throw std::runtime_error("index entry for " + entry.path +
+                               " has the wrong shape");
+    }
+    encodeAdd(pending, entry);
+    records++;
+    auto it = byPath.find(entry.path);
+    if (it != byPath.end()) {
+      entries[it->second] = std::move(entry);
+    } else {
+      byPath[entry.path] = entries.size();
+      entries.push_back(std::move(entry));
+    }
+  }
+
+  // Leaves a tombstone for path; the last document takes its position
+  void erase(const std::string &path) {
+    auto it = byPath.find(path);
+    if (it == byPath.end()) return;
+    pending.push_back(kDelete);
+    append(pending, static_cast<uint32_t>(path.size()));
+    pending += path;
+    records++;
+
+    size_t slot = it->second;
+    byPath.erase(it);
+    if (slot + 1 != entries.size()) {
+      entries[slot] = std::move(entries.back());
+      byPath[entries[slot].path] = slot;
+    }
+    entries.pop_back();
+  }
+
+  // Records that no longer describe a live document
+  size_t tombstones() const { return records - entries.size(); }
+
+  // Appends the pending records to the log
+  void flush() {
+    if (pending.empty()) return;
+    std::ofstream out(logPath(), std::ios::binary | std::ios::app);
+    if (!out) throw std::runtime_error("cannot open " + logPath());
+    out.write(pending.data(), pending.size());
+    out.close();
+    if (!out) throw std::runtime_error("error writing " + logPath());
+    pending.clear();
+  }
+
+  // Rewrites the log with one record per live document; written aside and
+  // renamed into place
+  void compact() {
+    std::string log;
+    for (const IndexEntry &entry : entries) encodeAdd(log, entry);
+    std::string tmpPath = logPath() + ".tmp";
+    {
+      std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+      if (!out) throw std::runtime_error("cannot create " + tmpPath);
+      out.write(log.data(), log.size());
+      out.close();
+      if (!out) throw std::runtime_error("error writing " + tmpPath);
+    }
+    std::filesystem::rename(tmpPath, logPath());
+    pending.clear();
+    records = entries.size();
+  }
+};
+
+#endif
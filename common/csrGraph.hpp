@@ -0,0 +1,153 @@
+#ifndef COMMON_CSR_GRAPH_HPP
+#define COMMON_CSR_GRAPH_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "npyWriter.hpp"
+#include "threadPool.hpp"
+
+//---------------------------------------------------------------------------
+// Sparse similarity graph (--csr)
+//---------------------------------------------------------------------------
+// The similar pairs as the adjacency matrix of an undirected weighted graph
+// in compressed sparse row form: the neighbours of row r are
+// column[rowPointer[r] .. rowPointer[r + 1]), sorted, with their
+// similarities in value. A pair appears in the rows of both documents.
+//
+// The graph is built from the pairs in three parallel passes: the degrees
+// are counted with atomic increments, every pair is scattered into the
+// slots its two rows reserved (an atomic cursor per row), and each row is
+// sorted. Only the prefix sum of the degrees is sequential.
+//
+// It is written as four .npy files (common/npyWriter.hpp):
+//
+//   <name>.indptr.npy    int64    rowPointer, rows + 1 entries
+//   <name>.indices.npy   int32    column
+//   <name>.data.npy      float32  value
+//   <name>.docs.npy      uint32   document number of every row
+//
+// which is SciPy's layout with its signed index types, so
+// csr_matrix((data, indices, indptr)) over the arrays loaded with
+// mmap_mode='r' uses the data and indices files in place.
+
+struct CsrGraph {
+  std::vector<int64_t> rowPointer;
+  std::vector<int32_t> column;
+  std::vector<float> value;
+  std::vector<uint32_t> rowDocument;  // Filled by the caller
+
+  size_t rows() const { return rowPointer.empty() ? 0 : rowPointer.size() - 1; }
+};
+
+// Pair p joins rows rowOf[pairs[p].first] and rowOf[pairs[p].second] with
+// weight weight(p); rowOf maps every document to one of rows rows
+template <typename Weight>
+CsrGraph buildCsrGraph(size_t rows, const std::vector<std::pair<int, int>> &pairs,
+                       const std::vector<int> &rowOf, const Weight &weight) {
+  if (rows > INT32_MAX) throw std::invalid_argument("too many graph rows");
+  constexpr size_t kGrain = 1024;
+  ThreadPool &pool = ThreadPool::instance();
+
+  // Degrees, then reused as the next free slot of every row
+  std::unique_ptr<std::atomic<int64_t>[]> cursor(new std::atomic<int64_t>[rows]);
+  for (size_t r = 0; r < rows; r++) cursor[r].store(0, std::memory_order_relaxed);
+  pool.parallelFor(0, pairs.size(), [&](size_t p) {
+    cursor[rowOf[pairs[p].first]].fetch_add(1, std::memory_order_relaxed);
+    cursor[rowOf[pairs[p].second]].fetch_add(1, std::memory_order_relaxed);
+  }, kGrain);
+
+  CsrGraph graph;
+  graph.rowPointer.assign(rows + 1, 0);
+  for (size_t r = 0; r < rows; r++) {
+    int64_t degree = cursor[r].load(std::memory_order_relaxed);
+    cursor[r].store(graph.rowPointer[r], std::memory_order_relaxed);
+    graph.rowPointer[r + 1] = graph.rowPointer[r] + degree;
+  }
+  graph.column.resize(graph.rowPointer[rows]);
+  graph.value.resize(graph.rowPointer[rows]);
+
+  pool.parallelFor(0, pairs.size(), [&](size_t p) {
+    int32_t a = rowOf[pairs[p].first], b = rowOf[pairs[p].second];
+    float similarity = weight(p);
+    int64_t slot = cursor[a].fetch_add(1, std::memory_order_relaxed);
+    graph.column[slot] = b;
+    graph.value[slot] = similarity;
+    slot = cursor[b].fetch_add(1, std::memory_order_relaxed);
+    graph.column[slot] = a;
+    graph.value[slot] = similarity;
+  }, kGrain);
+
+  // The scatter order depends on the threads; sorting fixes it
+  pool.parallelFor(0, rows, [&](size_t r) {
+    int64_t begin = graph.rowPointer[r], end = graph.rowPointer[r + 1];
+    if (end - begin < 2) return;
+    thread_local std::vector<std::pair<int32_t, float>> entries;
+    entries.clear();
+    for (int64_t i = begin; i < end; i++) {
+      entries.emplace_back(graph.column[i], graph.value[i]);
+    }
+    std::sort(entries.begin(), entries.end());
+    for (int64_t i = begin; i < end; i++) {
+      graph.column[i] = entries[i - begin].first;
+      graph.value[i] = entries[i - begin].second;
+    }
+  }, 256);
+  return graph;
+}
+
+// The four files of the graph; base is the path without extension
+inline bool writeCsrGraph(const std::string &base, const CsrGraph &graph) {
+  NpyColumn<int64_t> indptr(base + ".indptr.npy", "<i8");
+  NpyColumn<int32_t> indices(base + ".indices.npy", "<i4");
+  NpyColumn<float> data(base + ".data.npy", "<f4");
+  NpyColumn<uint32_t> docs(base + ".docs.npy", "<u4");
+  if (!indptr.isOpen() || !indices.isOpen() || !data.isOpen() || !docs.isOpen()) {
+    return false;
+  }
+  indptr.pushAll(graph.rowPointer.data(), graph.rowPointer.size());
+  indices.pushAll(graph.column.data(), graph.column.size());
+  data.pushAll(graph.value.data(), graph.value.size());
+  docs.pushAll(graph.rowDocument.data(), graph.rowDocument.size());
+  bool ok = indptr.close();
+  ok = indices.close() && ok;
+  ok = data.close() && ok;
+  return docs.close() && ok;
+}
+
+// The similarity graph of the engines (--csr): document i is row rowOf[i]
+// (its rank, like the clusters) and is numbered numbers[i] in the docs
+// file, and pair p weighs weight(p), the similarity the CSV reports
+template <typename Weight>
+CsrGraph similarityGraph(const std::vector<int> &rowOf,
+                         const std::vector<int> &numbers,
+                         const std::vector<std::pair<int, int>> &pairs,
+                         const Weight &weight) {
+  CsrGraph graph = buildCsrGraph(rowOf.size(), pairs, rowOf, weight);
+  graph.rowDocument.resize(rowOf.size());
+  for (size_t i = 0; i < rowOf.size(); i++) {
+    graph.rowDocument[rowOf[i]] = static_cast<uint32_t>(numbers[i]);
+  }
+  return graph;
+}
+
+// The .npy files of the graph, named after filename without .csv
+inline void writeGraph(const std::string &filename, const CsrGraph &graph) {
+  std::string base = npyBase(filename);
+  if (!writeCsrGraph(base, graph)) {
+    std::cerr << "Error: Could not write the graph files " << base << ".*.npy"
+              << std::endl;
+    return;
+  }
+  std::cout << "Graph written to " << base
+            << ".{indptr,indices,data,docs}.npy" << std::endl;
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef COMMON_DICTIONARY_HPP
+#define COMMON_DICTIONARY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//---------------------------------------------------------------------------
+// Corpus-wide word dictionary
+//---------------------------------------------------------------------------
+// Interns every normalized word into a uint32 id so documents become id
+// streams and a k-shingle is just k integers. Safe to call from many
+// ingestion threads at once: words are spread over shards, each behind a
+// reader/writer lock, and a word already seen only takes the shared lock.
+//
+// The low kShardBits bits of an id name the shard and the rest index the
+// shard's word list, so ids are unique without a global counter. Which id a
+// word gets depends on the order threads reach it; only equality matters.
+class WordDictionary {
+ private:
+  static constexpr unsigned kShardBits = 6;
+  static constexpr size_t kShards = size_t(1) << kShardBits;
+
+  struct Shard {
+    mutable std::shared_mutex mutex;
+    std::unordered_map<std::string, uint32_t> ids;
+    std::vector<std::string> words;
+  };
+
+  Shard shards[kShards];
+
+ public:
+  uint32_t intern(const std::string &word) {
+    size_t h = std::hash<std::string>{}(word);
+    size_t s = (h >> 7) & (kShards - 1);
+    Shard &shard = shards[s];
+    {
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      auto it = shard.ids.find(word);
+      if (it != shard.ids.end()) return it->second;
+    }
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.ids.find(word);
+    if (it != shard.ids.end()) return it->second;
+    if (shard.words.size() >= (size_t(1) << (32 - kShardBits))) {
+      throw std::runtime_error("word dictionary is full");
+    }
+    uint32_t id = static_cast<uint32_t>((shard.words.size() << kShardBits) | s);
+    shard.words.push_back(word);
+    shard.ids.emplace(word, id);
+    return id;
+  }
+
+  std::string word(uint32_t id) const {
+    const Shard &shard = shards[id & (kShards - 1)];
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.words.at(id >> kShardBits);
+  }
+
+  size_t size() const {
+    size_t n = 0;
+    for (const Shard &shard : shards) {
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      n += shard.words.size();
+    }
+    return n;
+  }
+};
+
+#endif
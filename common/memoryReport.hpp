@@ -0,0 +1,333 @@
+#ifndef COMMON_MEMORY_REPORT_HPP
+#define COMMON_MEMORY_REPORT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "perfCounters.hpp"  // besideTimes
+
+//---------------------------------------------------------------------------
+// Memory accounting (--memory)
+//---------------------------------------------------------------------------
+// Two views of where the memory goes, written to <algorithm>Memory_*.csv
+// next to the times CSV:
+//
+//   structure  the estimated heap bytes of each main data structure (the
+//              documents' shingles and signatures, the band buckets, the
+//              forest nodes, the pairs), measured by the tools once it is
+//              built with heapBytes below. Count is its element count.
+//   peak rss   the peak resident set size while a Timer stage ran. Count is
+//              how many times the stage ran.
+//   rss        the resident set size when the stage last ended.
+//
+// The estimates follow libstdc++ and glibc malloc: a vector is its capacity,
+// a hash container one node per element plus its bucket array, and every
+// allocation is rounded up to malloc's chunk size. They do not walk into
+// the allocator, so they cost a pass over the structure and nothing while
+// it is built. A structure measured several times (the sweeps) keeps its
+// largest size.
+//
+// The peak RSS of a stage comes from VmHWM in /proc/self/status, which is
+// reset (write 5 to /proc/self/clear_refs) whenever a stage starts or ends
+// and folded into every stage open at the time. Where it cannot be reset a
+// stage's peak is the process peak so far. Stages opened before --memory
+// was seen (the tools' "time") report the process peak.
+
+// Bytes glibc's malloc takes for a request: an 8-byte header, 16-byte
+// alignment and a 32-byte minimum
+inline size_t allocationBytes(size_t bytes) {
+  if (bytes == 0) return 0;
+  return std::max<size_t>(32, (bytes + 8 + 15) & ~size_t(15));
+}
+
+// Heap bytes owned by a value, not counting sizeof the value itself
+template <typename T>
+typename std::enable_if<std::is_trivially_copyable<T>::value, size_t>::type
+heapBytes(const T &) {
+  return 0;
+}
+inline size_t heapBytes(const std::string &text);
+template <typename A, typename B>
+size_t heapBytes(const std::pair<A, B> &pair);
+template <typename T>
+size_t heapBytes(const std::optional<T> &value);
+template <typename T, typename Alloc>
+size_t heapBytes(const std::vector<T, Alloc> &values);
+template <typename K, typename H, typename E, typename Alloc>
+size_t heapBytes(const std::unordered_set<K, H, E, Alloc> &values);
+template <typename K, typename V, typename H, typename E, typename Alloc>
+size_t heapBytes(const std::unordered_map<K, V, H, E, Alloc> &values);
+template <typename K, typename C, typename Alloc>
+size_t heapBytes(const std::set<K, C, Alloc> &values);
+template <typename K, typename V, typename C, typename Alloc>
+size_t heapBytes(const std::map<K, V, C, Alloc> &values);
+
+namespace memory_detail {
+
+// Sum of heapBytes over a range, skipped for element types that own none
+template <typename T, typename Range>
+size_t elementBytes(const Range &range) {
+  if constexpr (std::is_trivially_copyable<T>::value) {
+    return 0;
+  } else {
+    size_t bytes = 0;
+    for (const auto &value : range) bytes += heapBytes(value);
+    return bytes;
+  }
+}
+
+// A hash container: its bucket array (inline while it has one bucket) and
+// a node per element holding the next pointer, the value and, unless the
+// key is arithmetic, the cached hash code
+template <typename Value, bool arithmeticKey, typename Container>
+size_t hashTableBytes(const Container &values) {
+  size_t buckets = values.bucket_count() > 1
+                       ? allocationBytes(values.bucket_count() * sizeof(void *))
+                       : 0;
+  size_t node = sizeof(void *) + sizeof(Value) +
+                (arithmeticKey ? 0 : sizeof(size_t));
+  return buckets + values.size() * allocationBytes(node) +
+         elementBytes<Value>(values);
+}
+
+// A red-black tree: a node per element with colour, parent and children
+template <typename Value, typename Container>
+size_t treeBytes(const Container &values) {
+  size_t node = 4 * sizeof(void *) + sizeof(Value);
+  return values.size() * allocationBytes(node) + elementBytes<Value>(values);
+}
+
+}  // namespace memory_detail
+
+// Beyond the small-string buffer of 15 characters
+inline size_t heapBytes(const std::string &text) {
+  return text.capacity() > 15 ? allocationBytes(text.capacity() + 1) : 0;
+}
+
+template <typename A, typename B>
+size_t heapBytes(const std::pair<A, B> &pair) {
+  return heapBytes(pair.first) + heapBytes(pair.second);
+}
+
+template <typename T>
+size_t heapBytes(const std::optional<T> &value) {
+  return value ? heapBytes(*value) : 0;
+}
+
+template <typename T, typename Alloc>
+size_t heapBytes(const std::vector<T, Alloc> &values) {
+  return allocationBytes(values.capacity() * sizeof(T)) +
+         memory_detail::elementBytes<T>(values);
+}
+
+template <typename K, typename H, typename E, typename Alloc>
+size_t heapBytes(const std::unordered_set<K, H, E, Alloc> &values) {
+  return memory_detail::hashTableBytes<K, std::is_arithmetic<K>::value>(values);
+}
+
+template <typename K, typename V, typename H, typename E, typename Alloc>
+size_t heapBytes(const std::unordered_map<K, V, H, E, Alloc> &values) {
+  return memory_detail::hashTableBytes<std::pair<const K, V>,
+                                       std::is_arithmetic<K>::value>(values);
+}
+
+template <typename K, typename C, typename Alloc>
+size_t heapBytes(const std::set<K, C, Alloc> &values) {
+  return memory_detail::treeBytes<K>(values);
+}
+
+template <typename K, typename V, typename C, typename Alloc>
+size_t heapBytes(const std::map<K, V, C, Alloc> &values) {
+  return memory_detail::treeBytes<std::pair<const K, V>>(values);
+}
+
+class MemoryReport {
+ private:
+  struct Structure {
+    size_t count = 0;
+    size_t bytes = 0;
+  };
+  struct Stage {
+    size_t runs = 0;
+    size_t peak = 0;
+    size_t rss = 0;  // At the end of the last run
+  };
+  struct OpenStage {
+    uint64_t id;
+    size_t peak;
+  };
+
+  std::atomic<bool> enabled{false};
+  bool resettable = false;  // VmHWM can be reset
+  std::mutex mutex;         // Everything below
+  uint64_t nextId = 1;
+  size_t processPeak = 0;
+  std::vector<OpenStage> open;
+  std::map<std::string, Structure> structures;
+  std::map<std::string, Stage> stages;
+
+  MemoryReport() = default;
+
+  // VmRSS and VmHWM in bytes
+  static bool readStatus(size_t &rss, size_t &peak) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    bool haveRss = false, havePeak = false;
+    while (std::getline(status, line)) {
+      if (line.compare(0, 6, "VmRSS:") == 0) {
+        rss = std::stoull(line.substr(6)) * 1024;
+        haveRss = true;
+      } else if (line.compare(0, 6, "VmHWM:") == 0) {
+        peak = std::stoull(line.substr(6)) * 1024;
+        havePeak = true;
+      }
+    }
+    return haveRss && havePeak;
+  }
+
+  static bool resetPeak() {
+    std::FILE *file = std::fopen("/proc/self/clear_refs", "w");
+    if (!file) return false;
+    bool ok = std::fputs("5", file) >= 0;
+    return std::fclose(file) == 0 && ok;
+  }
+
+  // Folds the peak since the last checkpoint into the open stages and
+  // starts a new interval; the current RSS
+  size_t checkpoint() {
+    size_t rss = 0, peak = 0;
+    if (!readStatus(rss, peak)) return 0;
+    processPeak = std::max(processPeak, peak);
+    for (OpenStage &stage : open) stage.peak = std::max(stage.peak, peak);
+    if (resettable) resetPeak();
+    return rss;
+  }
+
+ public:
+  static MemoryReport &instance() {
+    static MemoryReport report;
+    return report;
+  }
+
+  MemoryReport(const MemoryReport &) = delete;
+  MemoryReport &operator=(const MemoryReport &) = delete;
+
+  bool isEnabled() const { return enabled.load(std::memory_order_acquire); }
+
+  // False (with a warning) when the RSS cannot be read
+  bool enable() {
+    if (isEnabled()) return true;
+    size_t rss = 0, peak = 0;
+    if (!readStatus(rss, peak)) {
+      std::fprintf(stderr,
+                   "Warning: /proc/self/status is not readable, memory is not "
+                   "reported\n");
+      return false;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      processPeak = peak;
+      resettable = resetPeak();
+    }
+    if (!resettable) {
+      std::fprintf(stderr,
+                   "Warning: The peak RSS cannot be reset, every stage reports "
+                   "the process peak so far\n");
+    }
+    enabled.store(true, std::memory_order_release);
+    return true;
+  }
+
+  // A stage that starts now; its id for closeStage
+  uint64_t openStage() {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t rss = checkpoint();
+    open.push_back({nextId, rss});
+    return nextId++;
+  }
+
+  // Ends the stage id (0 for one opened before the report was enabled)
+  void closeStage(const std::string &name, uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t rss = checkpoint();
+    size_t peak = processPeak;
+    for (auto it = open.begin(); it != open.end(); ++it) {
+      if (it->id == id) {
+        peak = it->peak;
+        open.erase(it);
+        break;
+      }
+    }
+    Stage &stage = stages[name];
+    stage.runs++;
+    stage.peak = std::max(stage.peak, peak);
+    stage.rss = rss;
+  }
+
+  // The size of a structure, keeping the largest one seen under name
+  void structure(const std::string &name, size_t count, size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Structure &entry = structures[name];
+    if (bytes >= entry.bytes) entry = {count, bytes};
+  }
+
+  // Kind,Name,Count,Bytes; the file name is the times CSV's with Times
+  // replaced by Memory
+  bool writeCSV(const std::string &timesPath) {
+    if (!isEnabled()) return true;
+    std::ofstream file(besideTimes(timesPath, "Memory"));
+    if (!file.is_open()) return false;
+    file << "Kind,Name,Count,Bytes\n";
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &entry : structures) {
+      file << "structure," << entry.first << "," << entry.second.count << ","
+           << entry.second.bytes << "\n";
+    }
+    for (const auto &entry : stages) {
+      file << "peak rss," << entry.first << "," << entry.second.runs << ","
+           << entry.second.peak << "\n";
+    }
+    for (const auto &entry : stages) {
+      file << "rss," << entry.first << "," << entry.second.runs << ","
+           << entry.second.rss << "\n";
+    }
+    return file.good();
+  }
+};
+
+// Records the peak and final RSS of the stage name over its lifetime; name
+// is the Timer's stage name
+class StageMemory {
+ private:
+  const char *name;
+  uint64_t id = 0;  // 0 when the report was not enabled yet
+
+ public:
+  explicit StageMemory(const char *name) : name(name) {
+    MemoryReport &report = MemoryReport::instance();
+    if (report.isEnabled()) id = report.openStage();
+  }
+
+  StageMemory(const StageMemory &) = delete;
+  StageMemory &operator=(const StageMemory &) = delete;
+
+  ~StageMemory() {
+    MemoryReport &report = MemoryReport::instance();
+    if (report.isEnabled()) report.closeStage(name, id);
+  }
+};
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef COMMON_NPY_WRITER_HPP
+#define COMMON_NPY_WRITER_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "resultWriter.hpp"
+
+//---------------------------------------------------------------------------
+// Binary columnar pair output (--npy)
+//---------------------------------------------------------------------------
+// Instead of <name>.csv, a pair result is written as one NumPy .npy file
+// per column next to where the CSV would go:
+//
+//   <name>.doc1.npy   uint32   document number of the first document
+//   <name>.doc2.npy   uint32   document number of the second document
+//   <name>.sim.npy    float32  similarity
+//
+// (plus <name>.similar.npy, uint8, for LSHbase's IsSimilar column). Rows
+// are in the order of the CSV and a document without a number in its name
+// is 4294967295. Each file is a version 1.0 .npy: a 128-byte header whose
+// dictionary gives the dtype and the row count, then the raw little-endian
+// values, so numpy.load(path, mmap_mode='r') maps a column without copying
+// it. The row count is unknown while streaming; the header is written with
+// 0 rows and rewritten in place on close.
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "the .npy columns are written in host byte order");
+
+namespace npy_detail {
+
+constexpr size_t kHeaderSize = 128;  // Magic, version, length and dictionary
+
+inline std::string header(const char *descr, uint64_t rows) {
+  std::string dict = std::string("{'descr': '") + descr +
+                     "', 'fortran_order': False, 'shape': (" +
+                     std::to_string(rows) + ",), }";
+  std::string header("\x93NUMPY\x01\x00", 8);
+  uint16_t length = static_cast<uint16_t>(kHeaderSize - 10);
+  header.push_back(static_cast<char>(length & 0xff));
+  header.push_back(static_cast<char>(length >> 8));
+  header += dict;
+  header.append(kHeaderSize - 1 - header.size(), ' ');
+  header.push_back('\n');
+  return header;
+}
+
+}  // namespace npy_detail
+
+// One column, streamed through a ResultWriter
+template <typename T>
+class NpyColumn {
+ private:
+  std::string path;
+  const char *descr;
+  uint64_t rows = 0;
+  ResultWriter out;
+
+ public:
+  NpyColumn(const std::string &path, const char *descr)
+      : path(path), descr(descr), out(path) {
+    if (out.isOpen()) out.append(npy_detail::header(descr, 0));
+  }
+
+  bool isOpen() const { return out.isOpen(); }
+
+  void push(T value) {
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    out.append(std::string_view(bytes, sizeof(T)));
+    rows++;
+  }
+
+  // A whole array, handed over in slices so no chunk grows past its size
+  void pushAll(const T *values, size_t count) {
+    constexpr size_t kSlice = (1 << 16) / sizeof(T);
+    for (size_t start = 0; start < count; start += kSlice) {
+      size_t n = std::min(kSlice, count - start);
+      out.append(std::string_view(reinterpret_cast<const char *>(values + start),
+                                  n * sizeof(T)));
+    }
+    rows += count;
+  }
+
+  // Flushes the values and writes the final row count into the header
+  bool close() {
+    if (!out.close()) return false;
+    std::FILE *file = std::fopen(path.c_str(), "r+b");
+    if (!file) return false;
+    std::string final = npy_detail::header(descr, rows);
+    bool ok = std::fwrite(final.data(), 1, final.size(), file) == final.size();
+    return std::fclose(file) == 0 && ok;
+  }
+};
+
+// The doc1/doc2/sim columns of a pair result; base is the CSV path without
+// its .csv extension
+class PairNpyWriter {
+ private:
+  NpyColumn<uint32_t> doc1;
+  NpyColumn<uint32_t> doc2;
+  NpyColumn<float> sim;
+
+ public:
+  explicit PairNpyWriter(const std::string &base)
+      : doc1(base + ".doc1.npy", "<u4"),
+        doc2(base + ".doc2.npy", "<u4"),
+        sim(base + ".sim.npy", "<f4") {}
+
+  bool isOpen() const { return doc1.isOpen() && doc2.isOpen() && sim.isOpen(); }
+
+  // Document numbers as the CSVs print them; -1 (no number) is stored as
+  // UINT32_MAX
+  void add(long long number1, long long number2, float similarity) {
+    doc1.push(static_cast<uint32_t>(number1));
+    doc2.push(static_cast<uint32_t>(number2));
+    sim.push(similarity);
+  }
+
+  bool close() {
+    bool ok = doc1.close();
+    ok = doc2.close() && ok;
+    return sim.close() && ok;
+  }
+};
+
+// The CSV path without .csv, for the column files
+inline std::string npyBase(const std::string &csvPath) {
+  const std::string extension = ".csv";
+  if (csvPath.size() >= extension.size() &&
+      csvPath.compare(csvPath.size() - extension.size(), extension.size(),
+                      extension) == 0) {
+    return csvPath.substr(0, csvPath.size() - extension.size());
+  }
+  return csvPath;
+}
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef COMMON_OPTIONS_HPP
+#define COMMON_OPTIONS_HPP
+
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------------------------
+// Command line options
+//---------------------------------------------------------------------------
+// The tools keep their positional arguments (<corpus_dir> <k> <t> ...) and
+// accept optional "--name value" pairs or bare "--flag" switches after them.
+// A "--name" followed by another "--" token (or by nothing) is a switch.
+struct Options {
+  std::vector<std::string> positional;
+  std::map<std::string, std::string> named;
+
+  bool has(const std::string &name) const { return named.count(name) > 0; }
+
+  std::string get(const std::string &name, const std::string &def = "") const {
+    auto it = named.find(name);
+    return it == named.end() ? def : it->second;
+  }
+
+  int getInt(const std::string &name, int def) const {
+    auto it = named.find(name);
+    if (it == named.end() || it->second.empty()) return def;
+    return std::stoi(it->second);
+  }
+
+  // Like getInt, but the value must be a whole positive number; throws
+  // invalid_argument naming the option otherwise
+  int getPositiveInt(const std::string &name, int def) const {
+    auto it = named.find(name);
+    if (it == named.end() || it->second.empty()) return def;
+    size_t used = 0;
+    int value = 0;
+    try {
+      value = std::stoi(it->second, &used);
+    } catch (const std::exception &) {
+      used = 0;
+    }
+    if (used != it->second.size() || value <= 0) {
+      throw std::invalid_argument("--" + name +
+                                  " must be a positive integer, not " +
+                                  it->second);
+    }
+    return value;
+  }
+
+  float getFloat(const std::string &name, float def) const {
+    auto it = named.find(name);
+    if (it == named.end() || it->second.empty()) return def;
+    return std::stof(it->second);
+  }
+
+  // Comma-separated values ("--name 1,2,3"); empty when not given
+  std::vector<std::string> getList(const std::string &name) const {
+    std::vector<std::string> values;
+    auto it = named.find(name);
+    if (it == named.end()) return values;
+    size_t start = 0;
+    while (start <= it->second.size()) {
+      size_t comma = it->second.find(',', start);
+      if (comma == std::string::npos) comma = it->second.size();
+      if (comma > start) values.push_back(it->second.substr(start, comma - start));
+      start = comma + 1;
+    }
+    return values;
+  }
+};
+
+inline Options parseOptions(int argc, char *argv[]) {
+  Options opts;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg.size() > 2 && arg.compare(0, 2, "--") == 0) {
+      std::string name = arg.substr(2);
+      std::string value;
+      size_t eq = name.find('=');
+      if (eq != std::string::npos) {
+        value = name.substr(eq + 1);
+        name = name.substr(0, eq);
+      } else if (i + 1 < argc && std::string(argv[i + 1]).compare(0, 2, "--") != 0) {
+        value = argv[++i];
+      }
+      opts.named[name] = value;
+    } else {
+      opts.positional.push_back(arg);
+    }
+  }
+  return opts;
+}
+
+#endif
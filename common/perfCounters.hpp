@@ -0,0 +1,287 @@
+#ifndef COMMON_PERF_COUNTERS_HPP
+#define COMMON_PERF_COUNTERS_HPP
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+//---------------------------------------------------------------------------
+// Hardware performance counters (--perf-counters)
+//---------------------------------------------------------------------------
+// Cycles, instructions, cache misses and branch misses (plus task clock and
+// page faults, which are software counters the kernel always has) per
+// Timer stage, read through Linux perf_event_open.
+//
+// A perf counter follows one thread, so every thread that does work opens
+// its own: the main thread when counting starts, pool workers before
+// running a task and pipeline workers when they start. The counters stay
+// open until exit; one of a finished thread still reads its final value.
+// A stage's sample is the difference, over the stage, of the sum over all
+// threads, so work the main thread hands to the pool is counted in the
+// stage that waits for it. Values are scaled by enabled / running time
+// when the kernel multiplexes counters.
+//
+// Counters that cannot be opened (no PMU in a VM, perf_event_paranoid,
+// other systems) are left out of the sums and reported as empty fields; if
+// none can be opened counting is switched off with a warning.
+//
+// The totals are per stage name for the whole process, so in the parameter
+// sweeps a stage accumulates over the combinations run so far.
+
+// The path of a per-stage report next to the times CSV: Times in the file
+// name replaced by kind, or .<kind>.csv appended when it has no Times
+inline std::string besideTimes(const std::string &timesPath,
+                               const std::string &kind) {
+  std::string path = timesPath;
+  size_t slash = path.find_last_of('/');
+  size_t at = path.rfind("Times");
+  if (at != std::string::npos && (slash == std::string::npos || at > slash)) {
+    path.replace(at, 5, kind);
+  } else {
+    path += "." + kind + ".csv";
+  }
+  return path;
+}
+
+enum PerfEvent {
+  kCycles,
+  kInstructions,
+  kCacheMisses,
+  kBranchMisses,
+  kTaskClock,
+  kPageFaults,
+  kPerfEvents
+};
+
+struct PerfSample {
+  std::array<double, kPerfEvents> value{};
+
+  PerfSample &operator+=(const PerfSample &other) {
+    for (int e = 0; e < kPerfEvents; e++) value[e] += other.value[e];
+    return *this;
+  }
+  PerfSample operator-(const PerfSample &other) const {
+    PerfSample difference;
+    for (int e = 0; e < kPerfEvents; e++) {
+      difference.value[e] = value[e] - other.value[e];
+    }
+    return difference;
+  }
+};
+
+class PerfCounters {
+ private:
+  struct ThreadCounters {
+    std::array<int, kPerfEvents> fd;
+  };
+
+  std::atomic<bool> counting{false};
+  std::array<bool, kPerfEvents> available{};  // Opened on the main thread
+  std::mutex mutex;                           // threads and totals
+  std::vector<ThreadCounters> threads;
+  std::map<std::string, PerfSample> totals;
+
+  PerfCounters() = default;
+
+#ifdef __linux__
+  static int open(PerfEvent event) {
+    static const std::pair<uint32_t, uint64_t> kinds[kPerfEvents] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    };
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = kinds[event].first;
+    attr.config = kinds[event].second;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_kernel = 1;  // Allowed at the default perf_event_paranoid
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+  }
+
+  static double readScaled(int fd) {
+    uint64_t data[3];  // Value, time enabled, time running
+    if (::read(fd, data, sizeof(data)) != sizeof(data) || data[2] == 0) {
+      return 0;
+    }
+    return data[2] < data[1] ? data[0] * (double(data[1]) / data[2]) : data[0];
+  }
+#else
+  static int open(PerfEvent) {
+    errno = ENOSYS;
+    return -1;
+  }
+  static double readScaled(int) { return 0; }
+#endif
+
+  static bool &attachedHere() {
+    static thread_local bool attached = false;
+    return attached;
+  }
+
+  // Opens the counters of the calling thread
+  void openThread() {
+    attachedHere() = true;
+    ThreadCounters counters;
+    for (int e = 0; e < kPerfEvents; e++) {
+      counters.fd[e] = available[e] ? open(static_cast<PerfEvent>(e)) : -1;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    threads.push_back(counters);
+  }
+
+ public:
+  static PerfCounters &instance() {
+    static PerfCounters counters;
+    return counters;
+  }
+
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  static const char *eventName(int event) {
+    static const char *const names[kPerfEvents] = {
+        "Cycles", "Instructions", "CacheMisses",
+        "BranchMisses", "TaskClock(ns)", "PageFaults"};
+    return names[event];
+  }
+
+  bool isCounting() const { return counting.load(std::memory_order_acquire); }
+  bool isAvailable(int event) const { return available[event]; }
+
+  // Starts counting on the calling thread and, from then on, on every
+  // thread that attaches. False (with a warning) when no counter opens.
+  bool start() {
+    if (isCounting()) return true;
+    std::string failures;
+    bool any = false;
+    for (int e = 0; e < kPerfEvents; e++) {
+      int fd = open(static_cast<PerfEvent>(e));
+      available[e] = fd >= 0;
+      if (fd >= 0) {
+        any = true;
+#ifdef __linux__
+        ::close(fd);
+#endif
+      } else {
+        failures += std::string(failures.empty() ? "" : ", ") + eventName(e) +
+                    " (" + std::strerror(errno) + ")";
+      }
+    }
+    if (!any) {
+      std::fprintf(stderr,
+                   "Warning: No performance counter could be opened: %s. "
+                   "Counting is off.\n",
+                   failures.c_str());
+      return false;
+    }
+    if (!failures.empty()) {
+      std::fprintf(stderr, "Warning: Performance counters not available: %s\n",
+                   failures.c_str());
+    }
+    openThread();
+    counting.store(true, std::memory_order_release);
+    return true;
+  }
+
+  // Opens the calling thread's counters once; a no-op when not counting
+  static void attachThread() {
+    if (attachedHere()) return;
+    PerfCounters &counters = instance();
+    if (counters.isCounting()) counters.openThread();
+  }
+
+  // The counters summed over every thread so far
+  PerfSample read() {
+    PerfSample sample;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const ThreadCounters &counters : threads) {
+      for (int e = 0; e < kPerfEvents; e++) {
+        if (counters.fd[e] >= 0) sample.value[e] += readScaled(counters.fd[e]);
+      }
+    }
+    return sample;
+  }
+
+  void add(const std::string &stage, const PerfSample &sample) {
+    std::lock_guard<std::mutex> lock(mutex);
+    totals[stage] += sample;
+  }
+
+  // Operation,<events> per stage, empty where a counter is not available;
+  // the file name is the times CSV's with Times replaced by Counters
+  bool writeCSV(const std::string &timesPath) {
+    if (!isCounting()) return true;
+    std::ofstream file(besideTimes(timesPath, "Counters"));
+    if (!file.is_open()) return false;
+    file << "Operation";
+    for (int e = 0; e < kPerfEvents; e++) file << "," << eventName(e);
+    file << ",IPC\n" << std::fixed << std::setprecision(0);
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &stage : totals) {
+      const PerfSample &sample = stage.second;
+      file << stage.first;
+      for (int e = 0; e < kPerfEvents; e++) {
+        file << ",";
+        if (available[e]) file << sample.value[e];
+      }
+      file << ",";
+      if (available[kCycles] && available[kInstructions] &&
+          sample.value[kCycles] > 0) {
+        file << std::setprecision(3)
+             << sample.value[kInstructions] / sample.value[kCycles]
+             << std::setprecision(0);
+      }
+      file << "\n";
+    }
+    return file.good();
+  }
+};
+
+// Adds the counters over its lifetime to the stage's totals; name is the
+// Timer's stage name. A stage that was open when counting started (the
+// tools' "time") gets the counts from then on.
+class StageCounters {
+ private:
+  const char *name;
+  PerfSample startSample;  // Zero when not counting yet
+
+ public:
+  explicit StageCounters(const char *name) : name(name) {
+    if (PerfCounters::instance().isCounting()) {
+      startSample = PerfCounters::instance().read();
+    }
+  }
+
+  StageCounters(const StageCounters &) = delete;
+  StageCounters &operator=(const StageCounters &) = delete;
+
+  ~StageCounters() {
+    PerfCounters &counters = PerfCounters::instance();
+    if (counters.isCounting()) counters.add(name, counters.read() - startSample);
+  }
+};
+
+#endif
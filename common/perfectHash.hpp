@@ -0,0 +1,127 @@
+#ifndef COMMON_PERFECT_HASH_HPP
+#define COMMON_PERFECT_HASH_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------------------------
+// Minimal perfect hashing (hash and displace)
+//---------------------------------------------------------------------------
+// n keys go to n slots with no collisions: a first hash picks a bucket, the
+// bucket's displacement seeds a second hash that picks the slot. Buckets
+// holding a single key store their slot directly (high bit set). A lookup is
+// one or two hashes and one memcmp against the key stored in the slot.
+constexpr uint32_t kDirectSlot = 0x80000000u;
+
+// Seeded FNV-1a followed by the murmur3 finalizer
+constexpr uint32_t perfectHash(const char *s, size_t n, uint32_t seed) {
+  uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+  for (size_t i = 0; i < n; i++) {
+    h ^= static_cast<unsigned char>(s[i]);
+    h *= 16777619u;
+  }
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+constexpr size_t perfectHashSlot(const char *s, size_t n,
+                                 const uint32_t *displacement, size_t buckets,
+                                 size_t slots) {
+  uint32_t d = displacement[perfectHash(s, n, 0) % buckets];
+  return (d & kDirectSlot) ? (d & ~kDirectSlot) : perfectHash(s, n, d) % slots;
+}
+
+// Runtime-built table, used for custom lists and by the table generator
+class PerfectHashSet {
+ private:
+  std::vector<uint32_t> displacement;
+  std::vector<std::string> keys;  // indexed by slot
+
+ public:
+  PerfectHashSet() = default;
+
+  template <typename Container>
+  explicit PerfectHashSet(const Container &words) {
+    std::vector<std::string> unique(words.begin(), words.end());
+    std::sort(unique.begin(), unique.end());
+    unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+    if (unique.empty()) return;
+
+    size_t n = unique.size();
+    size_t buckets = std::max<size_t>(1, n / 2);
+    std::vector<std::vector<size_t>> members(buckets);
+    for (size_t i = 0; i < n; i++) {
+      const std::string &w = unique[i];
+      members[perfectHash(w.data(), w.size(), 0) % buckets].push_back(i);
+    }
+
+    // Place the biggest buckets first, while the table is still empty
+    std::vector<size_t> order(buckets);
+    for (size_t b = 0; b < buckets; b++) order[b] = b;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return members[a].size() > members[b].size();
+    });
+
+    displacement.assign(buckets, 0);
+    keys.assign(n, std::string());
+    std::vector<char> used(n, 0);
+    size_t nextFree = 0;
+    for (size_t b : order) {
+      const std::vector<size_t> &bucket = members[b];
+      if (bucket.empty()) break;
+      if (bucket.size() == 1) {
+        while (used[nextFree]) nextFree++;
+        used[nextFree] = 1;
+        keys[nextFree] = unique[bucket[0]];
+        displacement[b] = kDirectSlot | static_cast<uint32_t>(nextFree);
+        continue;
+      }
+      for (uint32_t d = 1;; d++) {
+        if (d == kDirectSlot) {
+          throw std::runtime_error("perfect hash construction failed");
+        }
+        std::vector<size_t> slots;
+        bool ok = true;
+        for (size_t i : bucket) {
+          const std::string &w = unique[i];
+          size_t slot = perfectHash(w.data(), w.size(), d) % n;
+          if (used[slot] ||
+              std::find(slots.begin(), slots.end(), slot) != slots.end()) {
+            ok = false;
+            break;
+          }
+          slots.push_back(slot);
+        }
+        if (!ok) continue;
+        for (size_t j = 0; j < bucket.size(); j++) {
+          used[slots[j]] = 1;
+          keys[slots[j]] = unique[bucket[j]];
+        }
+        displacement[b] = d;
+        break;
+      }
+    }
+  }
+
+  bool contains(const char *s, size_t n) const {
+    if (keys.empty()) return false;
+    const std::string &key = keys[perfectHashSlot(
+        s, n, displacement.data(), displacement.size(), keys.size())];
+    return key.size() == n && std::memcmp(key.data(), s, n) == 0;
+  }
+
+  size_t size() const { return keys.size(); }
+  const std::vector<uint32_t> &displacements() const { return displacement; }
+  const std::vector<std::string> &slotKeys() const { return keys; }
+};
+
+#endif
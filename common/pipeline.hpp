@@ -0,0 +1,166 @@
+#ifndef COMMON_PIPELINE_HPP
+#define COMMON_PIPELINE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "perfCounters.hpp"
+#include "profiler.hpp"
+
+//---------------------------------------------------------------------------
+// Bounded lock-free queue
+//---------------------------------------------------------------------------
+// Multi-producer / multi-consumer ring buffer (Vyukov). Every cell carries a
+// sequence number telling whether it is ready to be written or read, so
+// producers and consumers only contend on their own position counter.
+// Values are moved in and out, never copied.
+template <typename T>
+class BoundedQueue {
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T data;
+  };
+
+  std::unique_ptr<Cell[]> buffer;
+  size_t mask;
+  alignas(64) std::atomic<size_t> enqueuePos;
+  alignas(64) std::atomic<size_t> dequeuePos;
+  alignas(64) std::atomic<bool> closed;
+
+ public:
+  static constexpr size_t kMaxCapacity = size_t(1) << 30;
+
+  // Capacity is rounded up to the next power of two, at most kMaxCapacity
+  explicit BoundedQueue(size_t capacity)
+      : enqueuePos(0), dequeuePos(0), closed(false) {
+    capacity = std::min(capacity, kMaxCapacity);
+    size_t size = 2;
+    while (size < capacity) size <<= 1;
+    buffer.reset(new Cell[size]);
+    mask = size - 1;
+    for (size_t i = 0; i < size; i++) {
+      buffer[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  BoundedQueue(const BoundedQueue &) = delete;
+  BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+  // Moves value into the queue; returns false (value untouched) when full
+  bool tryPush(T &value) {
+    size_t pos = enqueuePos.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+      cell = &buffer[pos & mask];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueuePos.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;  // full
+      } else {
+        pos = enqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+    cell->data = std::move(value);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Moves the oldest value out of the queue; returns false when empty
+  bool tryPop(T &value) {
+    size_t pos = dequeuePos.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+      cell = &buffer[pos & mask];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff =
+          static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (dequeuePos.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;  // empty
+      } else {
+        pos = dequeuePos.load(std::memory_order_relaxed);
+      }
+    }
+    value = std::move(cell->data);
+    cell->sequence.store(pos + mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Blocking push: yields while the consumers catch up
+  void push(T value) {
+    while (!tryPush(value)) std::this_thread::yield();
+  }
+
+  // Blocking pop: returns false once the queue is closed and drained
+  bool pop(T &value) {
+    while (true) {
+      if (tryPop(value)) return true;
+      if (closed.load(std::memory_order_acquire)) return tryPop(value);
+      std::this_thread::yield();
+    }
+  }
+
+  // Called by the last producer; consumers drain what is left and stop
+  void close() { closed.store(true, std::memory_order_release); }
+};
+
+//---------------------------------------------------------------------------
+// Pipeline stages
+//---------------------------------------------------------------------------
+// Per-stage thread counts for the read -> tokenize -> sign pipeline
+struct PipelineConfig {
+  unsigned ioThreads = 1;
+  unsigned tokenizeThreads = 1;
+  unsigned signThreads = 1;
+  size_t queueCapacity = 64;
+
+  // Split `cores` between the two CPU-bound stages
+  static PipelineConfig defaults(
+      unsigned cores = std::thread::hardware_concurrency()) {
+    PipelineConfig config;
+    cores = std::max(1u, cores);
+    config.tokenizeThreads = std::max(1u, cores / 2);
+    config.signThreads = std::max(1u, cores - config.tokenizeThreads);
+    return config;
+  }
+};
+
+// Launches `threads` workers running work(); the last worker to return runs
+// onLastExit(), which is where a stage closes its downstream queue. Every
+// worker's run is a profiler scope called name.
+template <typename Work, typename Done>
+void launchStage(std::vector<std::thread> &workers, unsigned threads,
+                 const char *name, Work work, Done onLastExit) {
+  threads = std::max(1u, threads);
+  auto remaining = std::make_shared<std::atomic<unsigned>>(threads);
+  for (unsigned i = 0; i < threads; i++) {
+    workers.emplace_back([name, work, onLastExit, remaining]() mutable {
+      PerfCounters::attachThread();
+      {
+        ProfileScope scope(name);
+        work();
+      }
+      if (remaining->fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        onLastExit();
+      }
+    });
+  }
+}
+
+#endif
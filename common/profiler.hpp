@@ -0,0 +1,238 @@
+#ifndef COMMON_PROFILER_HPP
+#define COMMON_PROFILER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+//---------------------------------------------------------------------------
+// Scoped profiler (--trace FILE)
+//---------------------------------------------------------------------------
+// A ProfileScope times the block it lives in, in nanoseconds on the steady
+// clock. Every thread appends its finished scopes to a log of its own, so
+// recording takes no lock and worker threads can open scopes as freely as
+// the main thread. The logs belong to the profiler and outlive their
+// threads; they are merged when the trace is written at exit, once the work
+// is done.
+//
+// Scopes nest: at exit the hierarchy of every thread is rebuilt from which
+// scopes contain which, so "sign" inside "index build" inside "time" is the
+// stage "time/index build/sign". The tools' Timer opens a scope under its
+// CSV name, and finer scopes are opened inside it.
+//
+// With --trace FILE the tools write FILE as a Chrome trace-event JSON
+// (chrome://tracing, ui.perfetto.dev): one complete event per scope on the
+// thread that ran it. Next to it, FILE with .json replaced by .stages.csv
+// gets Stage,Count,Total(ns),Mean(ns) for every stage path. Without
+// --trace scopes are still timed, which is what the Timer reads, but
+// nothing is kept.
+
+struct ProfileEvent {
+  const char *name;
+  int64_t start;     // Nanoseconds since the profiler started
+  int64_t duration;  // Nanoseconds
+};
+
+class Profiler {
+ private:
+  struct ThreadLog {
+    uint32_t thread;
+    std::vector<ProfileEvent> events;
+  };
+
+  const std::chrono::steady_clock::time_point origin =
+      std::chrono::steady_clock::now();
+  std::atomic<bool> recording{false};
+  std::mutex mutex;  // logs, names and tracePath
+  std::vector<std::unique_ptr<ThreadLog>> logs;
+  std::set<std::string> names;
+  std::string tracePath;
+
+  Profiler() = default;
+
+  // This thread's log, registered on first use
+  ThreadLog &local() {
+    thread_local ThreadLog *log = nullptr;
+    if (!log) {
+      std::lock_guard<std::mutex> lock(mutex);
+      logs.emplace_back(new ThreadLog());
+      logs.back()->thread = static_cast<uint32_t>(logs.size() - 1);
+      log = logs.back().get();
+    }
+    return *log;
+  }
+
+  static std::string escape(const char *text) {
+    std::string escaped;
+    for (const char *c = text; *c; c++) {
+      if (*c == '"' || *c == '\\') {
+        escaped += '\\';
+        escaped += *c;
+      } else if (static_cast<unsigned char>(*c) >= 0x20) {
+        escaped += *c;
+      }
+    }
+    return escaped;
+  }
+
+  // Stage path of every event of a log, from which events contain which
+  static std::vector<std::string> stagePaths(std::vector<ProfileEvent> &events) {
+    std::sort(events.begin(), events.end(),
+              [](const ProfileEvent &a, const ProfileEvent &b) {
+                if (a.start != b.start) return a.start < b.start;
+                return a.duration > b.duration;  // Parent first
+              });
+    std::vector<std::string> paths(events.size());
+    std::vector<size_t> open;  // Enclosing events, innermost last
+    for (size_t i = 0; i < events.size(); i++) {
+      while (!open.empty() && events[open.back()].start +
+                                      events[open.back()].duration <=
+                                  events[i].start) {
+        open.pop_back();
+      }
+      paths[i] = open.empty() ? events[i].name
+                              : paths[open.back()] + "/" + events[i].name;
+      open.push_back(i);
+    }
+    return paths;
+  }
+
+  static void writeAtExit() {
+    Profiler &profiler = instance();
+    if (!profiler.write(profiler.tracePath)) {
+      std::fprintf(stderr, "Error: Could not write the trace %s\n",
+                   profiler.tracePath.c_str());
+    }
+  }
+
+ public:
+  static Profiler &instance() {
+    static Profiler profiler;
+    return profiler;
+  }
+
+  Profiler(const Profiler &) = delete;
+  Profiler &operator=(const Profiler &) = delete;
+
+  int64_t now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - origin)
+        .count();
+  }
+
+  bool isRecording() const {
+    return recording.load(std::memory_order_relaxed);
+  }
+
+  // A lasting copy of a name built at run time
+  const char *intern(const std::string &name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return names.insert(name).first->c_str();
+  }
+
+  void record(const char *name, int64_t start, int64_t end) {
+    local().events.push_back({name, start, end - start});
+  }
+
+  // Keeps every scope from now on and writes them to path at exit. The
+  // calling thread is thread 0 of the trace.
+  void traceTo(const std::string &path) {
+    local();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (tracePath.empty()) std::atexit(writeAtExit);
+      tracePath = path;
+    }
+    recording.store(true, std::memory_order_relaxed);
+  }
+
+  // The trace JSON at path and the stage totals next to it; the threads
+  // that recorded must be done
+  bool write(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ofstream trace(path);
+    if (!trace.is_open()) return false;
+    std::map<std::string, std::pair<uint64_t, int64_t>> stages;  // Count, total
+    trace << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    trace << std::fixed << std::setprecision(3);
+    bool first = true;
+    for (auto &log : logs) {
+      trace << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\","
+            << "\"pid\":1,\"tid\":" << log->thread << ",\"args\":{\"name\":\""
+            << (log->thread == 0 ? std::string("main")
+                                 : "worker " + std::to_string(log->thread))
+            << "\"}}";
+      first = false;
+      std::vector<std::string> paths = stagePaths(log->events);
+      for (size_t i = 0; i < log->events.size(); i++) {
+        const ProfileEvent &event = log->events[i];
+        trace << ",\n{\"name\":\"" << escape(event.name)
+              << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << log->thread
+              << ",\"ts\":" << event.start / 1000.0
+              << ",\"dur\":" << event.duration / 1000.0 << "}";
+        auto &stage = stages[paths[i]];
+        stage.first++;
+        stage.second += event.duration;
+      }
+    }
+    trace << "\n]}\n";
+    if (!trace.good()) return false;
+
+    std::string base = path;
+    const std::string extension = ".json";
+    if (base.size() >= extension.size() &&
+        base.compare(base.size() - extension.size(), extension.size(),
+                     extension) == 0) {
+      base.resize(base.size() - extension.size());
+    }
+    std::ofstream summary(base + ".stages.csv");
+    if (!summary.is_open()) return false;
+    summary << "Stage,Count,Total(ns),Mean(ns)\n";
+    for (const auto &stage : stages) {
+      summary << stage.first << "," << stage.second.first << ","
+              << stage.second.second << ","
+              << stage.second.second / static_cast<int64_t>(stage.second.first)
+              << "\n";
+    }
+    return summary.good();
+  }
+};
+
+// Times the enclosing block; name must outlive the profiler (a literal, or
+// Profiler::intern)
+class ProfileScope {
+ private:
+  const char *name;
+  int64_t start;
+
+ public:
+  explicit ProfileScope(const char *name)
+      : name(name), start(Profiler::instance().now()) {}
+
+  ProfileScope(const ProfileScope &) = delete;
+  ProfileScope &operator=(const ProfileScope &) = delete;
+
+  ~ProfileScope() {
+    Profiler &profiler = Profiler::instance();
+    if (profiler.isRecording()) profiler.record(name, start, profiler.now());
+  }
+
+  // Milliseconds since the scope was opened
+  double elapsedMs() const {
+    return (Profiler::instance().now() - start) / 1e6;
+  }
+};
+
+#endif
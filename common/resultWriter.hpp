@@ -0,0 +1,125 @@
+#ifndef COMMON_RESULT_WRITER_HPP
+#define COMMON_RESULT_WRITER_HPP
+
+#include <charconv>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+//---------------------------------------------------------------------------
+// Result writer
+//---------------------------------------------------------------------------
+// Result CSVs can run to billions of rows (every pair of a 50k document
+// corpus), so rows are formatted with std::to_chars into plain strings and
+// appended to large chunks instead of going through ofstream (locale,
+// manipulators and the flush of every endl). A full chunk is handed to a
+// background thread that writes it while the next one fills; at most
+// maxQueued chunks wait, which bounds memory when the disk is slower than
+// the formatting. Chunks are recycled, so a long run allocates only a few.
+
+// Field formatting, appended to row
+inline void appendInt(std::string &row, long long value) {
+  char digits[24];
+  auto result = std::to_chars(digits, digits + sizeof(digits), value);
+  row.append(digits, result.ptr);
+}
+
+// Fixed notation with precision decimals, like fixed << setprecision(p)
+inline void appendFixed(std::string &row, double value, int precision = 6) {
+  char digits[64];
+  auto result = std::to_chars(digits, digits + sizeof(digits), value,
+                              std::chars_format::fixed, precision);
+  row.append(digits, result.ptr);
+}
+
+class ResultWriter {
+ private:
+  std::FILE *file = nullptr;
+  size_t chunkSize;
+  size_t maxQueued;
+  std::string current;              // Chunk being filled
+  std::deque<std::string> pending;  // Full chunks waiting to be written
+  std::vector<std::string> spare;   // Written chunks, ready for reuse
+  std::mutex mutex;
+  std::condition_variable ready;    // A chunk is pending or closing
+  std::condition_variable drained;  // A pending chunk was written
+  bool closing = false;
+  bool failed = false;
+  std::thread writer;
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      ready.wait(lock, [&] { return closing || !pending.empty(); });
+      if (pending.empty()) return;  // Closing with nothing left
+      std::string chunk = std::move(pending.front());
+      pending.pop_front();
+      lock.unlock();
+      bool ok = std::fwrite(chunk.data(), 1, chunk.size(), file) == chunk.size();
+      chunk.clear();
+      lock.lock();
+      if (!ok) failed = true;
+      spare.push_back(std::move(chunk));
+      drained.notify_one();
+    }
+  }
+
+  void handOff() {
+    std::unique_lock<std::mutex> lock(mutex);
+    drained.wait(lock, [&] { return pending.size() < maxQueued; });
+    pending.push_back(std::move(current));
+    if (!spare.empty()) {
+      current = std::move(spare.back());
+      spare.pop_back();
+    } else {
+      current = std::string();
+      current.reserve(chunkSize);
+    }
+    ready.notify_one();
+  }
+
+ public:
+  explicit ResultWriter(const std::string &path, size_t chunkSize = 8 << 20,
+                        size_t maxQueued = 4)
+      : chunkSize(chunkSize), maxQueued(maxQueued) {
+    file = std::fopen(path.c_str(), "wb");
+    if (!file) return;
+    std::setvbuf(file, nullptr, _IONBF, 0);  // Chunks are already large
+    current.reserve(chunkSize);
+    writer = std::thread([this] { run(); });
+  }
+
+  ResultWriter(const ResultWriter &) = delete;
+  ResultWriter &operator=(const ResultWriter &) = delete;
+
+  ~ResultWriter() { close(); }
+
+  bool isOpen() const { return file != nullptr; }
+
+  void append(std::string_view text) {
+    current.append(text.data(), text.size());
+    if (current.size() >= chunkSize) handOff();
+  }
+
+  // Writes what is left and closes the file; false if any write failed
+  bool close() {
+    if (!file) return !failed;
+    if (!current.empty()) handOff();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closing = true;
+    }
+    ready.notify_one();
+    writer.join();
+    if (std::fclose(file) != 0) failed = true;
+    file = nullptr;
+    return !failed;
+  }
+};
+
+#endif
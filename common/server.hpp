@@ -0,0 +1,157 @@
+#ifndef COMMON_SERVER_HPP
+#define COMMON_SERVER_HPP
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+//---------------------------------------------------------------------------
+// Line protocol server
+//---------------------------------------------------------------------------
+// Keeps an index resident and answers one request per line, either on
+// stdin/stdout or on a Unix domain socket (several clients at once, one
+// thread each). The engine supplies a handler that turns a request line into
+// its complete response. A few commands are answered here:
+//
+//   PING      -> PONG
+//   QUIT      closes this connection (ends the loop on stdin)
+//   SHUTDOWN  stops the server
+//
+// Handlers run concurrently on the socket, so they may only read the index.
+using RequestHandler = std::function<std::string(const std::string &)>;
+
+namespace server_detail {
+
+// Shared part of both transports; false when the connection should close
+inline bool answer(const std::string &request, const RequestHandler &handler,
+                   std::string &response, bool &shutdown) {
+  std::string line = request;
+  if (!line.empty() && line.back() == '\r') line.pop_back();
+  if (line == "QUIT") return false;
+  if (line == "SHUTDOWN") {
+    shutdown = true;
+    return false;
+  }
+  if (line == "PING") {
+    response = "PONG\n";
+  } else if (line.empty()) {
+    response.clear();
+  } else {
+    response = handler(line);
+    if (!response.empty() && response.back() != '\n') response += '\n';
+  }
+  return true;
+}
+
+}  // namespace server_detail
+
+// Serves requests from in until QUIT, SHUTDOWN or end of input
+inline void serveStream(std::istream &in, std::ostream &out,
+                        const RequestHandler &handler) {
+  std::string line, response;
+  bool shutdown = false;
+  while (std::getline(in, line)) {
+    if (!server_detail::answer(line, handler, response, shutdown)) break;
+    out << response << std::flush;
+  }
+}
+
+#ifndef _WIN32
+// Listens on the Unix socket path (replacing a stale socket file) until a
+// client sends SHUTDOWN
+inline void serveUnixSocket(const std::string &path,
+                            const RequestHandler &handler) {
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw std::runtime_error("socket path too long: " + path);
+  }
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+  int listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenFd < 0) throw std::runtime_error("cannot create a socket");
+  ::unlink(path.c_str());
+  if (::bind(listenFd, reinterpret_cast<sockaddr *>(&address),
+             sizeof(address)) != 0 ||
+      ::listen(listenFd, 64) != 0) {
+    std::string reason = std::strerror(errno);
+    ::close(listenFd);
+    throw std::runtime_error("cannot listen on " + path + ": " + reason);
+  }
+
+  std::atomic<bool> stopping(false);
+  std::mutex clientsMutex;
+  std::set<int> clients;
+  std::vector<std::thread> workers;
+
+  auto serveClient = [&](int fd) {
+    std::string buffer, response;
+    char chunk[4096];
+    bool open = true, shutdown = false;
+    while (open) {
+      ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+      if (n <= 0) break;
+      buffer.append(chunk, static_cast<size_t>(n));
+      size_t newline;
+      while (open && (newline = buffer.find('\n')) != std::string::npos) {
+        std::string line = buffer.substr(0, newline);
+        buffer.erase(0, newline + 1);
+        open = server_detail::answer(line, handler, response, shutdown);
+        for (size_t sent = 0; open && sent < response.size();) {
+          ssize_t w = ::send(fd, response.data() + sent,
+                             response.size() - sent, MSG_NOSIGNAL);
+          if (w <= 0) open = false;
+          else sent += static_cast<size_t>(w);
+        }
+      }
+    }
+    if (shutdown && !stopping.exchange(true)) {
+      // Wakes accept() and every other client
+      ::shutdown(listenFd, SHUT_RDWR);
+      std::lock_guard<std::mutex> lock(clientsMutex);
+      for (int other : clients) {
+        if (other != fd) ::shutdown(other, SHUT_RDWR);
+      }
+    }
+    std::lock_guard<std::mutex> lock(clientsMutex);
+    clients.erase(fd);
+    ::close(fd);
+  };
+
+  while (!stopping) {
+    int fd = ::accept(listenFd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    std::lock_guard<std::mutex> lock(clientsMutex);
+    if (stopping) {
+      ::close(fd);
+      break;
+    }
+    clients.insert(fd);
+    workers.emplace_back(serveClient, fd);
+  }
+
+  for (std::thread &worker : workers) worker.join();
+  ::close(listenFd);
+  ::unlink(path.c_str());
+}
+#endif
+
+#endif
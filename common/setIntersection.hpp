@@ -0,0 +1,93 @@
+#ifndef COMMON_SET_INTERSECTION_HPP
+#define COMMON_SET_INTERSECTION_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COMMON_SET_INTERSECTION_AVX2 1
+#endif
+
+//---------------------------------------------------------------------------
+// Sorted set intersection
+//---------------------------------------------------------------------------
+// Exact Jaccard over shingle sets kept as sorted arrays of distinct uint64
+// keys. The intersection is a merge; on CPUs with AVX2 it compares a block
+// of four keys of one array against every rotation of a block of four of
+// the other (4 x 4 comparisons in four instructions) and advances the block
+// whose largest key is smaller. The AVX2 kernel is compiled with a target
+// attribute and picked at run time, so the binary still runs on older CPUs.
+
+// Sorted copy of a shingle set
+inline std::vector<uint64_t> sortedKeys(const std::unordered_set<uint64_t> &keys) {
+  std::vector<uint64_t> sorted(keys.begin(), keys.end());
+  std::sort(sorted.begin(), sorted.end());
+  return sorted;
+}
+
+namespace set_detail {
+
+inline size_t intersectScalar(const uint64_t *a, size_t na, const uint64_t *b,
+                              size_t nb) {
+  size_t i = 0, j = 0, count = 0;
+  while (i < na && j < nb) {
+    if (a[i] < b[j]) {
+      i++;
+    } else if (b[j] < a[i]) {
+      j++;
+    } else {
+      count++;
+      i++;
+      j++;
+    }
+  }
+  return count;
+}
+
+#ifdef COMMON_SET_INTERSECTION_AVX2
+__attribute__((target("avx2"))) inline size_t intersectAvx2(
+    const uint64_t *a, size_t na, const uint64_t *b, size_t nb) {
+  size_t i = 0, j = 0, count = 0;
+  while (i + 4 <= na && j + 4 <= nb) {
+    __m256i blockA = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+    __m256i blockB = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + j));
+    __m256i match = _mm256_cmpeq_epi64(blockA, blockB);
+    match = _mm256_or_si256(
+        match, _mm256_cmpeq_epi64(blockA, _mm256_permute4x64_epi64(blockB, 0x39)));
+    match = _mm256_or_si256(
+        match, _mm256_cmpeq_epi64(blockA, _mm256_permute4x64_epi64(blockB, 0x4e)));
+    match = _mm256_or_si256(
+        match, _mm256_cmpeq_epi64(blockA, _mm256_permute4x64_epi64(blockB, 0x93)));
+    count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(match)));
+
+    uint64_t lastA = a[i + 3], lastB = b[j + 3];
+    if (lastA <= lastB) i += 4;
+    if (lastB <= lastA) j += 4;
+  }
+  return count + intersectScalar(a + i, na - i, b + j, nb - j);
+}
+
+inline bool hasAvx2() {
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+}
+#endif
+
+}  // namespace set_detail
+
+// Number of keys two sorted arrays of distinct keys have in common
+inline size_t sortedIntersectionSize(const std::vector<uint64_t> &a,
+                                     const std::vector<uint64_t> &b) {
+#ifdef COMMON_SET_INTERSECTION_AVX2
+  if (set_detail::hasAvx2()) {
+    return set_detail::intersectAvx2(a.data(), a.size(), b.data(), b.size());
+  }
+#endif
+  return set_detail::intersectScalar(a.data(), a.size(), b.data(), b.size());
+}
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef COMMON_SHINGLER_HPP
+#define COMMON_SHINGLER_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//---------------------------------------------------------------------------
+// Shingle keys from word hashes
+//---------------------------------------------------------------------------
+// A k-shingle is keyed by mixing the hashes (or dictionary ids) of its k
+// words, so no shingle string is ever built. The shingler keeps one sliding
+// window of the last max(k) word hashes; after each word it walks the window
+// back from the newest word and emits a key every time the walk reaches one
+// of the requested lengths. One pass over the token stream therefore yields
+// the shingles for every k at once.
+class MultiShingler {
+ private:
+  std::vector<unsigned> ks;      // Requested sizes, ascending
+  std::vector<uint64_t> window;  // Ring of the last maxK word hashes
+  size_t words = 0;
+
+  static uint64_t finalize(uint64_t h) {
+    // splitmix64 finalizer
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+  }
+
+ public:
+  explicit MultiShingler(std::vector<unsigned> sizes) : ks(std::move(sizes)) {
+    ks.erase(std::remove(ks.begin(), ks.end(), 0u), ks.end());
+    std::sort(ks.begin(), ks.end());
+    ks.erase(std::unique(ks.begin(), ks.end()), ks.end());
+    window.assign(ks.empty() ? 1 : ks.back(), 0);
+  }
+
+  // Sizes in the order their index is reported to onShingle
+  const std::vector<unsigned> &sizes() const { return ks; }
+
+  // Adds a word; calls onShingle(size_t sizeIndex, uint64_t key) for every
+  // requested k that now has a full shingle ending at this word
+  template <typename F>
+  void push(uint64_t wordHash, F &&onShingle) {
+    const size_t maxK = window.size();
+    window[words % maxK] = wordHash;
+    words++;
+
+    size_t available = std::min(words, maxK);
+    size_t next = 0;
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+    for (size_t j = 0; j < available && next < ks.size(); j++) {
+      h = (h ^ window[(words - 1 - j) % maxK]) * 0xbf58476d1ce4e5b9ULL;
+      h ^= h >> 31;
+      if (j + 1 == ks[next]) {
+        onShingle(next, finalize(h ^ (j + 1)));
+        next++;
+      }
+    }
+  }
+
+  // Starts a new document
+  void reset() { words = 0; }
+};
+
+// Calls onShingle(uint64_t key) for every window of k consecutive ids
+template <typename Id, typename F>
+void forEachShingle(const std::vector<Id> &ids, size_t k, F &&onShingle) {
+  MultiShingler shingler({static_cast<unsigned>(k)});
+  for (Id id : ids) {
+    shingler.push(id, [&](size_t, uint64_t key) { onShingle(key); });
+  }
+}
+
+#endif
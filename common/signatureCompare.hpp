@@ -0,0 +1,146 @@
+#ifndef COMMON_SIGNATURE_COMPARE_HPP
+#define COMMON_SIGNATURE_COMPARE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COMMON_SIGNATURE_COMPARE_AVX2 1
+#endif
+
+//---------------------------------------------------------------------------
+// Threshold-aware signature comparison
+//---------------------------------------------------------------------------
+// Candidate verification only needs to know whether two MinHash signatures
+// agree on at least threshold * t of their t slots, not the estimate
+// itself. The slots are compared a block of 16 (one cache line) at a time
+// and the scan stops as soon as the answer is known:
+//
+//   accept    the matches so far already reach the threshold
+//   reject    the matches so far plus every slot left cannot reach it
+//
+// Both are exact, so the answer is the one a full scan gives. With a
+// confidence c in (0, 1) pairs are also rejected by a sequential test:
+// after m slots with x matches, a pair of true similarity at the threshold
+// would show x < m * (threshold - eps) with probability at most
+// exp(-2 m eps^2) (Hoeffding). eps is chosen at every block so the chance
+// of wrongly dropping such a pair over the whole scan is at most 1 - c.
+// Dissimilar pairs, most of the candidates, are then dropped after a few
+// blocks instead of after (1 - threshold) * t mismatches.
+//
+// On CPUs with AVX2 a block is two 8-lane compares; the kernel is compiled
+// with a target attribute and picked at run time.
+
+namespace signature_detail {
+
+constexpr size_t kBlock = 16;
+
+inline size_t countEqualScalar(const int *a, const int *b, size_t n) {
+  size_t count = 0;
+  for (size_t i = 0; i < n; i++) count += a[i] == b[i];
+  return count;
+}
+
+// Scans blocks until the verdict is known. minimum[k] is the fewest matches
+// after block k that can still reach needed.
+inline bool scanScalar(const int *a, const int *b, size_t n, size_t needed,
+                       const size_t *minimum) {
+  size_t count = 0;
+  for (size_t start = 0, k = 0; start < n; start += kBlock, k++) {
+    count += countEqualScalar(a + start, b + start, std::min(kBlock, n - start));
+    if (count >= needed) return true;
+    if (count < minimum[k]) return false;
+  }
+  return count >= needed;
+}
+
+#ifdef COMMON_SIGNATURE_COMPARE_AVX2
+__attribute__((target("avx2"))) inline bool scanAvx2(const int *a, const int *b,
+                                                     size_t n, size_t needed,
+                                                     const size_t *minimum) {
+  size_t count = 0, start = 0, k = 0;
+  for (; start + kBlock <= n; start += kBlock, k++) {
+    __m256i low = _mm256_cmpeq_epi32(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + start)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + start)));
+    __m256i high = _mm256_cmpeq_epi32(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + start + 8)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + start + 8)));
+    unsigned mask = _mm256_movemask_ps(_mm256_castsi256_ps(low)) |
+                    (_mm256_movemask_ps(_mm256_castsi256_ps(high)) << 8);
+    count += __builtin_popcount(mask);
+    if (count >= needed) return true;
+    if (count < minimum[k]) return false;
+  }
+  if (start < n) count += countEqualScalar(a + start, b + start, n - start);
+  return count >= needed;
+}
+
+inline bool hasAvx2() {
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+}
+#endif
+
+}  // namespace signature_detail
+
+class ThresholdComparator {
+ private:
+  size_t slots = 0;
+  size_t needed = 0;            // Fewest matching slots that reach the threshold
+  std::vector<size_t> minimum;  // Per block: fewest matches to keep scanning
+
+ public:
+  ThresholdComparator() = default;
+
+  // Signatures of length slots compared against threshold; confidence 0
+  // keeps the comparison exact
+  ThresholdComparator(size_t length, float threshold, double confidence = 0)
+      : slots(length) {
+    if (confidence < 0 || confidence >= 1) {
+      throw std::invalid_argument("comparison confidence must be in [0, 1)");
+    }
+    // Same float arithmetic as matches / t >= threshold
+    while (needed <= slots &&
+           static_cast<float>(needed) / slots < threshold) {
+      needed++;
+    }
+
+    size_t blocks = (slots + signature_detail::kBlock - 1) / signature_detail::kBlock;
+    minimum.resize(blocks, 0);
+    double perBlock = confidence > 0 ? (1 - confidence) / blocks : 0;
+    for (size_t k = 0; k < blocks; k++) {
+      size_t seen = std::min((k + 1) * signature_detail::kBlock, slots);
+      size_t left = slots - seen;
+      size_t reachable = needed > left ? needed - left : 0;
+      if (perBlock > 0) {
+        double eps = std::sqrt(std::log(1 / perBlock) / (2.0 * seen));
+        double bound = std::ceil(seen * (threshold - eps));
+        if (bound > 0) reachable = std::max(reachable, static_cast<size_t>(bound));
+      }
+      minimum[k] = reachable;
+    }
+  }
+
+  size_t length() const { return slots; }
+
+  // True when the signatures agree on enough slots to reach the threshold
+  bool reaches(const std::vector<int> &a, const std::vector<int> &b) const {
+    if (a.size() != slots || b.size() != slots || slots == 0) return false;
+    if (needed > slots) return false;
+#ifdef COMMON_SIGNATURE_COMPARE_AVX2
+    if (signature_detail::hasAvx2()) {
+      return signature_detail::scanAvx2(a.data(), b.data(), slots, needed,
+                                        minimum.data());
+    }
+#endif
+    return signature_detail::scanScalar(a.data(), b.data(), slots, needed,
+                                        minimum.data());
+  }
+};
+
+#endif
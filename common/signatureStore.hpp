@@ -0,0 +1,271 @@
+#ifndef COMMON_SIGNATURE_STORE_HPP
+#define COMMON_SIGNATURE_STORE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//---------------------------------------------------------------------------
+// Persistent MinHash signature store
+//---------------------------------------------------------------------------
+// Binary file with everything needed to band a corpus again without reading
+// it: the parameters the signatures were built with, the n x t signature
+// matrix and the document names. Layout (native byte order):
+//
+//   header    128 bytes, see signature_store_detail::Header
+//   matrix    n * t int32, row-major, starts 64-byte aligned
+//   offsets   n + 1 uint64, name i is blob[offsets[i], offsets[i + 1])
+//   blob      document names, back to back
+//
+// The matrix is used in place from a read-only mapping, so loading costs
+// one mmap no matter how big the corpus is. A store with t signatures also
+// serves any smaller t: the first t' columns are the signature for t'.
+struct SignatureStoreInfo {
+  uint32_t k = 0;          // Shingle size
+  uint32_t t = 0;          // Hash functions (signature length)
+  uint64_t seed = 0;       // Seed of the hash coefficients
+  std::string hashFamily;  // How shingles were hashed, e.g. "xxh64-words/..."
+};
+
+namespace signature_store_detail {
+
+constexpr char kMagic[8] = {'M', 'H', 'S', 'I', 'G', 'S', '\0', '\1'};
+constexpr uint32_t kVersion = 1;
+constexpr size_t kFamilySize = 48;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t k;
+  uint32_t t;
+  uint32_t reserved;
+  uint64_t docs;
+  uint64_t seed;
+  uint64_t matrixOffset;
+  uint64_t namesOffset;
+  uint64_t fileSize;
+  char hashFamily[kFamilySize];
+};
+static_assert(sizeof(Header) <= 128, "signature store header too big");
+
+constexpr uint64_t kMatrixOffset = 128;
+
+inline uint64_t alignUp(uint64_t n, uint64_t a) { return (n + a - 1) / a * a; }
+
+}  // namespace signature_store_detail
+
+// Writes docs rows; nameOf(i) gives a string and rowOf(i) a vector<int> of
+// exactly info.t values. The file is written aside and renamed into place.
+template <typename NameFn, typename RowFn>
+void writeSignatureStore(const std::string &path, const SignatureStoreInfo &info,
+                         size_t docs, NameFn nameOf, RowFn rowOf) {
+  using namespace signature_store_detail;
+  if (info.hashFamily.size() >= kFamilySize) {
+    throw std::runtime_error("hash family name too long: " + info.hashFamily);
+  }
+
+  Header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.k = info.k;
+  header.t = info.t;
+  header.docs = docs;
+  header.seed = info.seed;
+  header.matrixOffset = kMatrixOffset;
+  header.namesOffset =
+      alignUp(kMatrixOffset + uint64_t(docs) * info.t * sizeof(int32_t), 8);
+  std::memcpy(header.hashFamily, info.hashFamily.data(),
+              info.hashFamily.size());
+
+  std::vector<uint64_t> offsets(docs + 1, 0);
+  for (size_t i = 0; i < docs; i++) {
+    offsets[i + 1] = offsets[i] + std::string_view(nameOf(i)).size();
+  }
+  header.fileSize =
+      header.namesOffset + offsets.size() * sizeof(uint64_t) + offsets[docs];
+
+  std::string tmpPath = path + ".tmp";
+  std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+  if (!out) throw std::runtime_error("cannot create " + tmpPath);
+
+  char padding[128] = {};
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.write(padding, kMatrixOffset - sizeof(header));
+  for (size_t i = 0; i < docs; i++) {
+    const auto &row = rowOf(i);
+    if (row.size() != info.t) {
+      throw std::runtime_error("signature of " + std::string(nameOf(i)) +
+                               " has the wrong length");
+    }
+    std::vector<int32_t> packed(row.begin(), row.end());
+    out.write(reinterpret_cast<const char *>(packed.data()),
+              packed.size() * sizeof(int32_t));
+  }
+  uint64_t matrixEnd = kMatrixOffset + uint64_t(docs) * info.t * sizeof(int32_t);
+  out.write(padding, header.namesOffset - matrixEnd);
+  out.write(reinterpret_cast<const char *>(offsets.data()),
+            offsets.size() * sizeof(uint64_t));
+  for (size_t i = 0; i < docs; i++) {
+    std::string_view name(nameOf(i));
+    out.write(name.data(), name.size());
+  }
+  out.close();
+  if (!out) throw std::runtime_error("error writing " + tmpPath);
+
+  if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    std::remove(tmpPath.c_str());
+    throw std::runtime_error("cannot move " + tmpPath + " to " + path);
+  }
+}
+
+// Read-only view of a store file
+class SignatureStore {
+ private:
+  SignatureStoreInfo storeInfo;
+  size_t docs = 0;
+  const char *base = nullptr;
+  size_t mappedSize = 0;
+  std::vector<char> buffer;  // Used instead of a mapping where there is none
+  const int32_t *matrix = nullptr;
+  const uint64_t *offsets = nullptr;
+  const char *blob = nullptr;
+
+  void release() {
+#ifndef _WIN32
+    if (mappedSize) ::munmap(const_cast<char *>(base), mappedSize);
+#endif
+    mappedSize = 0;
+    base = nullptr;
+  }
+
+ public:
+  explicit SignatureStore(const std::string &path) {
+    using namespace signature_store_detail;
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("cannot open " + path);
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size < 128) {
+      ::close(fd);
+      throw std::runtime_error(path + " is not a signature store");
+    }
+    mappedSize = static_cast<size_t>(st.st_size);
+    void *mapping = ::mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) throw std::runtime_error("cannot map " + path);
+    base = static_cast<const char *>(mapping);
+#else
+    std::ifstream in(path, std::ios::binary);
+    if (!in) throw std::runtime_error("cannot open " + path);
+    buffer.assign(std::istreambuf_iterator<char>(in),
+                  std::istreambuf_iterator<char>());
+    base = buffer.data();
+    if (buffer.size() < 128) {
+      throw std::runtime_error(path + " is not a signature store");
+    }
+#endif
+    size_t size = mappedSize ? mappedSize : buffer.size();
+
+    Header header;
+    std::memcpy(&header, base, sizeof(header));
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+        header.version != kVersion || header.fileSize != size ||
+        header.matrixOffset + header.docs * header.t * sizeof(int32_t) >
+            header.namesOffset ||
+        header.namesOffset + (header.docs + 1) * sizeof(uint64_t) > size) {
+      release();
+      throw std::runtime_error(path + " is not a valid signature store");
+    }
+
+    docs = header.docs;
+    storeInfo.k = header.k;
+    storeInfo.t = header.t;
+    storeInfo.seed = header.seed;
+    storeInfo.hashFamily.assign(
+        header.hashFamily,
+        std::find(header.hashFamily, header.hashFamily + kFamilySize, '\0'));
+    matrix = reinterpret_cast<const int32_t *>(base + header.matrixOffset);
+    offsets = reinterpret_cast<const uint64_t *>(base + header.namesOffset);
+    blob = base + header.namesOffset + (docs + 1) * sizeof(uint64_t);
+    if (blob + offsets[docs] != base + size) {
+      release();
+      throw std::runtime_error(path + " is not a valid signature store");
+    }
+  }
+
+  SignatureStore(const SignatureStore &) = delete;
+  SignatureStore &operator=(const SignatureStore &) = delete;
+
+  ~SignatureStore() { release(); }
+
+  const SignatureStoreInfo &info() const { return storeInfo; }
+  size_t size() const { return docs; }
+
+  // info().t values; the first t' of them are the signature for t' <= t
+  const int32_t *row(size_t i) const {
+    return matrix + i * static_cast<size_t>(storeInfo.t);
+  }
+
+  std::string_view name(size_t i) const {
+    return std::string_view(blob + offsets[i], offsets[i + 1] - offsets[i]);
+  }
+};
+
+// The seed of the store at path, which a run using it must adopt before
+// initializing its hash functions: documents it signs itself (queries,
+// served documents) are only comparable with the stored signatures under
+// the same coefficients. An explicit seed (seedGiven) must match it.
+inline uint64_t storeSeed(const std::string &path, bool seedGiven,
+                          uint64_t seed) {
+  uint64_t stored = SignatureStore(path).info().seed;
+  if (seedGiven && seed != stored) {
+    throw std::runtime_error(path + " was signed with seed " +
+                             std::to_string(stored) + ", not --seed " +
+                             std::to_string(seed));
+  }
+  return stored;
+}
+
+// Throws unless the store at path holds signatures built the way this run
+// builds them: the same k, at least t hash functions (the first t are
+// used), the same hash family (which names --word-ids mode) and the same
+// seed
+inline void checkSignatureStore(const std::string &path,
+                                const SignatureStoreInfo &info, uint32_t k,
+                                uint32_t t, const std::string &hashFamily,
+                                uint64_t seed) {
+  if (info.k != k || info.t < t) {
+    throw std::runtime_error(path + " has signatures for k=" +
+                             std::to_string(info.k) + ", t=" +
+                             std::to_string(info.t) + "; cannot serve k=" +
+                             std::to_string(k) + ", t=" + std::to_string(t));
+  }
+  if (info.hashFamily != hashFamily) {
+    throw std::runtime_error(path + " was signed with hash family " +
+                             info.hashFamily + ", this run uses " + hashFamily +
+                             " (is --word-ids the same?)");
+  }
+  if (info.seed != seed) {
+    throw std::runtime_error(path + " was signed with seed " +
+                             std::to_string(info.seed) + ", this run uses " +
+                             std::to_string(seed));
+  }
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef COMMON_STOPWORDS_HPP
+#define COMMON_STOPWORDS_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "perfectHash.hpp"
+#include "stopwordsTable.hpp"
+
+//---------------------------------------------------------------------------
+// Stopword filter
+//---------------------------------------------------------------------------
+// By default checks the list compiled in from stopwords-en.json (see
+// tools/genStopwords.cpp), so no JSON is parsed at startup. A custom list
+// loaded at runtime (--stopwords <file>) gets the same kind of table built
+// on the spot. Either way a check is a hash plus one memcmp, no allocation.
+class StopwordFilter {
+ private:
+  PerfectHashSet custom;
+  bool useCustom = false;
+
+ public:
+  StopwordFilter() = default;
+
+  template <typename Container>
+  explicit StopwordFilter(const Container &words)
+      : custom(words), useCustom(true) {}
+
+  bool contains(const char *s, size_t n) const {
+    if (useCustom) return custom.contains(s, n);
+    if (kBuiltinStopwordCount == 0) return false;
+    const std::string_view &key = kBuiltinStopwords[perfectHashSlot(
+        s, n, kBuiltinStopwordDisplacement, kBuiltinStopwordBuckets,
+        kBuiltinStopwordCount)];
+    return key.size() == n && std::memcmp(key.data(), s, n) == 0;
+  }
+
+  bool contains(const std::string &word) const {
+    return contains(word.data(), word.size());
+  }
+
+  size_t size() const {
+    return useCustom ? custom.size() : kBuiltinStopwordCount;
+  }
+
+  bool empty() const { return size() == 0; }
+};
+
+#endif
@@ -0,0 +1,171 @@
+// Generated by tools/genStopwords.cpp from stopwords-en.json. Do not edit.
+#ifndef COMMON_STOPWORDS_TABLE_HPP
+#define COMMON_STOPWORDS_TABLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "perfectHash.hpp"
+
+constexpr size_t kBuiltinStopwordCount = 126;
+constexpr size_t kBuiltinStopwordBuckets = 63;
+
+constexpr uint32_t kBuiltinStopwordDisplacement[] = {
+    2u, 9u, 2147483651u, 0u, 0u, 3u,
+    2147483662u, 2147483673u, 13u, 5u, 14u, 2u,
+    0u, 32u, 2147483677u, 0u, 2147483683u, 2147483688u,
+    2147483700u, 1u, 2u, 1u, 2147483710u, 3u,
+    1u, 0u, 1u, 2u, 13u, 12u,
+    27u, 28u, 4u, 2u, 2147483714u, 3u,
+    3u, 3u, 0u, 2u, 0u, 2147483720u,
+    13u, 2147483722u, 2u, 2147483725u, 0u, 2147483726u,
+    9u, 1u, 7u, 2147483728u, 6u, 15u,
+    17u, 2147483733u, 0u, 2u, 76u, 2147483746u,
+    14u, 2147483747u, 2147483768u};
+
+constexpr std::string_view kBuiltinStopwords[] = {
+    "very",
+    "more",
+    "will",
+    "over",
+    "just",
+    "they",
+    "then",
+    "ours",
+    "your",
+    "when",
+    "her",
+    "an",
+    "such",
+    "of",
+    "himself",
+    "themselves",
+    "does",
+    "both",
+    "for",
+    "any",
+    "below",
+    "as",
+    "between",
+    "our",
+    "not",
+    "his",
+    "before",
+    "if",
+    "him",
+    "those",
+    "each",
+    "yourselves",
+    "herself",
+    "most",
+    "by",
+    "in",
+    "it",
+    "who",
+    "at",
+    "should",
+    "how",
+    "only",
+    "hers",
+    "why",
+    "with",
+    "its",
+    "again",
+    "what",
+    "their",
+    "all",
+    "to",
+    "don",
+    "have",
+    "he",
+    "here",
+    "own",
+    "you",
+    "ourselves",
+    "these",
+    "because",
+    "until",
+    "while",
+    "am",
+    "had",
+    "nor",
+    "did",
+    "been",
+    "through",
+    "myself",
+    "under",
+    "were",
+    "this",
+    "t",
+    "itself",
+    "which",
+    "so",
+    "off",
+    "s",
+    "she",
+    "a",
+    "me",
+    "is",
+    "be",
+    "has",
+    "yourself",
+    "above",
+    "further",
+    "having",
+    "up",
+    "some",
+    "down",
+    "than",
+    "being",
+    "yours",
+    "once",
+    "can",
+    "out",
+    "them",
+    "other",
+    "do",
+    "on",
+    "but",
+    "no",
+    "whom",
+    "same",
+    "during",
+    "doing",
+    "into",
+    "there",
+    "few",
+    "after",
+    "we",
+    "theirs",
+    "where",
+    "now",
+    "too",
+    "that",
+    "my",
+    "or",
+    "and",
+    "against",
+    "the",
+    "about",
+    "from",
+    "was",
+    "are"};
+
+// Every key must land on its own slot
+constexpr bool builtinStopwordsConsistent() {
+  for (size_t i = 0; i < kBuiltinStopwordCount; i++) {
+    const std::string_view key = kBuiltinStopwords[i];
+    if (perfectHashSlot(key.data(), key.size(),
+                        kBuiltinStopwordDisplacement,
+                        kBuiltinStopwordBuckets,
+                        kBuiltinStopwordCount) != i) {
+      return false;
+    }
+  }
+  return true;
+}
+static_assert(builtinStopwordsConsistent(),
+              "stopword table is not a perfect hash");
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef COMMON_SWEEP_HPP
+#define COMMON_SWEEP_HPP
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "options.hpp"
+
+//---------------------------------------------------------------------------
+// Parameter sweeps
+//---------------------------------------------------------------------------
+// "--sweep-t 100,200 --sweep-b 10,50% --sweep-thr 0.3,0.5" asks one process
+// for every combination instead of one process per combination. Signatures
+// are computed once for the largest t and smaller t use their prefix, so
+// only banding and querying are repeated. A parameter without a list keeps
+// its positional value. A band count ending in '%' is a percentage of t,
+// like experimento.py's --base_b.
+//
+// "--sweep-k 1,2,3" shingles every document once for all the k values (see
+// MultiShingler) and runs the rest of the sweep once per k.
+struct SweepPlan {
+  std::vector<int> ks;  // Ascending and unique; empty unless k is swept
+  std::vector<int> ts;
+  std::vector<std::string> bands;
+  std::vector<float> thresholds;
+  bool active = false;
+
+  int maxT() const { return *std::max_element(ts.begin(), ts.end()); }
+
+  // Band count for one entry of `bands` at a given t
+  static int bandsFor(const std::string &spec, int t) {
+    if (!spec.empty() && spec.back() == '%') {
+      return std::max(1, t * std::stoi(spec.substr(0, spec.size() - 1)) / 100);
+    }
+    return std::stoi(spec);
+  }
+};
+
+inline SweepPlan parseSweep(const Options &opts, int t, int b, float threshold) {
+  SweepPlan plan;
+  plan.active = opts.has("sweep-k") || opts.has("sweep-t") ||
+                opts.has("sweep-b") || opts.has("sweep-thr");
+  for (const std::string &value : opts.getList("sweep-k")) {
+    plan.ks.push_back(std::stoi(value));
+  }
+  std::sort(plan.ks.begin(), plan.ks.end());
+  plan.ks.erase(std::unique(plan.ks.begin(), plan.ks.end()), plan.ks.end());
+  for (const std::string &value : opts.getList("sweep-t")) {
+    plan.ts.push_back(std::stoi(value));
+  }
+  plan.bands = opts.getList("sweep-b");
+  for (const std::string &value : opts.getList("sweep-thr")) {
+    plan.thresholds.push_back(std::stof(value));
+  }
+  if (plan.ts.empty()) plan.ts.push_back(t);
+  if (plan.bands.empty()) plan.bands.push_back(std::to_string(b));
+  if (plan.thresholds.empty()) plan.thresholds.push_back(threshold);
+  for (int value : plan.ks) {
+    if (value <= 0) throw std::invalid_argument("--sweep-k values must be positive");
+  }
+  for (int value : plan.ts) {
+    if (value <= 0) throw std::invalid_argument("--sweep-t values must be positive");
+  }
+  // A b that is too big for one t is skipped there; one that is not
+  // positive fits no t
+  for (const std::string &value : opts.getList("sweep-b")) {
+    std::string count = value;
+    if (!count.empty() && count.back() == '%') count.pop_back();
+    if (std::stoi(count) <= 0) {
+      throw std::invalid_argument("--sweep-b values must be positive");
+    }
+  }
+  for (const std::string &value : opts.getList("sweep-thr")) {
+    float thr = std::stof(value);
+    if (!(thr >= 0.0f && thr <= 1.0f)) {
+      throw std::invalid_argument("--sweep-thr values must be between 0 and 1");
+    }
+  }
+  return plan;
+}
+
+#endif
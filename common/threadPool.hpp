@@ -0,0 +1,213 @@
+#ifndef COMMON_THREAD_POOL_HPP
+#define COMMON_THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "perfCounters.hpp"
+
+//---------------------------------------------------------------------------
+// Work-stealing thread pool
+//---------------------------------------------------------------------------
+// Every worker owns a deque: it pushes and pops its own tasks at the back
+// (newest first, cache friendly) and, when it runs dry, steals from the front
+// of another worker's deque (oldest first, usually the biggest chunk left).
+// Threads that wait for a parallel loop keep running tasks instead of
+// blocking, so a pool of N - 1 workers plus the caller uses N cores.
+class ThreadPool {
+ private:
+  struct WorkQueue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::vector<std::unique_ptr<WorkQueue>> queues;
+  std::vector<std::thread> workers;
+  std::atomic<size_t> queued;
+  std::atomic<size_t> nextQueue;
+  std::atomic<bool> stopping;
+  std::mutex sleepMutex;
+  std::condition_variable wake;
+
+  // Which pool/queue the current thread works for (nullptr / -1 outside)
+  static ThreadPool *&currentPool() {
+    static thread_local ThreadPool *pool = nullptr;
+    return pool;
+  }
+  static int &currentIndex() {
+    static thread_local int index = -1;
+    return index;
+  }
+
+  int selfIndex() const {
+    return currentPool() == this ? currentIndex() : -1;
+  }
+
+  bool popOwn(int self, std::function<void()> &task) {
+    WorkQueue &queue = *queues[self];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) return false;
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+  }
+
+  bool steal(int self, std::function<void()> &task) {
+    size_t n = queues.size();
+    size_t start = self >= 0 ? static_cast<size_t>(self) + 1
+                             : nextQueue.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < n; i++) {
+      WorkQueue &queue = *queues[(start + i) % n];
+      std::unique_lock<std::mutex> lock(queue.mutex, std::try_to_lock);
+      if (!lock.owns_lock() || queue.tasks.empty()) continue;
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      return true;
+    }
+    return false;
+  }
+
+  // Runs one pending task, if any can be found
+  bool runOne(int self) {
+    if (queued.load(std::memory_order_acquire) == 0) return false;
+    std::function<void()> task;
+    if ((self >= 0 && popOwn(self, task)) || steal(self, task)) {
+      queued.fetch_sub(1, std::memory_order_acq_rel);
+      PerfCounters::attachThread();  // Count the work of every thread
+      task();
+      return true;
+    }
+    return false;
+  }
+
+  void workerLoop(int index) {
+    currentPool() = this;
+    currentIndex() = index;
+    while (!stopping.load(std::memory_order_acquire)) {
+      if (runOne(index)) continue;
+      std::unique_lock<std::mutex> lock(sleepMutex);
+      wake.wait_for(lock, std::chrono::milliseconds(10), [this]() {
+        return stopping.load(std::memory_order_acquire) ||
+               queued.load(std::memory_order_acquire) > 0;
+      });
+    }
+  }
+
+  template <typename F>
+  void splitRange(size_t begin, size_t end, size_t grain, const F &fn,
+                  std::atomic<size_t> &remaining) {
+    // Keep halving, handing the upper half to whoever steals it
+    while (end - begin > grain) {
+      size_t mid = begin + (end - begin) / 2;
+      submit([this, mid, end, grain, &fn, &remaining]() {
+        splitRange(mid, end, grain, fn, remaining);
+      });
+      end = mid;
+    }
+    for (size_t i = begin; i < end; i++) {
+      fn(i);
+    }
+    remaining.fetch_sub(end - begin, std::memory_order_acq_rel);
+  }
+
+ public:
+  // `threads` is the total parallelism including the calling thread
+  explicit ThreadPool(unsigned threads)
+      : queued(0), nextQueue(0), stopping(false) {
+    threads = std::max(1u, threads);
+    for (unsigned i = 0; i < threads; i++) {
+      queues.emplace_back(new WorkQueue());
+    }
+    for (unsigned i = 1; i < threads; i++) {
+      workers.emplace_back(&ThreadPool::workerLoop, this, static_cast<int>(i));
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  ~ThreadPool() {
+    stopping.store(true, std::memory_order_release);
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers) {
+      worker.join();
+    }
+  }
+
+  unsigned size() const { return static_cast<unsigned>(queues.size()); }
+
+  // Queues a task: on the caller's own deque from inside the pool,
+  // round-robin otherwise
+  void submit(std::function<void()> task) {
+    int self = selfIndex();
+    size_t target = self >= 0 ? static_cast<size_t>(self)
+                              : nextQueue.fetch_add(1) % queues.size();
+    {
+      std::lock_guard<std::mutex> lock(queues[target]->mutex);
+      queues[target]->tasks.push_back(std::move(task));
+    }
+    queued.fetch_add(1, std::memory_order_acq_rel);
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wake.notify_one();
+  }
+
+  // Runs tasks from the pool until done() holds
+  template <typename Pred>
+  void helpUntil(Pred done) {
+    int self = selfIndex();
+    while (!done()) {
+      if (!runOne(self)) std::this_thread::yield();
+    }
+  }
+
+  // Calls fn(i) for every i in [begin, end); ranges of `grain` indices are
+  // the unit of stealing
+  template <typename F>
+  void parallelFor(size_t begin, size_t end, const F &fn, size_t grain = 1) {
+    if (begin >= end) return;
+    grain = std::max<size_t>(1, grain);
+    if (queues.size() == 1) {
+      for (size_t i = begin; i < end; i++) fn(i);
+      return;
+    }
+    std::atomic<size_t> remaining(end - begin);
+    splitRange(begin, end, grain, fn, remaining);
+    helpUntil([&remaining]() {
+      return remaining.load(std::memory_order_acquire) == 0;
+    });
+  }
+
+  //-------------------------------------------------------------------------
+  // Process-wide pool, sized once from --threads
+  //-------------------------------------------------------------------------
+  static unsigned &configuredThreads() {
+    static unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    return threads;
+  }
+
+  // Must be called before the first instance() call to take effect
+  static void setThreads(unsigned threads) {
+    configuredThreads() = std::max(1u, threads);
+  }
+
+  static ThreadPool &instance() {
+    static ThreadPool pool(configuredThreads());
+    return pool;
+  }
+};
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef COMMON_TOKENIZER_HPP
+#define COMMON_TOKENIZER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOKENIZER_X86 1
+#endif
+
+//---------------------------------------------------------------------------
+// Vectorized tokenizer
+//---------------------------------------------------------------------------
+// Same rules as the old `stringstream >> word` + normalize() loop: a token is
+// a maximal run of non-whitespace bytes, and a word is its token with every
+// non-letter byte dropped and ASCII letters lowercased. Tokens that keep no
+// letter are still reported (as empty words) so callers decide what to do
+// with them, exactly as before.
+//
+// The input is classified 64 bytes at a time (AVX2 when the CPU has it,
+// SSE2 otherwise) into bit masks of letters, whitespace and punctuation, and
+// lowercased in-register. Words are then copied out run by run.
+enum TokenizerFlags : unsigned {
+  kSplitOnPunctuation = 1,  // punctuation also ends a token (ispunct -> ' ')
+  kKeepNonAlpha = 2,        // keep non-letter bytes, only lowercase letters
+};
+
+namespace tokenizer_detail {
+
+struct Block {
+  uint64_t alpha;  // A-Z, a-z
+  uint64_t space;  // ' ', \t, \n, \v, \f, \r
+  uint64_t punct;  // printable, not alphanumeric, not space
+  alignas(64) char lowered[64];
+};
+
+inline void classifyScalar(const char *p, Block &block) {
+  block.alpha = block.space = block.punct = 0;
+  for (int i = 0; i < 64; i++) {
+    unsigned char c = static_cast<unsigned char>(p[i]);
+    bool alpha = static_cast<unsigned char>((c | 0x20) - 'a') < 26;
+    bool digit = static_cast<unsigned char>(c - '0') < 10;
+    bool space = c == ' ' || static_cast<unsigned char>(c - '\t') < 5;
+    bool printable = static_cast<unsigned char>(c - 0x21) < 94;
+    block.alpha |= static_cast<uint64_t>(alpha) << i;
+    block.space |= static_cast<uint64_t>(space) << i;
+    block.punct |= static_cast<uint64_t>(printable && !alpha && !digit) << i;
+    block.lowered[i] = static_cast<char>(alpha ? (c | 0x20) : c);
+  }
+}
+
+#ifdef TOKENIZER_X86
+// Unsigned range checks via the signed-compare trick:
+// (c - lo) mod 256 < n  <=>  int8(c + (0x80 - lo)) < int8(0x80 + n)
+inline void classifySSE2(const char *p, Block &block) {
+  const __m128i bit5 = _mm_set1_epi8(0x20);
+  block.alpha = block.space = block.punct = 0;
+  for (int i = 0; i < 64; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    __m128i alpha = _mm_cmplt_epi8(
+        _mm_add_epi8(_mm_or_si128(v, bit5), _mm_set1_epi8(0x80 - 'a')),
+        _mm_set1_epi8(static_cast<char>(0x80 + 26)));
+    __m128i digit =
+        _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8(0x80 - '0')),
+                       _mm_set1_epi8(static_cast<char>(0x80 + 10)));
+    __m128i space = _mm_or_si128(
+        _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+        _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8(0x80 - '\t')),
+                       _mm_set1_epi8(static_cast<char>(0x80 + 5))));
+    __m128i printable =
+        _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8(0x80 - 0x21)),
+                       _mm_set1_epi8(static_cast<char>(0x80 + 94)));
+    __m128i punct =
+        _mm_andnot_si128(_mm_or_si128(alpha, digit), printable);
+    __m128i lowered = _mm_or_si128(v, _mm_and_si128(alpha, bit5));
+    _mm_store_si128(reinterpret_cast<__m128i *>(block.lowered + i), lowered);
+    block.alpha |= static_cast<uint64_t>(
+                       static_cast<uint16_t>(_mm_movemask_epi8(alpha)))
+                   << i;
+    block.space |= static_cast<uint64_t>(
+                       static_cast<uint16_t>(_mm_movemask_epi8(space)))
+                   << i;
+    block.punct |= static_cast<uint64_t>(
+                       static_cast<uint16_t>(_mm_movemask_epi8(punct)))
+                   << i;
+  }
+}
+
+__attribute__((target("avx2"))) inline void classifyAVX2(const char *p,
+                                                         Block &block) {
+  const __m256i bit5 = _mm256_set1_epi8(0x20);
+  block.alpha = block.space = block.punct = 0;
+  for (int i = 0; i < 64; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+    // a < b  <=>  b > a
+    __m256i alpha = _mm256_cmpgt_epi8(
+        _mm256_set1_epi8(static_cast<char>(0x80 + 26)),
+        _mm256_add_epi8(_mm256_or_si256(v, bit5),
+                        _mm256_set1_epi8(0x80 - 'a')));
+    __m256i digit = _mm256_cmpgt_epi8(
+        _mm256_set1_epi8(static_cast<char>(0x80 + 10)),
+        _mm256_add_epi8(v, _mm256_set1_epi8(0x80 - '0')));
+    __m256i space = _mm256_or_si256(
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(0x80 + 5)),
+                          _mm256_add_epi8(v, _mm256_set1_epi8(0x80 - '\t'))));
+    __m256i printable = _mm256_cmpgt_epi8(
+        _mm256_set1_epi8(static_cast<char>(0x80 + 94)),
+        _mm256_add_epi8(v, _mm256_set1_epi8(0x80 - 0x21)));
+    __m256i punct =
+        _mm256_andnot_si256(_mm256_or_si256(alpha, digit), printable);
+    __m256i lowered = _mm256_or_si256(v, _mm256_and_si256(alpha, bit5));
+    _mm256_store_si256(reinterpret_cast<__m256i *>(block.lowered + i),
+                       lowered);
+    block.alpha |= static_cast<uint64_t>(
+                       static_cast<uint32_t>(_mm256_movemask_epi8(alpha)))
+                   << i;
+    block.space |= static_cast<uint64_t>(
+                       static_cast<uint32_t>(_mm256_movemask_epi8(space)))
+                   << i;
+    block.punct |= static_cast<uint64_t>(
+                       static_cast<uint32_t>(_mm256_movemask_epi8(punct)))
+                   << i;
+  }
+}
+#endif
+
+typedef void (*ClassifyFn)(const char *, Block &);
+
+inline ClassifyFn selectClassifier() {
+#ifdef TOKENIZER_X86
+  if (__builtin_cpu_supports("avx2")) return classifyAVX2;
+  return classifySSE2;
+#else
+  return classifyScalar;
+#endif
+}
+
+inline ClassifyFn classifier() {
+  static const ClassifyFn fn = selectClassifier();
+  return fn;
+}
+
+}  // namespace tokenizer_detail
+
+// Calls onWord(const std::string &word) for every token of [data, data + len)
+template <typename F>
+void forEachWord(const char *data, size_t len, F &&onWord, unsigned flags = 0) {
+  using tokenizer_detail::Block;
+  const tokenizer_detail::ClassifyFn classify = tokenizer_detail::classifier();
+  Block block;
+  std::string word;
+  bool inToken = false;
+
+  for (size_t base = 0; base < len; base += 64) {
+    size_t n = len - base < 64 ? len - base : 64;
+    if (n == 64) {
+      classify(data + base, block);
+    } else {
+      // Pad the tail with spaces so it ends the last token
+      char tail[64];
+      std::memcpy(tail, data + base, n);
+      std::memset(tail + n, ' ', 64 - n);
+      classify(tail, block);
+    }
+
+    uint64_t sep = block.space;
+    if (flags & kSplitOnPunctuation) sep |= block.punct;
+    uint64_t keep = (flags & kKeepNonAlpha) ? ~sep : block.alpha;
+
+    unsigned pos = 0;
+    while (pos < 64) {
+      uint64_t sepAhead = sep >> pos;
+      unsigned next = sepAhead ? pos + __builtin_ctzll(sepAhead) : 64;
+      if (next > pos) {
+        // Bytes [pos, next) belong to the current token
+        inToken = true;
+        uint64_t segment = (next == 64 ? ~0ULL : (1ULL << next) - 1) &
+                           ~((1ULL << pos) - 1);
+        uint64_t kept = keep & segment;
+        if (kept == segment) {
+          word.append(block.lowered + pos, next - pos);
+        } else {
+          while (kept) {
+            word.push_back(block.lowered[__builtin_ctzll(kept)]);
+            kept &= kept - 1;
+          }
+        }
+      }
+      if (next < 64) {
+        if (inToken) {
+          onWord(static_cast<const std::string &>(word));
+          word.clear();
+          inToken = false;
+        }
+        pos = next + 1;
+      } else {
+        pos = 64;
+      }
+    }
+  }
+  if (inToken) onWord(static_cast<const std::string &>(word));
+}
+
+template <typename F>
+void forEachWord(const std::string &text, F &&onWord, unsigned flags = 0) {
+  forEachWord(text.data(), text.size(), onWord, flags);
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef COMMON_TOP_K_HPP
+#define COMMON_TOP_K_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+//---------------------------------------------------------------------------
+// Bounded top-k selection
+//---------------------------------------------------------------------------
+// Keeps the k best entries offered so far in a heap whose root is the worst
+// of them, so an entry that cannot make the cut costs one comparison and
+// one that can costs O(log k). Memory stays at k entries however many are
+// offered, which turns an all-pairs pass into O(n k) output.
+//
+// Ties are broken by index so the selection does not depend on the order
+// in which entries are offered (and therefore not on the thread count).
+
+struct Neighbour {
+  int doc;
+  float similarity;
+};
+
+// More similar first, then the lower document
+struct CloserNeighbour {
+  bool operator()(const Neighbour &a, const Neighbour &b) const {
+    if (a.similarity != b.similarity) return a.similarity > b.similarity;
+    return a.doc < b.doc;
+  }
+};
+
+struct ScoredPair {
+  int first;
+  int second;
+  float similarity;
+};
+
+// More similar first, then the lower pair
+struct MoreSimilarPair {
+  bool operator()(const ScoredPair &a, const ScoredPair &b) const {
+    if (a.similarity != b.similarity) return a.similarity > b.similarity;
+    if (a.first != b.first) return a.first < b.first;
+    return a.second < b.second;
+  }
+};
+
+// The capacity best entries under Better (Better(a, b): a ranks before b)
+template <typename Entry, typename Better>
+class BoundedHeap {
+ private:
+  size_t capacity;
+  std::vector<Entry> heap;  // Max-heap under Better: the root ranks last
+  Better better;
+
+ public:
+  explicit BoundedHeap(size_t capacity) : capacity(capacity) {
+    heap.reserve(capacity);
+  }
+
+  size_t size() const { return heap.size(); }
+  bool full() const { return heap.size() == capacity; }
+
+  // Worst entry kept; only meaningful when not empty
+  const Entry &worst() const { return heap.front(); }
+
+  // Whether entry would be kept if it were offered now
+  bool admits(const Entry &entry) const {
+    return capacity > 0 && (!full() || better(entry, heap.front()));
+  }
+
+  bool offer(const Entry &entry) {
+    if (!admits(entry)) return false;
+    if (full()) {
+      std::pop_heap(heap.begin(), heap.end(), better);
+      heap.back() = entry;
+    } else {
+      heap.push_back(entry);
+    }
+    std::push_heap(heap.begin(), heap.end(), better);
+    return true;
+  }
+
+  // The kept entries, best first; the heap is consumed
+  std::vector<Entry> take() {
+    std::sort_heap(heap.begin(), heap.end(), better);
+    return std::move(heap);
+  }
+};
+
+using NeighbourHeap = BoundedHeap<Neighbour, CloserNeighbour>;
+using PairHeap = BoundedHeap<ScoredPair, MoreSimilarPair>;
+
+#endif
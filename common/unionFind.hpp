@@ -0,0 +1,65 @@
+#ifndef COMMON_UNION_FIND_HPP
+#define COMMON_UNION_FIND_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+//---------------------------------------------------------------------------
+// Concurrent union-find
+//---------------------------------------------------------------------------
+// Disjoint sets over 0..n-1 that many threads can unite at once without
+// locks. Every parent only ever moves to a smaller index, so a root is
+// always the smallest element of its set and a compare-and-swap on the
+// larger root is the only write needed to link two sets; a failed CAS
+// means another thread linked it first and the union retries from the new
+// roots. find() halves the path as it walks, also with CAS, which may lose
+// races harmlessly: the parent it would have written is still an ancestor.
+class ConcurrentUnionFind {
+ private:
+  size_t count;
+  std::unique_ptr<std::atomic<uint32_t>[]> parent;
+
+ public:
+  explicit ConcurrentUnionFind(size_t n)
+      : count(n), parent(new std::atomic<uint32_t>[n]) {
+    if (n > UINT32_MAX) throw std::invalid_argument("too many union-find elements");
+    for (size_t i = 0; i < n; i++) {
+      parent[i].store(static_cast<uint32_t>(i), std::memory_order_relaxed);
+    }
+  }
+
+  size_t size() const { return count; }
+
+  uint32_t find(uint32_t x) {
+    while (true) {
+      uint32_t p = parent[x].load(std::memory_order_acquire);
+      if (p == x) return x;
+      uint32_t grandparent = parent[p].load(std::memory_order_acquire);
+      if (grandparent != p) {
+        parent[x].compare_exchange_weak(p, grandparent,
+                                        std::memory_order_acq_rel);
+      }
+      x = grandparent;
+    }
+  }
+
+  void unite(uint32_t a, uint32_t b) {
+    while (true) {
+      a = find(a);
+      b = find(b);
+      if (a == b) return;
+      if (a < b) std::swap(a, b);  // a is the larger root, linked under b
+      uint32_t expected = a;
+      if (parent[a].compare_exchange_strong(expected, b,
+                                            std::memory_order_acq_rel)) {
+        return;
+      }
+    }
+  }
+};
+
+#endif
@@ -10,6 +10,9 @@
 #include <unordered_set>
 #include <vector>
 
+#include "common/options.hpp"
+#include "common/stopwords.hpp"
+#include "common/tokenizer.hpp"
 #include "deps/nlohmann/json.hpp"  // Incluye la biblioteca nlohmann/json
 using namespace std;
 using json = nlohmann::json;
@@ -138,7 +141,7 @@ vector<string> improvedTokenization(const string& input) {
 
 // Function to clean text: remove unwanted punctuation, lowercase, and remove
 // stopwords
-string cleanText(const string& text, const unordered_set<string>& stopwords) {
+string cleanText(const string& text, const StopwordFilter& stopwords) {
   // Use improved tokenization that handles special cases
   vector<string> tokens = improvedTokenization(text);
 
@@ -148,23 +151,17 @@ string cleanText(const string& text, const unordered_set<string>& stopwords) {
     spaceSeparated += token + " ";
   }
 
-  // Convert to lowercase
-  string lowercased;
-  for (char c : spaceSeparated) {
-    lowercased += tolower(c);
-  }
-
-  // Remove stopwords
-  stringstream cleanedStream(lowercased);
-  string word;
+  // Convert to lowercase and remove stopwords in one pass
   string result;
-
-  while (cleanedStream >> word) {
-    if (stopwords.empty() || stopwords.find(word) == stopwords.end()) {
-      // Keep meaningful words
-      result += word + " ";
-    }
-  }
+  forEachWord(
+      spaceSeparated,
+      [&](const string& word) {
+        if (!stopwords.contains(word)) {
+          // Keep meaningful words
+          result += word + " ";
+        }
+      },
+      kKeepNonAlpha);
 
   // Trim trailing space if any
   if (!result.empty() && result.back() == ' ') {
@@ -176,7 +173,7 @@ string cleanText(const string& text, const unordered_set<string>& stopwords) {
 
 // Función para dividir el texto en frases
 vector<string> separaFrases(const string& text,
-                            const unordered_set<string>& stopwords) {
+                            const StopwordFilter& stopwords) {
   vector<string> frases;
   stringstream ss(text);
   string phrase;
@@ -273,21 +270,25 @@ bool makeDirectory(const string& path) {
 }
 
 int main(int argc, char* argv[]) {
-  if (argc != 2) {
-    cout << "Usage: " << argv[0] << " <D>" << endl;
+  Options opts = parseOptions(argc, argv);
+  if (opts.positional.size() != 1) {
+    cout << "Usage: " << argv[0] << " <D> [--stopwords FILE]" << endl;
     cout << "where D is the number of documents to generate" << endl;
     return 1;
   }
 
-  int D = stoi(argv[1]);
+  int D = stoi(opts.positional[0]);
   if (D <= 0) {
     cerr << "Error: D must be positive" << endl;
     return 1;
   }
 
-  // Load stopwords from external file
-  unordered_set<string> stopwords = loadStopwords("stopwords-en.json");
-  cout << "Loaded " << stopwords.size() << " stopwords from file" << endl;
+  // Built-in stopword list unless another one is given
+  StopwordFilter stopwords;
+  if (opts.has("stopwords")) {
+    stopwords = StopwordFilter(loadStopwords(opts.get("stopwords")));
+    cout << "Loaded " << stopwords.size() << " stopwords from file" << endl;
+  }
 
   // basicText.json contiene frases
   ifstream file("basicText.json");
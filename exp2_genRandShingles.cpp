@@ -7,20 +7,25 @@
 #include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_set>
 #include <vector>
 
+#include "common/options.hpp"
+#include "common/stopwords.hpp"
+#include "common/threadPool.hpp"
+#include "common/tokenizer.hpp"
 #include "deps/nlohmann/json.hpp"
 using namespace std;
 using namespace nlohmann;
 typedef unsigned int uint;
-unordered_set<string> stopwords;
+StopwordFilter stopwords;
 
 unsigned int k, D;
 
 // Treating StopWords
 bool is_stopword(const string& word) {
-  return stopwords.find(word) != stopwords.end();
+  return stopwords.contains(word);
 }
 
 unordered_set<string> loadStopwords(const string& filename) {
@@ -41,30 +46,15 @@ unordered_set<string> loadStopwords(const string& filename) {
   return stopwords;
 }
 
-// Treating Format
-string normalize(const string& word) {
-  string result;
-  result.reserve(word.length());
-  for (char c : word) {
-    if (isalpha(c)) {
-      result += tolower(c);
-    }
-  }
-  return result;
-}
-
 // Count unique words in text (excluding stopwords)
 int countUniqueWords(const string& text) {
   unordered_set<string> uniqueWords;
-  stringstream ss(text);
-  string word;
 
-  while (ss >> word) {
-    string normalizedWord = normalize(word);
+  forEachWord(text, [&](const string& normalizedWord) {
     if (!normalizedWord.empty() && !is_stopword(normalizedWord)) {
       uniqueWords.insert(normalizedWord);
     }
-  }
+  });
 
   return uniqueWords.size();
 }
@@ -72,16 +62,14 @@ int countUniqueWords(const string& text) {
 unordered_set<string> generateShingles(const string& text) {
   unordered_set<string> shingles;
   vector<string> words;
-  stringstream ss(text);
-  string word;
 
-  // Tokenize the text into words
-  while (ss >> word) {
+  // Tokenize the text into normalized words
+  forEachWord(text, [&](const string& word) {
     // Consider if it's a stopword
-    if (!is_stopword(normalize(word))) {
-      words.push_back(normalize(word));
+    if (!is_stopword(word)) {
+      words.push_back(word);
     }
-  }
+  });
 
   // Generate k-word shingles
   if (words.size() >= k) {
@@ -223,6 +211,20 @@ void generaDocumentos(const unordered_set<string>& shingles,
          << selectedShingles.size() << " shingles" << endl;
   }
 
+  // Pairwise Jaccard similarities, one row per task
+  vector<vector<double>> similarities(D, vector<double>(D, 1.0));
+  ThreadPool::instance().parallelFor(0, D, [&](size_t i) {
+    for (size_t j = i + 1; j < D; ++j) {
+      similarities[i][j] =
+          calculateJaccardSimilarity(documents[i], documents[j]);
+    }
+  });
+  for (size_t i = 0; i < D; ++i) {
+    for (size_t j = 0; j < i; ++j) {
+      similarities[i][j] = similarities[j][i];
+    }
+  }
+
   // Generate similarity matrix using Jaccard similarity
   ofstream simMatrix("datasets/similarity_matrix.txt");
   if (simMatrix.is_open()) {
@@ -244,8 +246,7 @@ void generaDocumentos(const unordered_set<string>& shingles,
         if (i == j) {
           simMatrix << "1.000\t";  // Self-similarity is 1
         } else {
-          double similarity =
-              calculateJaccardSimilarity(documents[i], documents[j]);
+          double similarity = similarities[i][j];
           simMatrix << fixed << setprecision(3) << similarity << "\t";
         }
       }
@@ -257,8 +258,7 @@ void generaDocumentos(const unordered_set<string>& shingles,
     int pairCount = 0;
     for (int i = 0; i < D; ++i) {
       for (int j = i + 1; j < D; ++j) {
-        totalSimilarity +=
-            calculateJaccardSimilarity(documents[i], documents[j]);
+        totalSimilarity += similarities[i][j];
         pairCount++;
       }
     }
@@ -291,22 +291,33 @@ bool makeDirectory(const std::string& path) {
 }
 
 int main(int argc, char* argv[]) {
-  stopwords = loadStopwords("stopwords-en.json");
-  if (argc != 3) {
-    cout << "Usage: " << argv[0] << " <k> <D>" << endl;
+  Options opts = parseOptions(argc, argv);
+  if (opts.positional.size() != 2) {
+    cout << "Usage: " << argv[0] << " <k> <D> [--threads N] [--stopwords FILE]"
+         << endl;
     cout << "where k is the shingle size" << endl;
     cout << "where D is the number of documents to generate" << endl;
     return 1;
   }
+  try {
+    ThreadPool::setThreads(
+        opts.getPositiveInt("threads", thread::hardware_concurrency()));
+  } catch (const exception &e) {
+    cerr << "Error: " << e.what() << endl;
+    return 1;
+  }
+  if (opts.has("stopwords")) {
+    stopwords = StopwordFilter(loadStopwords(opts.get("stopwords")));
+  }
 
   // Get k value from command line
-  k = stoi(argv[1]);
+  k = stoi(opts.positional[0]);
   if (k <= 0) {
     cerr << "Error: k must be positive" << endl;
     return 1;
   }
 
-  D = stoi(argv[2]);
+  D = stoi(opts.positional[1]);
   if (D < 20) {
     cerr << "Error: D must be at least 20 according to requirements" << endl;
     return 1;
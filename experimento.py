@@ -10,12 +10,69 @@ import random
 import time
 from itertools import combinations
 
+# Fingerprint bits of the SimHash engine, which has no t or b
+SIMHASH_BITS = 64
+
+# Engines write their pairs as .npy columns instead of CSVs (--binary_results)
+BINARY_RESULTS = False
+
+
+# Pair results: <name>.csv, or with the engines' --npy the columns
+# <name>.doc1.npy (uint32), <name>.doc2.npy (uint32) and <name>.sim.npy
+# (float32) next to where the CSV would be. Everything below takes the CSV
+# path and uses whichever form is there (the newer one if both are).
+NPY_COLUMNS = {'Doc1': 'doc1', 'Doc2': 'doc2', 'Sim%': 'sim'}
+
+
+def npy_column_paths(csv_path):
+    base = os.path.splitext(csv_path)[0]
+    return {name: f"{base}.{suffix}.npy" for name, suffix in NPY_COLUMNS.items()}
+
+
+def has_npy_results(csv_path):
+    paths = npy_column_paths(csv_path)
+    if not all(os.path.exists(path) for path in paths.values()):
+        return False
+    return not os.path.exists(csv_path) or os.path.getmtime(paths['Sim%']) >= os.path.getmtime(csv_path)
+
+
+def pair_results_exist(csv_path):
+    return os.path.exists(csv_path) or has_npy_results(csv_path)
+
+
+def rename_pair_results(csv_path, new_csv_path):
+    """Rename a pair result, CSV and/or .npy columns, to another CSV path."""
+    if os.path.exists(csv_path):
+        os.rename(csv_path, new_csv_path)
+    new_paths = npy_column_paths(new_csv_path)
+    base, new_base = os.path.splitext(csv_path)[0], os.path.splitext(new_csv_path)[0]
+    for suffix in list(NPY_COLUMNS.values()) + ['similar']:
+        path = f"{base}.{suffix}.npy"
+        if os.path.exists(path):
+            os.rename(path, f"{new_base}.{suffix}.npy")
+
+
+def load_pair_columns(csv_path):
+    """Doc1, Doc2 and Sim% as NumPy arrays. The .npy columns are
+    memory-mapped, so nothing is parsed or copied until it is used."""
+    if has_npy_results(csv_path):
+        return {name: np.load(path, mmap_mode='r') for name, path in npy_column_paths(csv_path).items()}
+    df = pd.read_csv(csv_path)
+    return {name: df[name].to_numpy() for name in NPY_COLUMNS}
+
+
+def load_pair_results(csv_path):
+    """Pair results as a DataFrame with the CSV's Doc1, Doc2 and Sim% columns."""
+    if has_npy_results(csv_path):
+        return pd.DataFrame(load_pair_columns(csv_path), copy=False)
+    return pd.read_csv(csv_path)
+
 
 def create_directories():
     directories = [
         'results/real', 'results/virtual', 'datasets/real', 'datasets/virtual', 'bin', 'results', 'logs'
     ]
-    types = ['bruteForce', 'MinHash', 'LSHbase', 'bucketing', 'forest']
+    types = ['bruteForce', 'MinHash', 'LSHbase', 'bucketing', 'forest', 'simhash']
     for directory in directories:
         if 'results/' in directory:
             for t in types:
@@ -56,6 +113,8 @@ def run_corpus_mode(executable_path, dataset_path, output_dir, k=None, t=None, b
         algo_type = 'bucketing'
     elif 'LSHforest' in executable_path:
         algo_type = 'forest'
+    elif 'SimHash' in executable_path:
+        algo_type = 'simhash'
     else:
         algo_type = 'unknown'
 
@@ -73,15 +132,21 @@ def run_corpus_mode(executable_path, dataset_path, output_dir, k=None, t=None, b
     # Add parameters if provided for other executables
     if k is not None:
         cmd.append(str(k))
+    # SimHash takes <k> <f> <sim_threshold>
+    if algo_type == 'simhash':
+        cmd.append(str(SIMHASH_BITS))
+        param_parts.append(f"f{SIMHASH_BITS}")
     if t is not None:
         cmd.append(str(t))
     if b is not None:
         cmd.append(str(b))
-    if thr is not None and algo_type in ['bucketing', 'forest']:
+    if thr is not None and algo_type in ['bucketing', 'forest', 'simhash']:
         cmd.append(str(thr))
+    if BINARY_RESULTS:
+        cmd.append("--npy")
 
-    # Only append threshold to filename for bucketing and forest
-    if algo_type in ['bucketing', 'forest'] and thr is not None:
+    # Only append threshold to filename for bucketing, forest and simhash
+    if algo_type in ['bucketing', 'forest', 'simhash'] and thr is not None:
         param_parts.append(f"threshold{thr}")
 
     try:
@@ -100,8 +165,7 @@ def run_corpus_mode(executable_path, dataset_path, output_dir, k=None, t=None, b
             similarity_csv = similarity_csv_default.replace('.csv', f'_run{run_idx}.csv')
             times_csv = times_csv_default.replace('.csv', f'_run{run_idx}.csv')
             
-            if os.path.exists(similarity_csv_default):
-                os.rename(similarity_csv_default, similarity_csv)
+            rename_pair_results(similarity_csv_default, similarity_csv)
             if os.path.exists(times_csv_default):
                 os.rename(times_csv_default, times_csv)
         else:
@@ -136,6 +200,81 @@ def run_corpus_mode(executable_path, dataset_path, output_dir, k=None, t=None, b
             'run_idx': run_idx
         }
 
+def run_sweep_mode(executable_path, dataset_path, output_dir, param, values, k, t=None, b=None, thr=None,
+                   base_b=None, run_idx=None):
+    """Run every value of `param` in one process with the engines' --sweep-* options.
+
+    Signatures are computed once at the largest t, so only banding and
+    querying are repeated; a k sweep shingles every document once for all
+    the k values (shingles keyed by word hashes, as in single-k runs, so the
+    results match one process per k). Returns one result per value, in the
+    same form as run_corpus_mode, with the CSVs renamed per run the same way."""
+    if 'MinHash' in executable_path:
+        algo_type = 'MinHash'
+    elif 'LSHbase' in executable_path:
+        algo_type = 'LSHbase'
+    elif 'LSHbucketing' in executable_path:
+        algo_type = 'bucketing'
+    elif 'LSHforest' in executable_path:
+        algo_type = 'forest'
+    else:
+        raise ValueError(f"{executable_path} has no sweep mode")
+    uses_b = algo_type in ['LSHbase', 'bucketing', 'forest']
+    uses_thr = algo_type in ['bucketing', 'forest']
+
+    # Positional values are the fixed ones; the swept parameter comes as a list
+    cmd = [executable_path, dataset_path, str(k), str(max(values) if param == 't' else t)]
+    if uses_b:
+        cmd.append(str(b))
+    if uses_thr:
+        cmd.append(str(thr))
+    cmd += [f"--sweep-{param}", ','.join(str(v) for v in values)]
+    if param == 't' and uses_b:
+        cmd += ["--sweep-b", f"{base_b}%"]
+    if BINARY_RESULTS:
+        cmd.append("--npy")
+
+    configs = []
+    for val in values:
+        cfg = {'k': k, 't': t, 'b': b if uses_b else None, 'thr': thr}
+        if param == 't':
+            cfg['t'] = val
+            if uses_b:
+                cfg['b'] = max(1, val * base_b // 100)
+        else:
+            cfg[param] = val
+        configs.append(cfg)
+
+    try:
+        start_time = time.time()
+        subprocess.run(cmd, capture_output=True, text=True, check=True)
+        elapsed = time.time() - start_time
+        logging.info(f"Successfully ran sweep of {param} with {executable_path} on {dataset_path}")
+    except subprocess.CalledProcessError as e:
+        logging.error(f"Error running sweep mode {executable_path}: {e}")
+        return [dict(cfg, dataset=dataset_path, output=e.stderr, runtime=None, status='error',
+                     method=algo_type, run_idx=run_idx) for cfg in configs]
+
+    results = []
+    for cfg in configs:
+        param_parts = [f"k{cfg['k']}", f"t{cfg['t']}"]
+        if uses_b:
+            param_parts.append(f"b{cfg['b']}")
+        if uses_thr:
+            param_parts.append(f"threshold{cfg['thr']}")
+        similarity_csv = os.path.join(output_dir, f"{algo_type}/{algo_type}Similarities_{'_'.join(param_parts)}.csv")
+        times_csv = os.path.join(output_dir, f"{algo_type}/{algo_type}Times_{'_'.join(param_parts)}.csv")
+        if run_idx is not None:
+            rename_pair_results(similarity_csv, similarity_csv.replace('.csv', f'_run{run_idx}.csv'))
+            if os.path.exists(times_csv):
+                os.rename(times_csv, times_csv.replace('.csv', f'_run{run_idx}.csv'))
+            similarity_csv = similarity_csv.replace('.csv', f'_run{run_idx}.csv')
+            times_csv = times_csv.replace('.csv', f'_run{run_idx}.csv')
+        results.append(dict(cfg, dataset=dataset_path, similarity_csv=similarity_csv, times_csv=times_csv,
+                            runtime=elapsed / len(configs), status='success', method=algo_type,
+                            run_idx=run_idx))
+    return results
+
 def parse_csv_results(result):
     """Parse results from CSV files instead of output"""
     if result['status'] == 'error':
@@ -157,22 +296,23 @@ def parse_csv_results(result):
     index_build_time = None
     query_time = None
 
-    # Parse similarity CSV if it exists
+    # Parse similarity CSV (or .npy columns) if it exists
     try:
-        if os.path.exists(result['similarity_csv']):
-            similarity_df = pd.read_csv(result['similarity_csv'])
+        if pair_results_exist(result['similarity_csv']):
+            columns = load_pair_columns(result['similarity_csv'])
             # Extract document pairs
-            if not similarity_df.empty:
-                # Assuming the CSV has columns for doc1, doc2, and similarity
-                for _, row in similarity_df.iterrows():
-                    doc1 = row["Doc1"] if len(row) > 0 else None
-                    doc2 = row["Doc2"] if len(row) > 1 else None
-                    similarity = row["Sim%"] if len(row) > 2 else None
-                    threshold = result['thr'] if result['thr'] is not None else None
-                    if threshold is None:
-                        print("=============== WARNING:  Threshold is None")
-                    if doc1 is not None and doc2 is not None and similarity is not None and similarity > threshold:
-                        similarity_pairs.append((str(doc1), str(doc2), similarity))
+            if len(columns['Sim%']) > 0:
+                threshold = result['thr']
+                if threshold is None:
+                    print("=============== WARNING:  Threshold is None")
+                similarities = np.asarray(columns['Sim%'], dtype=np.float64)
+                keep = similarities > threshold
+                # Rows used to come from iterrows, which turns numeric
+                # document ids into floats; keep the same strings
+                docs = [columns[name][keep] for name in ('Doc1', 'Doc2')]
+                if all(np.issubdtype(d.dtype, np.number) for d in docs):
+                    docs = [d.astype(np.float64) for d in docs]
+                similarity_pairs = list(zip(map(str, docs[0]), map(str, docs[1]), similarities[keep]))
             else:
                 logging.error(f"No similar pairs found for {result['method']}")
         else:
@@ -230,8 +370,11 @@ def parse_csv_results(result):
 
 
 def run_parameter_experiment(bin, dataset_dir, output_dir, param_to_vary, 
-                            base_k=5, base_t=500, base_b=50, base_thr=0.3, num_runs=30):
-    """Run experiments varying one parameter while fixing others, repeating each num_runs times"""
+                            base_k=5, base_t=500, base_b=50, base_thr=0.3, num_runs=30, sweep=False):
+    """Run experiments varying one parameter while fixing others, repeating each num_runs times.
+
+    With sweep=True, k, t, b and thr are varied inside one process per run
+    (the engines' --sweep-* options) instead of one process per value."""
     results = []
     
     base_b_value = int(base_t * (base_b / 100.0)) if base_b is not None else None
@@ -241,7 +384,7 @@ def run_parameter_experiment(bin, dataset_dir, output_dir, param_to_vary,
     for exec_name, exec_path in bin.items():
         logging.info(f"Running {exec_name} with varying {param_to_vary}")
         
-        uses_t = exec_name != 'brute_force'
+        uses_t = exec_name not in ['brute_force', 'simhash']
         uses_b = 'lsh' in exec_name
         uses_thr = exec_name not in ['minhash', 'lsh_basic', 'brute_force']
         
@@ -260,7 +403,21 @@ def run_parameter_experiment(bin, dataset_dir, output_dir, param_to_vary,
             values_to_try = [round(x * 0.1, 1) for x in range(1, 10)]
         else:
             values_to_try = []
-            
+
+        if sweep and values_to_try and param_to_vary in ['k', 't', 'b', 'thr'] and uses_t:
+            for run_idx in range(1, num_runs + 1):
+                for val, result in zip(values_to_try,
+                                       run_sweep_mode(exec_path, dataset_dir, output_dir, param_to_vary,
+                                                      values_to_try, k_val, t_val, b_val, thr_val,
+                                                      base_b, run_idx)):
+                    parsed_result = parse_csv_results(result)
+                    parsed_result['similarity_pairs_count'] = len(parsed_result['similarity_pairs'])
+                    parsed_result['varied_param'] = param_to_vary
+                    parsed_result['varied_value'] = val
+                    parsed_result['run_idx'] = run_idx
+                    results.append(parsed_result)
+            continue
+
         for val in values_to_try:
             if param_to_vary == 'k':
                 k_val = val
@@ -438,9 +595,9 @@ def get_precision(file_path1, file_path2):
         float: Average precision value between 0 and 1
     """
     try:
-        # Load both CSV files
-        df1 = pd.read_csv(file_path1)
-        df2 = pd.read_csv(file_path2)
+        # Load both CSV files (or their .npy columns)
+        df1 = load_pair_results(file_path1)
+        df2 = load_pair_results(file_path2)
         
         # Get the column names
         cols1 = df1.columns.tolist()
@@ -477,16 +634,14 @@ def get_precision(file_path1, file_path2):
                 logging.warning(f"No common document pairs between {file_path1} and {file_path2}")
                 return None
                 
-            # Extract similarity values for common pairs
-            sim_values1 = []
-            sim_values2 = []
-            
-            for pair in common_pairs:
-                idx1 = df1[(df1.iloc[:, 0] == pair[0]) & (df1.iloc[:, 1] == pair[1])].index[0]
-                idx2 = df2[(df2.iloc[:, 0] == pair[0]) & (df2.iloc[:, 1] == pair[1])].index[0]
-                
-                sim_values1.append(df1.iloc[idx1, 2])
-                sim_values2.append(df2.iloc[idx2, 2])
+            # Extract similarity values for common pairs: one join instead
+            # of a scan of both frames per pair
+            left = df1.iloc[:, :3].drop_duplicates(subset=[cols1[0], cols1[1]])
+            right = df2.iloc[:, :3].drop_duplicates(subset=[cols2[0], cols2[1]])
+            left.columns = right.columns = ['Doc1', 'Doc2', 'Sim']
+            common = left.merge(right, on=['Doc1', 'Doc2'], suffixes=('1', '2'))
+            sim_values1 = common['Sim1'].tolist()
+            sim_values2 = common['Sim2'].tolist()
         
         # Calculate precision for each pair
         precision_values = [1 - abs(v1 - v2) for v1, v2 in zip(sim_values1, sim_values2)]
@@ -565,7 +720,8 @@ def compare_accuracy(results_dfs, output_dir):
         'MinHash': {'color': 'blue', 'marker': 'D'},    # Diamond
         'LSHbase': {'color': 'orange', 'marker': 's'},  # Square
         'bucketing': {'color': 'green', 'marker': 'o'}, # Circle
-        'forest': {'color': 'red', 'marker': '^'}       # Triangle
+        'forest': {'color': 'red', 'marker': '^'},      # Triangle
+        'simhash': {'color': 'purple', 'marker': 'v'}   # Inverted triangle
     }
     
     # Generate plots for each varied parameter
@@ -631,7 +787,7 @@ def compare_similarity_accuracy(results_dfs, output_dir, mode):
     all_similarity_csvs = {}
     for df in results_dfs:
         for _, row in df.iterrows():
-            if isinstance(row['similarity_csv'], str) and os.path.exists(row['similarity_csv']):
+            if isinstance(row['similarity_csv'], str) and pair_results_exist(row['similarity_csv']):
                 method = row['method']
                 param = row['varied_param']
                 value = row['varied_value']
@@ -673,18 +829,18 @@ def compare_similarity_accuracy(results_dfs, output_dir, mode):
                     base_k in all_similarity_csvs['bruteForce']['k']):
                     bf_file = all_similarity_csvs['bruteForce']['k'][base_k][1]  # Use run 1
 
-            if not bf_file or not os.path.exists(bf_file):
+            if not bf_file or not pair_results_exist(bf_file):
                 logging.warning(f"No bruteForce file found for {param}={value} (base k={base_k})")
                 continue
 
             # Step 5: Compare with approximate methods
-            for algo in ['MinHash', 'LSHbase', 'bucketing', 'forest']:
+            for algo in ['MinHash', 'LSHbase', 'bucketing', 'forest', 'simhash']:
                 if (algo in all_similarity_csvs and 
                     param in all_similarity_csvs[algo] and 
                     value in all_similarity_csvs[algo][param]):
                     run_files = all_similarity_csvs[algo][param][value]
                     for run_idx, algo_file in run_files.items():
-                        if os.path.exists(algo_file):
+                        if pair_results_exist(algo_file):
                             precision = get_precision(bf_file, algo_file)
                             if precision is not None:
                                 similarity_precision_results.append({
@@ -752,8 +908,8 @@ def create_heatmap(csv_file, output_dir):
         output_dir: Directory to save the heatmap image.
     """
     try:
-        # Leer el archivo CSV
-        df = pd.read_csv(csv_file)
+        # Leer el archivo CSV (o sus columnas .npy)
+        df = load_pair_results(csv_file)
         
         # Verificar si tiene las columnas necesarias
         if 'Doc1' not in df.columns or 'Doc2' not in df.columns or 'Sim%' not in df.columns:
@@ -882,7 +1038,7 @@ def analyze_and_visualize_results(mode, experiment_types=['vary_k', 'vary_t', 'v
     similarity_precision_df = compare_similarity_accuracy(results_dfs, viz_dir, mode)
     
     # Create heatmaps from similarity CSV files
-    for algo_type in ['bruteForce', 'MinHash', 'LSHbase', 'bucketing', 'forest']:
+    for algo_type in ['bruteForce', 'MinHash', 'LSHbase', 'bucketing', 'forest', 'simhash']:
         similarity_dir = os.path.join(output_dir, algo_type)
         if os.path.exists(similarity_dir):
             # Find similarity CSV files
@@ -1002,8 +1158,7 @@ def create_summary_report(results_dfs, accuracy_df, similarity_precision_df, out
 
 def get_third_column_values(file_path):
     try:
-        df = pd.read_csv(file_path)  
-        third_column = df.iloc[:, 2].tolist()  
+        third_column = load_pair_columns(file_path)['Sim%'].tolist()
         return third_column
     except Exception as e:
         print(f"Error: {e}")
@@ -1106,8 +1261,16 @@ def main():
                         type=int,
                         default=5,
                         help='Number of runs for each experiment')
+    parser.add_argument('--sweep',
+                        action='store_true',
+                        help='Vary k, t, b and threshold inside one process per run (documents read once)')
+    parser.add_argument('--binary_results',
+                        action='store_true',
+                        help='Have the engines write pair results as .npy columns (--npy) instead of CSVs')
 
     args = parser.parse_args()
+    global BINARY_RESULTS
+    BINARY_RESULTS = args.binary_results
 
     create_directories()
     setup_logging()
@@ -1123,7 +1286,8 @@ def main():
         'minhash': './bin/jaccardMinHash',
         'lsh_basic': './bin/jaccardLSHbase',
         'lsh_bucketing': './bin/jaccardLSHbucketing',
-        'lsh_forest': './bin/jaccardLSHforest'
+        'lsh_forest': './bin/jaccardLSHforest',
+        'simhash': './bin/jaccardSimHash'
     }
 
     dataset_dir = os.path.join('datasets', args.mode)
@@ -1136,7 +1300,7 @@ def main():
         if args.experiment_type == 'vary_k' or args.experiment_type == 'all':
             logging.info("Running experiment varying k...")
             csvs = run_parameter_experiment(bin, dataset_dir, output_dir, 'k', 
-                                    args.base_k, args.base_t, args.base_b, args.base_thr, args.num_runs)
+                                    args.base_k, args.base_t, args.base_b, args.base_thr, args.num_runs, args.sweep)
             values_to_try = list(range(1, 15))
             # print(values_to_try)
             output = precisions_files_var(csvs,'k',values_to_try,args.mode)
@@ -1150,7 +1314,7 @@ def main():
         if args.experiment_type == 'vary_t' or args.experiment_type == 'all':
             logging.info("Running experiment varying t...")
             csvs = run_parameter_experiment(bin, dataset_dir, output_dir, 't', 
-                                    args.base_k, args.base_t, args.base_b, args.base_thr, args.num_runs)
+                                    args.base_k, args.base_t, args.base_b, args.base_thr, args.num_runs, args.sweep)
             
             values_to_try = list(range(100, 1001, 100))
             # print(values_to_try)
@@ -1163,7 +1327,7 @@ def main():
         if args.experiment_type == 'vary_b' or args.experiment_type == 'all':
             logging.info("Running experiment varying b...")
             csvs = run_parameter_experiment(bin, dataset_dir, output_dir, 'b', 
-                                    args.base_k, args.base_t, args.base_b, args.base_thr, args.num_runs)
+                                    args.base_k, args.base_t, args.base_b, args.base_thr, args.num_runs, args.sweep)
 
             
             
@@ -1171,7 +1335,7 @@ def main():
         if args.experiment_type == 'vary_thr' or args.experiment_type == 'all':
             logging.info("Running experiment varying threshold...")
             run_parameter_experiment(bin, dataset_dir, output_dir, 'thr', 
-                                    args.base_k, args.base_t, args.base_b, args.base_thr, args.num_runs)
+                                    args.base_k, args.base_t, args.base_b, args.base_thr, args.num_runs, args.sweep)
 
         logging.info("Experiments completed successfully.")
     
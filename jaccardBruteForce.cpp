@@ -3,13 +3,24 @@
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <optional>
 #include <regex>
 #include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_set>
 #include <vector>
 
+#include "common/npyWriter.hpp"
+#include "common/options.hpp"
+#include "common/memoryReport.hpp"
+#include "common/perfCounters.hpp"
+#include "common/profiler.hpp"
+#include "common/resultWriter.hpp"
+#include "common/stopwords.hpp"
+#include "common/threadPool.hpp"
+#include "common/tokenizer.hpp"
 #include "deps/nlohmann/json.hpp"
 
 using namespace std;
@@ -17,8 +28,9 @@ using namespace nlohmann;
 namespace fs = filesystem;
 
 typedef unsigned int uint;
-unordered_set<string> stopwords;
-map<string, int> times;
+StopwordFilter stopwords;
+map<string, double> times;
+bool npyOutput = false; // Pairs as .npy columns (--npy)
 
 struct Result
 {
@@ -33,29 +45,21 @@ vector<Result> results;
 class Timer
 {
 private:
-  chrono::high_resolution_clock::time_point startTime;
+  ProfileScope scope;  // Also the scope of the trace (common/profiler.hpp)
+  StageCounters counters;  // --perf-counters (common/perfCounters.hpp)
+  StageMemory memory;  // --memory (common/memoryReport.hpp)
   string operationName;
 
 public:
-  Timer(const string &name) : operationName(name)
-  {
-    startTime = chrono::high_resolution_clock::now();
-  }
+  Timer(const string &name)
+    : scope(Profiler::instance().intern(name)),
+      counters(Profiler::instance().intern(name)),
+      memory(Profiler::instance().intern(name)),
+      operationName(name) {}
 
   ~Timer()
   {
-    auto endTime = chrono::high_resolution_clock::now();
-    auto duration =
-        chrono::duration_cast<chrono::milliseconds>(endTime - startTime)
-            .count();
-    if (times.count(operationName) == 0)
-    {
-      times[operationName] = duration;
-    }
-    else
-    {
-      times[operationName] += duration;
-    }
+    times[operationName] += scope.elapsedMs();
   }
 };
 
@@ -65,7 +69,7 @@ public:
 
 bool is_stopword(const string &word)
 {
-  return stopwords.find(word) != stopwords.end();
+  return stopwords.contains(word);
 }
 
 unordered_set<string> loadStopwords(const string &filename)
@@ -93,36 +97,6 @@ unordered_set<string> loadStopwords(const string &filename)
 // Text Processing
 //---------------------------------------------------------------------------
 
-string remove_punctuation(const string &text)
-{
-  string newtext;
-  for (char c : text)
-  {
-    if (ispunct(c))
-    {
-      newtext += ' ';
-    }
-    else
-    {
-      newtext += c;
-    }
-  }
-  return newtext;
-}
-
-string normalize(const string &word)
-{
-  string result;
-  for (char c : word)
-  {
-    if (isalpha(c))
-    {
-      result += tolower(c);
-    }
-  }
-  return result;
-}
-
 string readFile(const string &filename)
 {
   ifstream file(filename);
@@ -149,17 +123,15 @@ unordered_set<string> generateShingles(const string &text, uint k)
 {
   unordered_set<string> shingles;
   vector<string> words;
-  stringstream ss(text);
-  string word;
 
-  while (ss >> word)
+  // Punctuation separates words here, as if it were replaced by spaces
+  forEachWord(text, [&](const string &norm_word)
   {
-    string norm_word = normalize(word);
     if (!is_stopword(norm_word))
     {
       words.push_back(norm_word);
     }
-  }
+  }, kSplitOnPunctuation);
 
   if (words.size() >= k)
   {
@@ -230,22 +202,46 @@ int main(int argc, char *argv[])
   int k;
   {
     Timer processTimer("time");
-    if (argc != 3)
+    Options opts = parseOptions(argc, argv);
+    if (opts.positional.size() != 2)
     {
-      cout << "Usage: " << argv[0] << " <directory> <k>" << endl;
+      cout << "Usage: " << argv[0] << " <directory> <k> [--threads N] [--stopwords FILE] [--npy] [--trace FILE] [--perf-counters] [--memory]" << endl;
+      cout << "--npy writes the pairs as .npy columns (doc1, doc2, sim) instead of a CSV" << endl;
+      cout << "--trace FILE writes a Chrome trace of the timed stages to FILE" << endl;
+      cout << "--perf-counters writes hardware counters per stage to a Counters CSV next to the times" << endl;
+      cout << "--memory writes the size of the shingle sets and pairs and the peak RSS per stage to a Memory CSV next to the times" << endl;
       return 1;
     }
 
-    string directory = argv[1];
-    k = stoi(argv[2]);
+    string directory = opts.positional[0];
+    k = stoi(opts.positional[1]);
+    try
+    {
+      ThreadPool::setThreads(opts.getPositiveInt("threads", thread::hardware_concurrency()));
+    }
+    catch (const exception &e)
+    {
+      cerr << "Error: " << e.what() << endl;
+      return 1;
+    }
+    npyOutput = opts.has("npy");
+    string tracePath = opts.get("trace");
+    if (!tracePath.empty())
+      Profiler::instance().traceTo(tracePath);
+    if (opts.has("perf-counters"))
+      PerfCounters::instance().start();
+    if (opts.has("memory"))
+      MemoryReport::instance().enable();
+    if (opts.has("stopwords"))
+    {
+      stopwords = StopwordFilter(loadStopwords(opts.get("stopwords")));
+    }
     if (k <= 0)
     {
       cerr << "Error: k must be positive" << endl;
       return 1;
     }
 
-    stopwords = loadStopwords("stopwords-en.json");
-
     vector<string> files;
     for (const auto &entry : fs::directory_iterator(directory))
     {
@@ -258,39 +254,66 @@ int main(int argc, char *argv[])
     // Pre-allocate space for results
     results.reserve(files.size() * (files.size() - 1) / 2);
 
-    for (size_t i = 0; i < files.size(); i++)
+    ThreadPool &pool = ThreadPool::instance();
+
+    // Shingle every file once instead of once per pair
+    vector<string> docNumbers(files.size());
+    vector<optional<unordered_set<string>>> shingleSets(files.size());
+    pool.parallelFor(0, files.size(), [&](size_t i)
     {
-      string doc1 = extract_doc_number(files[i]);
-      if (doc1 == "0")
-        continue; // Skip document 0
+      docNumbers[i] = extract_doc_number(files[i]);
+      if (docNumbers[i] == "0")
+        return; // Skip document 0
 
-      for (size_t j = i + 1; j < files.size(); j++)
-      {
-        string doc2 = extract_doc_number(files[j]);
-        if (doc2 == "0")
-          continue; // Skip document 0
+      string text = readFile(files[i]);
+      if (text.empty())
+        return;
 
-        string text1 = remove_punctuation(readFile(files[i]));
-        string text2 = remove_punctuation(readFile(files[j]));
+      shingleSets[i] = generateShingles(text, k);
+    });
 
-        if (text1.empty() || text2.empty())
-          continue;
+    // Each row i (pairs i, j > i) is an independent task
+    vector<vector<Result>> rowResults(files.size());
+    pool.parallelFor(0, files.size(), [&](size_t i)
+    {
+      if (!shingleSets[i])
+        return;
 
-        double similarity = 0.0;
-        unordered_set<string> shingles1;
-        unordered_set<string> shingles2;
+      for (size_t j = i + 1; j < files.size(); j++)
+      {
+        if (!shingleSets[j])
+          continue;
 
-        shingles1 = generateShingles(text1, k);
-        shingles2 = generateShingles(text2, k);
+        Result result;
+        result.doc1 = docNumbers[i];
+        result.doc2 = docNumbers[j];
+        result.similarity = calculateJaccardSimilarity(*shingleSets[i], *shingleSets[j]);
+        rowResults[i].push_back(result);
+      }
+    });
 
-        similarity = calculateJaccardSimilarity(shingles1, shingles2);
+    for (auto &row : rowResults)
+    {
+      for (auto &result : row)
+      {
+        results.push_back(move(result));
+      }
+    }
 
-        Result result;
-        result.doc1 = doc1;
-        result.doc2 = doc2;
-        result.similarity = similarity;
-        results.push_back(result);
+    // --memory: the shingle sets and the pairs
+    if (MemoryReport::instance().isEnabled())
+    {
+      size_t shingles = 0;
+      for (const auto &set : shingleSets)
+      {
+        if (set)
+          shingles += set->size();
       }
+      MemoryReport::instance().structure("shingleSets", shingles, heapBytes(shingleSets));
+      size_t bytes = allocationBytes(results.capacity() * sizeof(Result));
+      for (const Result &result : results)
+        bytes += heapBytes(result.doc1) + heapBytes(result.doc2);
+      MemoryReport::instance().structure("results", results.size(), bytes);
     }
   }
 
@@ -315,22 +338,59 @@ int main(int argc, char *argv[])
 
   std::string filename2 = ss2.str();
  
-  ofstream file(filename1);
-  if (!file.is_open())
+  if (npyOutput)
   {
-    cerr << "Error: Unable to open file " << filename1 << " for writing" << endl;
-    return 1;
+    // Document numbers as in the CSV; a file name without one becomes -1
+    auto number = [](const string &doc)
+    {
+      bool digits = !doc.empty() && all_of(doc.begin(), doc.end(), ::isdigit);
+      return digits ? stoll(doc) : -1LL;
+    };
+    PairNpyWriter columns(npyBase(filename1));
+    if (!columns.isOpen())
+    {
+      cerr << "Error: Unable to open the .npy files of " << filename1 << " for writing" << endl;
+      return 1;
+    }
+    for (const auto &result : results)
+    {
+      columns.add(number(result.doc1), number(result.doc2), result.similarity);
+    }
+    if (!columns.close())
+    {
+      cerr << "Error: Could not write the .npy files of " << filename1 << endl;
+    }
   }
+  else
+  {
+    ResultWriter file(filename1);
+    if (!file.isOpen())
+    {
+      cerr << "Error: Unable to open file " << filename1 << " for writing" << endl;
+      return 1;
+    }
 
-  // Write header
-  file << "Doc1,Doc2,Sim%" << endl;
+    // Write header
+    file.append("Doc1,Doc2,Sim%\n");
 
-  for (const auto &result : results)
-  {
-    file << result.doc1 << "," << result.doc2 << "," << fixed << setprecision(6) << result.similarity << endl;
-  }
+    string row;
+    for (const auto &result : results)
+    {
+      row.clear();
+      row += result.doc1;
+      row += ',';
+      row += result.doc2;
+      row += ',';
+      appendFixed(row, result.similarity);
+      row += '\n';
+      file.append(row);
+    }
 
-  file.close();
+    if (!file.close())
+    {
+      cerr << "Error: Could not write " << filename1 << endl;
+    }
+  }
   
   ofstream fileTime(filename2);
   if (!fileTime.is_open())
@@ -341,11 +401,20 @@ int main(int argc, char *argv[])
 
   // Write header
   fileTime << "Operation,Time(ms)" << endl;
+  fileTime << fixed << setprecision(3);  // Milliseconds to the microsecond
   for (const auto &pair : times)
   {
     fileTime << pair.first << "," << pair.second << endl;
   }
   fileTime.close();
+  if (!PerfCounters::instance().writeCSV(filename2))
+  {
+    cerr << "Error: Unable to write the counters next to " << filename2 << endl;
+  }
+  if (!MemoryReport::instance().writeCSV(filename2))
+  {
+    cerr << "Error: Unable to write the memory report next to " << filename2 << endl;
+  }
 
   return 0;
 }
@@ -3,6 +3,7 @@
 #include <climits>
 #include <cmath>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include "deps/nlohmann/json.hpp"
 #include <queue>
@@ -13,6 +14,21 @@
 #include <vector>
 #include <filesystem> // For directory iteration
 #include <map>        // For storing results
+#include <optional>
+#include <thread>
+#include "common/dictionary.hpp"
+#include "common/npyWriter.hpp"
+#include "common/options.hpp"
+#include "common/memoryReport.hpp"
+#include "common/perfCounters.hpp"
+#include "common/profiler.hpp"
+#include "common/resultWriter.hpp"
+#include "common/shingler.hpp"
+#include "common/signatureStore.hpp"
+#include "common/sweep.hpp"
+#include "common/stopwords.hpp"
+#include "common/threadPool.hpp"
+#include "common/tokenizer.hpp"
 
 using namespace std;
 using namespace nlohmann;
@@ -22,9 +38,13 @@ unsigned int k;                          // Size of k-shingles
 int numHashFunctions;                    // Number of hash functions for minhash (now a variable)
 vector<pair<int, int>> hashCoefficients; // [a, b] for hash function(x) = (ax + b) % p
 int p;                                   // Prime number for hash functions
-unordered_set<string> stopwords;         // Stopwords
+uint64_t hashSeed;                       // Seed of the coefficients (--seed)
+StopwordFilter stopwords;                // Stopwords
+bool useWordIds = false;                 // Shingles from word ids (--word-ids)
+bool npyOutput = false;                  // Pairs as .npy columns (--npy)
+WordDictionary dictionary;               // Word -> id, shared by all documents
 vector<vector<float>> Data;
-map<string, int> timeResults; // Map to store execution times
+map<string, double> timeResults; // Map to store execution times
 
 // Struct to hold similarity results
 struct SimilarityResult
@@ -39,29 +59,21 @@ struct SimilarityResult
 class Timer
 {
 private:
-  chrono::high_resolution_clock::time_point startTime;
+  ProfileScope scope;  // Also the scope of the trace (common/profiler.hpp)
+  StageCounters counters;  // --perf-counters (common/perfCounters.hpp)
+  StageMemory memory;  // --memory (common/memoryReport.hpp)
   string operationName;
 
 public:
-  Timer(const string &name) : operationName(name)
-  {
-    startTime = chrono::high_resolution_clock::now();
-  }
+  Timer(const string &name)
+    : scope(Profiler::instance().intern(name)),
+      counters(Profiler::instance().intern(name)),
+      memory(Profiler::instance().intern(name)),
+      operationName(name) {}
 
   ~Timer()
   {
-    auto endTime = chrono::high_resolution_clock::now();
-    auto duration =
-        chrono::duration_cast<chrono::milliseconds>(endTime - startTime)
-            .count();
-    if (timeResults.count(operationName) == 0)
-    {
-      timeResults[operationName] = duration;
-    }
-    else
-    {
-      timeResults[operationName] += duration;
-    }
+    timeResults[operationName] += scope.elapsedMs();
   }
 };
 
@@ -71,7 +83,7 @@ public:
 // Check if a word is a stopword
 bool is_stopword(const string &word)
 {
-  return stopwords.find(word) != stopwords.end();
+  return stopwords.contains(word);
 }
 
 // load stopwords from a file into stopword set
@@ -100,21 +112,6 @@ unordered_set<string> loadStopwords(const string &filename)
 // Treating Format
 //---------------------------------------------------------------------------
 
-// Remove punctuation and convert to lowercase
-string normalize(const string &word)
-{
-  string result;
-  result.reserve(word.length());
-  for (char c : word)
-  {
-    if (isalpha(c))
-    {
-      result += tolower(c);
-    }
-  }
-  return result;
-}
-
 // Read content from file
 string readFile(const string &filename)
 {
@@ -187,9 +184,8 @@ void initializeHashFunctions()
   p = nextPrime(
       10000); // A prime number larger than maximum possible shingle ID
 
-  // Use a time-based seed for better randomness
-  unsigned seed = chrono::system_clock::now().time_since_epoch().count();
-  mt19937 gen(seed);
+  // Seeded from --seed (the clock by default) so runs can be reproduced
+  mt19937 gen(hashSeed);
   uniform_int_distribution<> dis(1, p - 1);
 
   hashCoefficients.reserve(numHashFunctions);
@@ -199,58 +195,53 @@ void initializeHashFunctions()
   }
 }
 
-// Function to process text and extract k-shingles
-void tratar(const string &texto, unordered_set<string> &kShingles)
+// How shingles are hashed and signed, recorded in signature stores
+string hashFamily()
 {
-  queue<string> palabras; // queue to hold k consecutive words
-  string word;
-  stringstream ss(texto);
-
-  while (ss >> word)
-  { // read word from stringstream
-    // remove punctuation and convert to lowercase
-    word = normalize(word);
-    if (!is_stopword(word))
-    {
-      if (word.empty())
-        continue; // Skip empty words after normalization
-
-      palabras.push(word);
-      if (palabras.size() == k)
-      { // if we have k words in the queue, we have a k-shingle!
-        // Optimization: build the shingle directly with an estimated string
-        string shingle;
-        shingle.reserve(k * 10); // Reserve approximate space
-
-        queue<string> temp = palabras;
-        for (size_t i = 0; i < k; i++)
-        {
-          shingle += temp.front();
-          temp.pop();
-          if (i < k - 1)
-            shingle += " ";
-        }
+  return string(useWordIds ? "word-ids" : "std-hash-words") + "/mt19937/p" + to_string(p);
+}
 
-        kShingles.insert(shingle);
-        // Remove the first word to advance (sliding window approach)
-        palabras.pop();
-      }
-    }
-  }
+// Function to process text and extract k-shingles, stored as 64-bit keys.
+// Words are keyed by their dictionary id with --word-ids, by their hash
+// otherwise, and a shingle by mixing the keys of its k words
+// (common/shingler.hpp): the keys tratarMultiK gives for the same k, so a
+// --sweep-k run finds the same shingles as one run per k.
+void tratar(const string &texto, unordered_set<uint64_t> &kShingles)
+{
+  vector<uint64_t> words;
+  forEachWord(texto, [&](const string &word)
+  {
+    if (word.empty() || is_stopword(word))
+      return;
+    words.push_back(useWordIds ? dictionary.intern(word) : hash<string>{}(word));
+  });
+  forEachShingle(words, k, [&](uint64_t key) { kShingles.insert(key); });
+}
+
+// Shingles for every k of the shingler in one pass over the words (--sweep-k).
+// Words are keyed by their dictionary id with --word-ids, by their hash
+// otherwise; kShingles[i] gets the shingles for shingler.sizes()[i].
+void tratarMultiK(const string &texto, MultiShingler &shingler, vector<unordered_set<uint64_t>> &kShingles)
+{
+  shingler.reset();
+  forEachWord(texto, [&](const string &word)
+  {
+    if (word.empty() || is_stopword(word))
+      return;
+    uint64_t wordHash = useWordIds ? dictionary.intern(word) : hash<string>{}(word);
+    shingler.push(wordHash, [&](size_t i, uint64_t key) { kShingles[i].insert(key); });
+  });
 }
 
 // Function to compute MinHash signatures
-vector<int> computeMinHashSignature(const unordered_set<string> &kShingles)
+vector<int> computeMinHashSignature(const unordered_set<uint64_t> &kShingles)
 {
   vector<int> signature(numHashFunctions, INT_MAX);
 
-  // Cache hash values to avoid recomputation
-  hash<string> hasher;
-
   // For each shingle in the set
-  for (const string &shingle : kShingles)
+  for (uint64_t key : kShingles)
   {
-    int shingleID = hasher(shingle); // Convert shingle to a unique integer
+    int shingleID = static_cast<int>(key); // Shingle as an integer
 
     // Apply each hash function
     for (int i = 0; i < numHashFunctions; i++)
@@ -334,31 +325,63 @@ void writeResultsToCSV(const string &filename1,
     fs::create_directories(csvPath.parent_path());
   }
 
-  ofstream file(csvFilename);
-  if (!file.is_open())
+  if (npyOutput)
   {
-    cerr << "Error: Unable to open file " << csvFilename << " for writing" << endl;
-    return;
+    // Same rows as .npy columns, IsSimilar as a uint8 column of its own
+    string base = npyBase(csvFilename);
+    PairNpyWriter columns(base);
+    NpyColumn<uint8_t> similar(base + ".similar.npy", "|u1");
+    if (!columns.isOpen() || !similar.isOpen())
+    {
+      cerr << "Error: Unable to open the .npy files of " << csvFilename << " for writing" << endl;
+      return;
+    }
+    for (const auto &result : results)
+    {
+      columns.add(extractNumber(result.file1), extractNumber(result.file2), result.similarity);
+      similar.push(result.isSimilar ? 1 : 0);
+    }
+    bool ok = columns.close();
+    if (!similar.close() || !ok)
+    {
+      cerr << "Error: Could not write the .npy files of " << csvFilename << endl;
+    }
   }
+  else
+  {
+    ResultWriter file(csvFilename);
+    if (!file.isOpen())
+    {
+      cerr << "Error: Unable to open file " << csvFilename << " for writing" << endl;
+      return;
+    }
 
-  // Write header
-  file << "Doc1,Doc2,Sim%,IsSimilar" << endl;
+    // Write header
+    file.append("Doc1,Doc2,Sim%,IsSimilar\n");
 
-  // Write data rows
-  for (const auto &result : results)
-  {
-    int docNum1 = extractNumber(result.file1);
-    int docNum2 = extractNumber(result.file2);
+    // Write data rows
+    string row;
+    for (const auto &result : results)
+    {
+      int docNum1 = extractNumber(result.file1);
+      int docNum2 = extractNumber(result.file2);
+
+      row.clear();
+      appendInt(row, docNum1);
+      row += ',';
+      appendInt(row, docNum2);
+      row += ',';
+      appendFixed(row, result.similarity);
+      row += result.isSimilar ? ",1\n" : ",0\n";
+      file.append(row);
+    }
 
-    file << docNum1 << ","
-         << docNum2 << ","
-         << fixed << setprecision(6) << result.similarity << ","
-         << (result.isSimilar ? 1 : 0)
-         << endl;
+    if (!file.close())
+    {
+      cerr << "Error: Could not write " << csvFilename << endl;
+    }
   }
 
-  file.close();
-
   // Open new file to store the time results
   string timeFilename = filename2;
   if (timeFilename.substr(timeFilename.length() - 4) != ".csv")
@@ -382,6 +405,7 @@ void writeResultsToCSV(const string &filename1,
 
   // Write header
   fileTime << "Operation,Time(ms)" << endl;
+  fileTime << fixed << setprecision(3);  // Milliseconds to the microsecond
 
   for (const auto &pair : timeResults)
   {
@@ -389,6 +413,14 @@ void writeResultsToCSV(const string &filename1,
   }
 
   fileTime.close();
+  if (!PerfCounters::instance().writeCSV(timeFilename))
+  {
+    cerr << "Error: Unable to write the counters next to " << timeFilename << endl;
+  }
+  if (!MemoryReport::instance().writeCSV(timeFilename))
+  {
+    cerr << "Error: Unable to write the memory report next to " << timeFilename << endl;
+  }
   cout << "Results written to " << csvFilename << endl;
 }
 
@@ -438,6 +470,145 @@ bool LSH(const vector<int> &signature1, const vector<int> &signature2,
   return false;
 }
 
+// All-pairs comparison of the signed files, banded with b bands
+vector<SimilarityResult> compareSignatures(const vector<string> &filePaths,
+                                           const map<string, vector<int>> &fileSignatures,
+                                           int b)
+{
+  // Each row i (pairs i, j > i) is an independent task; rows shrink
+  // towards the end, which work stealing evens out
+  vector<vector<SimilarityResult>> rowResults(filePaths.size());
+  ThreadPool::instance().parallelFor(0, filePaths.size(), [&](size_t i)
+  {
+    auto it1 = fileSignatures.find(filePaths[i]);
+    if (it1 == fileSignatures.end())
+      return;
+
+    for (size_t j = i + 1; j < filePaths.size(); j++)
+    {
+      // Skip if either file couldn't be processed
+      auto it2 = fileSignatures.find(filePaths[j]);
+      if (it2 == fileSignatures.end())
+      {
+        continue;
+      }
+
+      const vector<int> &signature1 = it1->second;
+      const vector<int> &signature2 = it2->second;
+
+      float similarity = SimilaridadDeJaccard(signature1, signature2);
+      bool isSimilar = LSH(signature1, signature2, b);
+
+      rowResults[i].push_back({filePaths[i], filePaths[j], similarity, isSimilar});
+    }
+  });
+
+  vector<SimilarityResult> results;
+  for (auto &row : rowResults)
+  {
+    for (auto &result : row)
+    {
+      results.push_back(move(result));
+    }
+  }
+  return results;
+}
+
+// results/<category>/LSHbase/LSHbase<kind>_k.._t.._b...csv
+string resultPath(const string &category, const string &kind, int b)
+{
+  stringstream ss;
+  ss << "results/" << category << "/LSHbase/LSHbase" << kind << "_k" << k
+     << "_t" << numHashFunctions << "_b" << b << ".csv";
+  return ss.str();
+}
+
+//---------------------------------------------------------------------------
+// Parameter sweep
+//---------------------------------------------------------------------------
+// Every (t, b) combination from one signing pass, using signature prefixes
+// for the smaller t. Each combination writes the CSV pair a standalone run
+// would, with the shared reading and signing time in its index build.
+void runSweep(const vector<string> &filePaths,
+              const map<string, vector<int>> &signedFiles,
+              const SweepPlan &sweep, const string &category)
+{
+  const map<string, double> shared = timeResults;
+  for (int sweepT : sweep.ts)
+  {
+    numHashFunctions = sweepT;
+    map<string, vector<int>> fileSignatures;
+    for (const auto &entry : signedFiles)
+    {
+      const vector<int> &signature = entry.second;
+      fileSignatures[entry.first] = vector<int>(signature.begin(), signature.begin() + sweepT);
+    }
+
+    for (const string &bands : sweep.bands)
+    {
+      int b = SweepPlan::bandsFor(bands, sweepT);
+      if (b <= 0 || b > sweepT)
+      {
+        cerr << "Warning: Skipping b=" << b << " for t=" << sweepT << endl;
+        continue;
+      }
+      timeResults = shared;
+      vector<SimilarityResult> results;
+      {
+        Timer timerQuery("query time");
+        results = compareSignatures(filePaths, fileSignatures, b);
+      }
+      timeResults["time"] = timeResults["index build"] + timeResults["query time"];
+      writeResultsToCSV(resultPath(category, "Similarities", b),
+                        resultPath(category, "Times", b), results);
+    }
+  }
+}
+
+// Reads and signs every file once for all the k values of --sweep-k;
+// element i maps each signed file to its signature for ks[i]
+vector<map<string, vector<int>>> signFilesMultiK(const vector<string> &filePaths,
+                                                 const vector<int> &ks)
+{
+  const vector<unsigned> sizes(ks.begin(), ks.end());
+  vector<vector<optional<vector<int>>>> slots(ks.size(), vector<optional<vector<int>>>(filePaths.size()));
+  ThreadPool::instance().parallelFor(0, filePaths.size(), [&](size_t f)
+  {
+    const string &filePath = filePaths[f];
+    string content = readFile(filePath);
+    if (content.empty())
+    {
+      cerr << "Warning: File is empty or could not be read: " << filePath << endl;
+      return;
+    }
+
+    MultiShingler shingler(sizes);
+    vector<unordered_set<uint64_t>> kShingles(ks.size());
+    tratarMultiK(content, shingler, kShingles);
+
+    for (size_t i = 0; i < ks.size(); i++)
+    {
+      if (kShingles[i].empty())
+      {
+        cerr << "Warning: No k-shingles could be extracted with k=" << ks[i] << " from: " << filePath << endl;
+        continue;
+      }
+      slots[i][f] = computeMinHashSignature(kShingles[i]);
+    }
+  });
+
+  vector<map<string, vector<int>>> fileSignatures(ks.size());
+  for (size_t i = 0; i < ks.size(); i++)
+  {
+    for (size_t f = 0; f < filePaths.size(); f++)
+    {
+      if (slots[i][f])
+        fileSignatures[i][filePaths[f]] = move(*slots[i][f]);
+    }
+  }
+  return fileSignatures;
+}
+
 //---------------------------------------------------------------------------
 // Main
 //---------------------------------------------------------------------------
@@ -449,25 +620,63 @@ int main(int argc, char *argv[])
   vector<SimilarityResult> results;
   {
     Timer timerInit("time");
-    
-    stopwords = loadStopwords("stopwords-en.json");
 
-    if (argc != 5)
+    Options opts = parseOptions(argc, argv);
+    if (opts.positional.size() != 4)
     {
-      cout << "Usage: " << argv[0] << " <directory> <k> <t> <b>" << endl;
+      cout << "Usage: " << argv[0] << " <directory> <k> <t> <b> [options]" << endl;
       cout << "where:" << endl;
       cout << "  <directory> is the directory containing text files to compare" << endl;
       cout << "  <k> is the shingle size" << endl;
       cout << "  <t> is the number of hash functions" << endl;
       cout << "  <b> is the number of bands for LSH" << endl;
+      cout << "  --threads N is the number of worker threads (default: all cores)" << endl;
+      cout << "  --stopwords FILE replaces the built-in stopword list with a JSON list" << endl;
+      cout << "  --word-ids builds shingles from dictionary word ids instead of strings" << endl;
+      cout << "  --seed N seeds the hash functions (default: clock)" << endl;
+      cout << "  --save-signatures FILE saves the signatures to a store" << endl;
+      cout << "  --signatures FILE compares the signatures of a store instead of reading <directory>" << endl;
+      cout << "  --sweep-t LIST, --sweep-b LIST run every (t, b) combination in one process" << endl;
+      cout << "    (b may be a percentage of t, e.g. 50%)" << endl;
+      cout << "  --sweep-k LIST shingles once for every k in the list and runs the sweep per k" << endl;
+      cout << "  --npy writes the pairs as .npy columns (doc1, doc2, sim, similar) instead of a CSV" << endl;
+      cout << "  --trace FILE writes a Chrome trace of the timed stages to FILE" << endl;
+      cout << "  --perf-counters writes hardware counters per stage to a Counters CSV next to the times" << endl;
+      cout << "  --memory writes the size of the signatures and the peak RSS per stage to a Memory CSV next to the times" << endl;
       return 1;
     }
 
     // Get directory path
-    string dirPath = argv[1];
+    string dirPath = opts.positional[0];
+    try
+    {
+      ThreadPool::setThreads(opts.getPositiveInt("threads", thread::hardware_concurrency()));
+    }
+    catch (const exception &e)
+    {
+      cerr << "Error: " << e.what() << endl;
+      return 1;
+    }
+    useWordIds = opts.has("word-ids");
+    npyOutput = opts.has("npy");
+    string tracePath = opts.get("trace");
+    if (!tracePath.empty())
+      Profiler::instance().traceTo(tracePath);
+    if (opts.has("perf-counters"))
+      PerfCounters::instance().start();
+    if (opts.has("memory"))
+      MemoryReport::instance().enable();
+    hashSeed = opts.has("seed") ? stoull(opts.get("seed"))
+                                : static_cast<unsigned>(chrono::system_clock::now().time_since_epoch().count());
+    string signaturesIn = opts.get("signatures");
+    string signaturesOut = opts.get("save-signatures");
+    if (opts.has("stopwords"))
+    {
+      stopwords = StopwordFilter(loadStopwords(opts.get("stopwords")));
+    }
 
     // Get k value from command line
-    k = stoi(argv[2]);
+    k = stoi(opts.positional[1]);
     if (k <= 0)
     {
       cerr << "Error: k must be positive" << endl;
@@ -475,7 +684,7 @@ int main(int argc, char *argv[])
     }
 
     // Get numHashFunctions (t) value from command line
-    numHashFunctions = stoi(argv[3]);
+    numHashFunctions = stoi(opts.positional[2]);
     if (numHashFunctions <= 0)
     {
       cerr << "Error: t (number of hash functions) must be positive" << endl;
@@ -483,7 +692,7 @@ int main(int argc, char *argv[])
     }
 
     // Get b value from command line
-    int b = stoi(argv[4]);
+    int b = stoi(opts.positional[3]);
     if (b <= 0)
     {
       cerr << "Error: b must be positive" << endl;
@@ -496,76 +705,207 @@ int main(int argc, char *argv[])
       return 1;
     }
 
-    // Initialize hash functions
+    SweepPlan sweep;
+    try
     {
-      Timer timerInit("index build");
-      initializeHashFunctions();
+      sweep = parseSweep(opts, numHashFunctions, b, 0.0f);
     }
-
-    // Vector to store all file paths
-    vector<string> filePaths;
-
-    // Check if directory exists
-    if (!fs::exists(dirPath) || !fs::is_directory(dirPath))
+    catch (const exception &e)
+    {
+      cerr << "Error: Invalid sweep list: " << e.what() << endl;
+      return 1;
+    }
+    if (sweep.active)
+      numHashFunctions = sweep.maxT(); // Sign once for the largest t
+    if (!sweep.ks.empty() && (!signaturesIn.empty() || !signaturesOut.empty()))
     {
-      cerr << "Error: Directory not found or is not a directory: " << dirPath << endl;
+      cerr << "Error: --sweep-k cannot be combined with --signatures or --save-signatures" << endl;
       return 1;
     }
 
-    // Collect all text files from the directory
-    // cout << "Collecting files from directory: " << dirPath << endl;
-    for (const auto &entry : fs::directory_iterator(dirPath))
+    // Band hashing uses the coefficients, so a store brings its own seed
+    if (!signaturesIn.empty())
     {
-      if (entry.is_regular_file())
+      try
       {
-        string extension = entry.path().extension().string();
-        if (extension == ".txt" || extension == ".doc" || extension == ".md")
-        {
-          filePaths.push_back(entry.path().string());
-        }
+        hashSeed = storeSeed(signaturesIn, opts.has("seed"), hashSeed);
+      }
+      catch (const exception &e)
+      {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
       }
     }
 
-    if (filePaths.empty())
+    // Initialize hash functions
     {
-      cerr << "Error: No valid text files found in directory." << endl;
-      return 1;
+      Timer timerInit("index build");
+      initializeHashFunctions();
     }
 
-    // cout << "Found " << filePaths.size() << " files to compare." << endl;
+    // Vector to store all file paths
+    vector<string> filePaths;
 
-    // Map to store file contents and their signatures
-    map<string, pair<string, vector<int>>> fileContents;
+    // Signature of every file; the file contents are dropped once it is
+    // computed
+    map<string, vector<int>> fileSignatures;
+    vector<map<string, vector<int>>> fileSignaturesPerK; // --sweep-k
 
-    // Read all files and compute signatures
+    if (!signaturesIn.empty())
     {
       Timer timerProcessFiles("index build");
-      for (const auto &filePath : filePaths)
+      try
+      {
+        SignatureStore store(signaturesIn);
+        checkSignatureStore(signaturesIn, store.info(), k, numHashFunctions, hashFamily(), hashSeed);
+        // The first t columns of a wider store are the signature for t
+        for (size_t i = 0; i < store.size(); i++)
+        {
+          string name(store.name(i));
+          filePaths.push_back(name);
+          fileSignatures[name] = vector<int>(store.row(i), store.row(i) + numHashFunctions);
+        }
+      }
+      catch (const exception &e)
+      {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+      }
+    }
+    else
+    {
+      // Check if directory exists
+      if (!fs::exists(dirPath) || !fs::is_directory(dirPath))
       {
-        // cout << "Processing file: " << filePath << endl;
+        cerr << "Error: Directory not found or is not a directory: " << dirPath << endl;
+        return 1;
+      }
 
-        string content = readFile(filePath);
-        if (content.empty())
+      // Collect all text files from the directory
+      // cout << "Collecting files from directory: " << dirPath << endl;
+      for (const auto &entry : fs::directory_iterator(dirPath))
+      {
+        if (entry.is_regular_file())
         {
-          cerr << "Warning: File is empty or could not be read: " << filePath << endl;
-          continue;
+          string extension = entry.path().extension().string();
+          if (extension == ".txt" || extension == ".doc" || extension == ".md")
+          {
+            filePaths.push_back(entry.path().string());
+          }
         }
+      }
 
-        unordered_set<string> kShingles;
-        size_t estimatedSize = max(1UL, (unsigned long)content.length() / 10);
-        kShingles.reserve(estimatedSize);
+      if (filePaths.empty())
+      {
+        cerr << "Error: No valid text files found in directory." << endl;
+        return 1;
+      }
+
+      // cout << "Found " << filePaths.size() << " files to compare." << endl;
+
+      // Read all files and compute signatures
+      if (!sweep.ks.empty())
+      {
+        Timer timerProcessFiles("index build");
+        fileSignaturesPerK = signFilesMultiK(filePaths, sweep.ks);
+      }
+      else
+      {
+        Timer timerProcessFiles("index build");
+        // Files are shingled and signed in parallel; one slot per file
+        vector<optional<vector<int>>> slots(filePaths.size());
+        ThreadPool::instance().parallelFor(0, filePaths.size(), [&](size_t f)
+        {
+          const string &filePath = filePaths[f];
+          // cout << "Processing file: " << filePath << endl;
+
+          string content = readFile(filePath);
+          if (content.empty())
+          {
+            cerr << "Warning: File is empty or could not be read: " << filePath << endl;
+            return;
+          }
+
+          unordered_set<uint64_t> kShingles;
+          size_t estimatedSize = max(1UL, (unsigned long)content.length() / 10);
+          kShingles.reserve(estimatedSize);
 
-        tratar(content, kShingles);
+          tratar(content, kShingles);
 
-        if (kShingles.empty())
+          if (kShingles.empty())
+          {
+            cerr << "Warning: No k-shingles could be extracted from: " << filePath << endl;
+            return;
+          }
+
+          slots[f] = computeMinHashSignature(kShingles);
+        });
+
+        for (size_t f = 0; f < filePaths.size(); f++)
         {
-          cerr << "Warning: No k-shingles could be extracted from: " << filePath << endl;
-          continue;
+          if (slots[f])
+            fileSignatures[filePaths[f]] = move(*slots[f]);
         }
+      }
+    }
+
+    if (!signaturesOut.empty())
+    {
+      // Only files that produced a signature, in directory order
+      vector<string> signedPaths;
+      for (const string &filePath : filePaths)
+      {
+        if (fileSignatures.count(filePath))
+          signedPaths.push_back(filePath);
+      }
+      SignatureStoreInfo info;
+      info.k = k;
+      info.t = numHashFunctions;
+      info.seed = hashSeed;
+      info.hashFamily = hashFamily();
+      try
+      {
+        writeSignatureStore(signaturesOut, info, signedPaths.size(),
+            [&](size_t i) -> const string & { return signedPaths[i]; },
+            [&](size_t i) -> const vector<int> & { return fileSignatures.at(signedPaths[i]); });
+      }
+      catch (const exception &e)
+      {
+        cerr << "Warning: Could not save signatures: " << e.what() << endl;
+      }
+    }
+
+    // --memory: the signatures, and the map holding them with the file names
+    if (MemoryReport::instance().isEnabled())
+    {
+      size_t files = 0, total = 0, signatures = 0;
+      auto measure = [&](const map<string, vector<int>> &byFile)
+      {
+        files += byFile.size();
+        total += heapBytes(byFile);
+        for (const auto &entry : byFile)
+          signatures += heapBytes(entry.second);
+      };
+      measure(fileSignatures);
+      for (const auto &perK : fileSignaturesPerK)
+        measure(perK);
+      MemoryReport::instance().structure("fileSignatures", files, total - signatures);
+      MemoryReport::instance().structure("signatures", files, signatures);
+    }
 
-        vector<int> signature = computeMinHashSignature(kShingles);
-        fileContents[filePath] = make_pair(content, signature);
+    if (!sweep.ks.empty())
+    {
+      for (size_t i = 0; i < sweep.ks.size(); i++)
+      {
+        k = sweep.ks[i];
+        runSweep(filePaths, fileSignaturesPerK[i], sweep, determineCategory(dirPath));
       }
+      return 0;
+    }
+    if (sweep.active)
+    {
+      runSweep(filePaths, fileSignatures, sweep, determineCategory(dirPath));
+      return 0;
     }
 
     // Store results
@@ -579,34 +919,13 @@ int main(int argc, char *argv[])
 
     {
       Timer timerInit("query time");
-      for (size_t i = 0; i < filePaths.size(); i++)
+      results = compareSignatures(filePaths, fileSignatures, b);
+      for (const SimilarityResult &result : results)
       {
-        for (size_t j = i + 1; j < filePaths.size(); j++)
+        totalComparisons++;
+        if (result.isSimilar)
         {
-          string file1 = filePaths[i];
-          string file2 = filePaths[j];
-
-          // Skip if either file couldn't be processed
-          if (fileContents.find(file1) == fileContents.end() ||
-              fileContents.find(file2) == fileContents.end())
-          {
-            continue;
-          }
-
-          totalComparisons++;
-
-          vector<int> &signature1 = fileContents[file1].second;
-          vector<int> &signature2 = fileContents[file2].second;
-
-          float similarity = SimilaridadDeJaccard(signature1, signature2);
-          bool isSimilar = LSH(signature1, signature2, b);
-
-          if (isSimilar)
-          {
-            similarFiles++;
-          }
-
-          results.push_back({file1, file2, similarity, isSimilar});
+          similarFiles++;
         }
       }
     }
@@ -614,22 +933,10 @@ int main(int argc, char *argv[])
      category = determineCategory(dirPath);
 
   // Generate filenames for results
-  stringstream ss;
-  ss << "results/" << category << "/LSHbase/LSHbaseSimilarities_k" << k
-    << "_t" << numHashFunctions
-     << "_b" << b
-     << ".csv";
-
-     filename1 = ss.str();
+  filename1 = resultPath(category, "Similarities", b);
 
   // Generate filename for time results
-  stringstream ss2;
-  ss2 << "results/" << category << "/LSHbase/LSHbaseTimes_k" << k
-    << "_t" << numHashFunctions
-      << "_b" << b
-      << ".csv";
-
-     filename2 = ss2.str();
+  filename2 = resultPath(category, "Times", b);
 
   }
 
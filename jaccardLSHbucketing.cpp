@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <chrono>
 #include <climits>
@@ -8,15 +9,39 @@
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <numeric>
+#include <optional>
 #include <queue>
 #include <random>
 #include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+#include "common/bandTuner.hpp"
+#include "common/clustering.hpp"
+#include "common/corpusIndex.hpp"
+#include "common/csrGraph.hpp"
+#include "common/dictionary.hpp"
+#include "common/npyWriter.hpp"
+#include "common/options.hpp"
+#include "common/resultWriter.hpp"
+#include "common/pipeline.hpp"
+#include "common/memoryReport.hpp"
+#include "common/perfCounters.hpp"
+#include "common/profiler.hpp"
+#include "common/server.hpp"
+#include "common/setIntersection.hpp"
+#include "common/shingler.hpp"
+#include "common/signatureCompare.hpp"
+#include "common/signatureStore.hpp"
+#include "common/sweep.hpp"
+#include "common/stopwords.hpp"
+#include "common/threadPool.hpp"
+#include "common/tokenizer.hpp"
 #include "deps/nlohmann/json.hpp"
 #include "deps/xxhash/xxhash.h"
 
@@ -30,17 +55,28 @@ float SIMILARITY_THRESHOLD;
 vector<pair<int, int>>
     hashCoefficients;             // [a, b] for funcionhash(x) = (ax + b) % p
 int p;                            // Prime number for hash functions
-unordered_set<string> stopwords;  // Stopwords
+uint64_t hashSeed;                // Seed of the coefficients (--seed)
+StopwordFilter stopwords;         // Stopwords
+bool useWordIds = false;          // Shingles from word ids (--word-ids)
+int probesPerBand = 0;            // Extra buckets probed per band (--probes)
+bool clusterOutput = false;       // Also write the clusters (--clusters)
+bool csrOutput = false;           // Also write the similarity graph (--csr)
+bool exactVerify = false;         // Verify candidates on the shingles (--exact)
+double rejectConfidence = 0;      // Sequential rejection test (--reject-confidence)
+bool npyOutput = false;           // Pairs as .npy columns (--npy)
+WordDictionary dictionary;        // Word -> id, shared by all documents
 vector<pair<int, int>> similarPairs;  // Similar pairs of documents
 vector<vector<float>> Data;
-map<string, int> timeResults;  // Map to store execution times
+map<string, double> timeResults;  // Map to store execution times
 
 // Document structure to store document information
 struct Document {
   string filename;
-  unordered_set<string> kShingles;
+  vector<uint64_t> shingles;  // Sorted shingle keys, kept with --exact
   vector<int> signature;
+  vector<int> runnerUp;  // Second smallest hash of every row (--probes)
 
+  Document() = default;
   Document(const string &name) : filename(name) {}
 };
 
@@ -60,29 +96,21 @@ vector<BandBuckets> bandBucketMap;
 class Timer
 {
 private:
-  chrono::high_resolution_clock::time_point startTime;
+  ProfileScope scope;  // Also the scope of the trace (common/profiler.hpp)
+  StageCounters counters;  // --perf-counters (common/perfCounters.hpp)
+  StageMemory memory;  // --memory (common/memoryReport.hpp)
   string operationName;
 
 public:
-  Timer(const string &name) : operationName(name)
-  {
-    startTime = chrono::high_resolution_clock::now();
-  }
+  Timer(const string &name)
+    : scope(Profiler::instance().intern(name)),
+      counters(Profiler::instance().intern(name)),
+      memory(Profiler::instance().intern(name)),
+      operationName(name) {}
 
   ~Timer()
   {
-    auto endTime = chrono::high_resolution_clock::now();
-    auto duration =
-        chrono::duration_cast<chrono::milliseconds>(endTime - startTime)
-            .count();
-    if (timeResults.count(operationName) == 0)
-    {
-      timeResults[operationName] = duration;
-    }
-    else
-    {
-      timeResults[operationName] += duration;
-    }
+    timeResults[operationName] += scope.elapsedMs();
   }
 };
 
@@ -91,7 +119,7 @@ public:
 // --------------------------------------------------------------------------
 // Check if a word is a stopword
 bool is_stopword(const string &word) {
-  return stopwords.find(word) != stopwords.end();
+  return stopwords.contains(word);
 }
 
 // load stopwords from a file into stopword set
@@ -125,18 +153,6 @@ unordered_set<string> loadStopwords(const string &filename) {
 // Treating Format
 //---------------------------------------------------------------------------
 
-// Quita signos de puntuacion y mayusculas
-string normalize(const string &word) {
-  string result;
-  result.reserve(word.length());
-  for (char c : word) {
-    if (isalpha(c)) {
-      result += tolower(c);
-    }
-  }
-  return result;
-}
-
 // Read content from file
 string readFile(const string &filename) {
   ifstream file(filename);
@@ -199,9 +215,8 @@ void initializeHashFunctions() {
   // avoid overflow
   p = nextPrime(INT_MAX / 4);
 
-  // Use a time-based seed for better randomness
-  unsigned seed = chrono::system_clock::now().time_since_epoch().count();
-  mt19937 gen(seed);  // Using Mersenne Twister
+  // Seeded from --seed (the clock by default) so runs can be reproduced
+  mt19937 gen(hashSeed);  // Using Mersenne Twister
   uniform_int_distribution<int> dis(1, p - 1);
 
   hashCoefficients.clear();  // Clear existing coefficients
@@ -216,58 +231,83 @@ void initializeHashFunctions() {
   }
 }
 
+// How shingles are hashed and signed, recorded in signature stores
+string hashFamily() {
+  return string(useWordIds ? "word-ids" : "xxh64-words") + "/mt19937/p" +
+         to_string(p);
+}
+
 //---------------------------------------------------------------------------
 // Jaccard Locality-Sensitive Hashing Algorithm
 //---------------------------------------------------------------------------
 
-// Function to process text and extract k-shingles
-void tratar(const string &texto, unordered_set<string> &kShingles) {
-  queue<string> palabras;  // cola para tener las k palabras consecutivas
-  string word;
-  stringstream ss(texto);
-
-  while (ss >> word) {  // leer palabra del stringstream
-    // quitar singnos de puntuacion y mayusculas
-    word = normalize(word);
-    if (!word.empty() &&
-        !is_stopword(word)) {  // Skip empty words and stopwords
-      palabras.push(word);
-      if (palabras.size() ==
-          k) {  // si ya tenemos k palabras en la cola tenemos un k shingle!
-        // Optimización: construir el shingle directamente con un string
-        // estimado
-        string shingle;
-        shingle.reserve(k * 10);  // Reservar espacio aproximado
-
-        queue<string> temp = palabras;
-        for (size_t i = 0; i < k; i++) {
-          shingle += temp.front();
-          temp.pop();
-          if (i < k - 1) shingle += " ";
-        }
+// Function to process text and extract k-shingles, stored as 64-bit keys.
+// Words are keyed by their dictionary id with --word-ids, by their xxHash
+// otherwise, and a shingle by mixing the keys of its k words
+// (common/shingler.hpp): the keys tratarMultiK gives for the same k, so a
+// --sweep-k run finds the same shingles as one run per k.
+void tratar(const string &texto, unordered_set<uint64_t> &kShingles) {
+  vector<uint64_t> words;
+  forEachWord(texto, [&](const string &word) {
+    if (word.empty() || is_stopword(word)) return;
+    words.push_back(useWordIds ? dictionary.intern(word) : xxHashFunction(word));
+  });
+  forEachShingle(words, k, [&](uint64_t key) { kShingles.insert(key); });
+}
 
-        kShingles.insert(shingle);
-        // Quitamos la primera para avanzar (sliding window approach)
-        palabras.pop();
-      }
-    }
-  }
+// Shingles for every k of the shingler in one pass over the words (--sweep-k).
+// Words are keyed by their dictionary id with --word-ids, by their xxHash
+// otherwise; kShingles[i] gets the shingles for shingler.sizes()[i].
+void tratarMultiK(const string &texto, MultiShingler &shingler,
+                  vector<unordered_set<uint64_t>> &kShingles) {
+  shingler.reset();
+  forEachWord(texto, [&](const string &word) {
+    if (word.empty() || is_stopword(word)) return;
+    uint64_t wordHash =
+        useWordIds ? dictionary.intern(word) : xxHashFunction(word);
+    shingler.push(wordHash, [&](size_t i, uint64_t key) {
+      kShingles[i].insert(key);
+    });
+  });
 }
 
 // Improved function to compute MinHash signatures using xxHash
-vector<int> computeMinHashSignature(const unordered_set<string> &kShingles) {
+// If runnerUp is given it receives the second smallest hash of every row
+// (INT_MAX if there is none), which multi-probing uses
+vector<int> computeMinHashSignature(const unordered_set<uint64_t> &kShingles,
+                                    vector<int> *runnerUp = nullptr) {
   // Check if there are no shingles
   if (kShingles.empty()) {
     cerr << "Warning: Empty kShingles set. Creating default signature." << endl;
+    if (runnerUp) runnerUp->assign(t, INT_MAX);
     return vector<int>(t, INT_MAX);  // Return default signature
   }
 
   vector<int> signature(t, INT_MAX);
 
+  if (runnerUp) {
+    runnerUp->assign(t, INT_MAX);
+    for (uint64_t shingleID : kShingles) {
+      for (unsigned int i = 0; i < t && i < hashCoefficients.size(); i++) {
+        int64_t hashValue =
+            (static_cast<int64_t>(hashCoefficients[i].first) * shingleID +
+             hashCoefficients[i].second) %
+            p;
+        if (hashValue < 0) hashValue += p;
+        int value = static_cast<int>(hashValue);
+        if (value < signature[i]) {
+          (*runnerUp)[i] = signature[i];
+          signature[i] = value;
+        } else if (value < (*runnerUp)[i] && value != signature[i]) {
+          (*runnerUp)[i] = value;
+        }
+      }
+    }
+    return signature;
+  }
+
   // For each shingle in the set
-  for (const string &shingle : kShingles) {
-    // Use xxHash for better distribution and performance
-    uint64_t shingleID = xxHashFunction(shingle);
+  for (uint64_t shingleID : kShingles) {
 
     // Apply each hash function
     for (unsigned int i = 0; i < t && i < hashCoefficients.size(); i++) {
@@ -288,20 +328,15 @@ vector<int> computeMinHashSignature(const unordered_set<string> &kShingles) {
   return signature;
 }
 
-// Calculate exact Jaccard similarity between two sets of shingles
-float exactJaccardSimilarity(const unordered_set<string> &set1,
-                             const unordered_set<string> &set2) {
+// Calculate exact Jaccard similarity between two sorted sets of shingles
+float exactJaccardSimilarity(const vector<uint64_t> &set1,
+                             const vector<uint64_t> &set2) {
   // Check for empty sets
   if (set1.empty() && set2.empty()) return 1.0f;  // Both empty = 100% similar
   if (set1.empty() || set2.empty()) return 0.0f;  // One empty = 0% similar
 
-  // Count intersection size
-  size_t intersectionSize = 0;
-  for (const auto &shingle : set1) {
-    if (set2.find(shingle) != set2.end()) {
-      intersectionSize++;
-    }
-  }
+  // Count intersection size (merge of the sorted keys, SIMD when available)
+  size_t intersectionSize = sortedIntersectionSize(set1, set2);
 
   // Calculate union size: |A| + |B| - |A∩B|
   size_t unionSize = set1.size() + set2.size() - intersectionSize;
@@ -333,6 +368,24 @@ float estimatedJaccardSimilarity(const vector<int> &signature1,
   return static_cast<float>(matchingElements) / signature1.size();
 }
 
+// Similarity a candidate pair is judged by: exact on the shingles with
+// --exact, estimated from the signatures otherwise
+float pairSimilarity(const Document &doc1, const Document &doc2) {
+  if (exactVerify) return exactJaccardSimilarity(doc1.shingles, doc2.shingles);
+  return estimatedJaccardSimilarity(doc1.signature, doc2.signature);
+}
+
+// Whether a candidate pair reaches the threshold of comparator: exact on the
+// shingles with --exact, otherwise on the signatures, stopping the scan as
+// soon as the answer is known
+bool pairReaches(const Document &doc1, const Document &doc2,
+                 const ThresholdComparator &comparator, float threshold) {
+  if (exactVerify) {
+    return exactJaccardSimilarity(doc1.shingles, doc2.shingles) >= threshold;
+  }
+  return comparator.reaches(doc1.signature, doc2.signature);
+}
+
 // Create a hash for a band (sub-signature)
 size_t hashBand(const vector<int> &band) {
   size_t hashValue = 0;
@@ -351,6 +404,103 @@ void initializeLSHBuckets(int numBands) {
   //cout << "Initialized " << numBands << " LSH bands" << endl;
 }
 
+// Key of the bucket a signature falls in for band b; false when the band is
+// past the end of the signature (more bands than hash functions)
+bool bandKey(const vector<int> &signature, int numBands, int b,
+             size_t &key) {
+  // Calculate band size (rows per band)
+  int rowsPerBand = max(1, static_cast<int>(signature.size() / numBands));
+
+  // Extract the band (sub-signature)
+  vector<int> band;
+  int startIdx = b * rowsPerBand;
+  int endIdx = min((b + 1) * rowsPerBand, static_cast<int>(signature.size()));
+
+  // Check bounds
+  if (startIdx >= static_cast<int>(signature.size())) {
+    return false;  // Skip this band if out of bounds
+  }
+
+  band.assign(signature.begin() + startIdx, signature.begin() + endIdx);
+
+  // Hash the band
+  key = hashBand(band);
+  return true;
+}
+
+// Multi-probe LSH: besides its own bucket, a query looks into the buckets it
+// would have landed in had some of its least certain rows come out
+// differently. A row is uncertain when its minimum beat the runner-up hash by
+// a small margin, since a slightly different document would likely have the
+// runner-up there. Perturbations (sets of rows whose runner-up is swapped in)
+// are generated in increasing order of total margin with the shift/expand
+// heap of Lv et al.; the index itself is unchanged.
+vector<size_t> probeKeys(const vector<int> &signature,
+                         const vector<int> &runnerUp, int numBands, int b,
+                         int probes) {
+  vector<size_t> keys;
+  int rowsPerBand = max(1, static_cast<int>(signature.size() / numBands));
+  int startIdx = b * rowsPerBand;
+  int endIdx = min((b + 1) * rowsPerBand, static_cast<int>(signature.size()));
+  if (probes <= 0 || startIdx >= endIdx || runnerUp.size() != signature.size())
+    return keys;
+
+  // Rows that have a runner-up, most uncertain first
+  vector<pair<int64_t, int>> rows;
+  for (int i = startIdx; i < endIdx; i++) {
+    if (runnerUp[i] != INT_MAX) {
+      rows.push_back({int64_t(runnerUp[i]) - signature[i], i});
+    }
+  }
+  sort(rows.begin(), rows.end());
+  if (rows.empty()) return keys;
+
+  // A perturbation is a sorted list of positions in rows
+  typedef pair<int64_t, vector<int>> Perturbation;
+  auto worse = [](const Perturbation &a, const Perturbation &b) {
+    return a.first > b.first;
+  };
+  priority_queue<Perturbation, vector<Perturbation>, decltype(worse)> heap(
+      worse);
+  heap.push({rows[0].first, {0}});
+  vector<int> band(signature.begin() + startIdx, signature.begin() + endIdx);
+  while (!heap.empty() && static_cast<int>(keys.size()) < probes) {
+    Perturbation next = heap.top();
+    heap.pop();
+
+    vector<int> probe = band;
+    for (int position : next.second) {
+      int row = rows[position].second;
+      probe[row - startIdx] = runnerUp[row];
+    }
+    keys.push_back(hashBand(probe));
+
+    int last = next.second.back();
+    if (last + 1 < static_cast<int>(rows.size())) {
+      Perturbation shifted = next;
+      shifted.second.back() = last + 1;
+      shifted.first += rows[last + 1].first - rows[last].first;
+      heap.push(move(shifted));
+      Perturbation expanded = next;
+      expanded.second.push_back(last + 1);
+      expanded.first += rows[last + 1].first;
+      heap.push(move(expanded));
+    }
+  }
+  return keys;
+}
+
+// Add a document to the buckets of a single band. Bands are independent, so
+// each one can be filled by a different thread.
+void addToLSHBand(const vector<int> &signature, int docIndex, int numBands,
+                  int b) {
+  size_t bandHash;
+  if (!bandKey(signature, numBands, b, bandHash)) return;
+
+  // Add the document to the corresponding bucket
+  bandBucketMap[b][bandHash].docIndices.push_back(docIndex);
+}
+
 // Add a document to LSH buckets
 void addToLSHBuckets(const vector<int> &signature, int docIndex, int numBands) {
   // Check for empty signature or invalid inputs
@@ -369,29 +519,10 @@ void addToLSHBuckets(const vector<int> &signature, int docIndex, int numBands) {
     return;
   }
 
-  // Calculate band size (rows per band)
-  int rowsPerBand = max(1, static_cast<int>(signature.size() / numBands));
-
   // For each band
   for (int b = 0; b < numBands && b < static_cast<int>(bandBucketMap.size());
        b++) {
-    // Extract the band (sub-signature)
-    vector<int> band;
-    int startIdx = b * rowsPerBand;
-    int endIdx = min((b + 1) * rowsPerBand, static_cast<int>(signature.size()));
-
-    // Check bounds
-    if (startIdx >= static_cast<int>(signature.size())) {
-      continue;  // Skip this band if out of bounds
-    }
-
-    band.assign(signature.begin() + startIdx, signature.begin() + endIdx);
-
-    // Hash the band
-    size_t bandHash = hashBand(band);
-
-    // Add the document to the corresponding bucket
-    bandBucketMap[b][bandHash].docIndices.push_back(docIndex);
+    addToLSHBand(signature, docIndex, numBands, b);
   }
 }
 
@@ -431,79 +562,310 @@ vector<pair<int, int>> findSimilarDocumentPairs(
   //    << " non-empty buckets, "
   //     << "largest bucket has " << maxBucketSize << " documents" << endl;
 
-  // Set to store pairs of similar documents (to avoid duplicates)
-  set<pair<int, int>> similarPairsSet;
-
-  // For each band
-  for (int b = 0; b < numBands && b < static_cast<int>(bandBucketMap.size());
-       b++) {
-    // For each bucket in this band
-    for (const auto &bucketPair : bandBucketMap[b]) {
-      const Bucket &bucket = bucketPair.second;
-
-      // If bucket has at least 2 documents, they might be similar
-      if (bucket.docIndices.size() >= 2) {
-        // Check all pairs in the bucket
-        for (size_t i = 0; i < bucket.docIndices.size(); i++) {
-          for (size_t j = i + 1; j < bucket.docIndices.size(); j++) {
-            int doc1 = bucket.docIndices[i];
-            int doc2 = bucket.docIndices[j];
-
-            // Check for valid document indices
-            if (doc1 < 0 || doc2 < 0 ||
-                doc1 >= static_cast<int>(documents.size()) ||
-                doc2 >= static_cast<int>(documents.size())) {
-              continue;  // Skip invalid indices
-            }
+  ThreadPool &pool = ThreadPool::instance();
 
-            // Ensure doc1 < doc2 for consistent ordering
-            if (doc1 > doc2) {
-              swap(doc1, doc2);
+  vector<pair<int, int>> candidatePairs;
+  {
+    ProfileScope scope("candidates");
+    // Candidate pairs of every band, collected in parallel
+    vector<vector<pair<int, int>>> bandCandidates(numBands);
+    pool.parallelFor(0, numBands, [&](size_t b) {
+      // For each bucket in this band
+      for (const auto &bucketPair : bandBucketMap[b]) {
+        const Bucket &bucket = bucketPair.second;
+
+        // If bucket has at least 2 documents, they might be similar
+        if (bucket.docIndices.size() >= 2) {
+          // Check all pairs in the bucket
+          for (size_t i = 0; i < bucket.docIndices.size(); i++) {
+            for (size_t j = i + 1; j < bucket.docIndices.size(); j++) {
+              int doc1 = bucket.docIndices[i];
+              int doc2 = bucket.docIndices[j];
+
+              // Check for valid document indices
+              if (doc1 < 0 || doc2 < 0 ||
+                  doc1 >= static_cast<int>(documents.size()) ||
+                  doc2 >= static_cast<int>(documents.size())) {
+                continue;  // Skip invalid indices
+              }
+
+              // Ensure doc1 < doc2 for consistent ordering
+              if (doc1 > doc2) {
+                swap(doc1, doc2);
+              }
+
+              bandCandidates[b].push_back({doc1, doc2});
             }
-
-            similarPairsSet.insert({doc1, doc2});
           }
         }
       }
+    });
+
+    // Multi-probe: every document also looks into the buckets next to its own
+    vector<vector<pair<int, int>>> probeCandidates;
+    if (probesPerBand > 0) {
+      probeCandidates.resize(documents.size());
+      pool.parallelFor(0, documents.size(), [&](size_t i) {
+        const Document &doc = documents[i];
+        for (int b = 0; b < numBands; b++) {
+          for (size_t key : probeKeys(doc.signature, doc.runnerUp, numBands, b,
+                                      probesPerBand)) {
+            auto it = bandBucketMap[b].find(key);
+            if (it == bandBucketMap[b].end()) continue;
+            for (int other : it->second.docIndices) {
+              if (other == static_cast<int>(i)) continue;
+              probeCandidates[i].push_back(
+                  {min(other, static_cast<int>(i)), max(other, static_cast<int>(i))});
+            }
+          }
+        }
+      });
     }
-  }
 
-  // Convert set to vector
-  vector<pair<int, int>> candidatePairs(similarPairsSet.begin(),
-                                        similarPairsSet.end());
+    // Merge bands and drop pairs that collided in more than one band
+    for (auto &candidates : probeCandidates) {
+      candidatePairs.insert(candidatePairs.end(), candidates.begin(),
+                            candidates.end());
+      vector<pair<int, int>>().swap(candidates);
+    }
+    for (auto &candidates : bandCandidates) {
+      candidatePairs.insert(candidatePairs.end(), candidates.begin(),
+                            candidates.end());
+      vector<pair<int, int>>().swap(candidates);
+    }
+    sort(candidatePairs.begin(), candidatePairs.end());
+    candidatePairs.erase(unique(candidatePairs.begin(), candidatePairs.end()),
+                         candidatePairs.end());
+  }
   //cout << "Found " << candidatePairs.size() << " candidate pairs" << endl;
 
   // Filter pairs based on actual similarity
+  ProfileScope scope("verify");
+  ThresholdComparator comparator(documents.empty() ? 0 : documents[0].signature.size(),
+                                 threshold, rejectConfidence);
+  vector<char> keep(candidatePairs.size(), 0);
+  pool.parallelFor(
+      0, candidatePairs.size(),
+      [&](size_t c) {
+        const auto &pair = candidatePairs[c];
+        // Check that signatures are valid
+        if (documents[pair.first].signature.empty() ||
+            documents[pair.second].signature.empty()) {
+          cerr << "Warning: Empty signature(s) for document pair: "
+               << pair.first << ", " << pair.second << endl;
+          return;
+        }
+
+        keep[c] = pairReaches(documents[pair.first], documents[pair.second],
+                              comparator, threshold);
+      },
+      256);
+
   vector<pair<int, int>> filteredPairs;
-  for (const auto &pair : candidatePairs) {
-    // Additional index checks
-    if (pair.first >= static_cast<int>(documents.size()) ||
-        pair.second >= static_cast<int>(documents.size()) || pair.first < 0 ||
-        pair.second < 0) {
-      cerr << "Error: Invalid document indices in pair: " << pair.first << ", "
-           << pair.second << endl;
-      continue;
-    }
+  for (size_t c = 0; c < candidatePairs.size(); c++) {
+    if (keep[c]) filteredPairs.push_back(candidatePairs[c]);
+  }
 
-    // Check that signatures are valid
-    if (documents[pair.first].signature.empty() ||
-        documents[pair.second].signature.empty()) {
-      cerr << "Warning: Empty signature(s) for document pair: " << pair.first
-           << ", " << pair.second << endl;
-      continue;
+  return filteredPairs;
+}
+
+// Documents whose similarity with query reaches threshold, as (position in
+// documents, similarity), most similar first. Probes the buckets built for
+// documents; neither is modified, so queries can run in parallel.
+// With runner-up hashes in the query, --probes neighbouring buckets are
+// looked into as well.
+vector<pair<int, float>> queryBuckets(const vector<Document> &documents,
+                                      const Document &query, int numBands,
+                                      float threshold) {
+  const vector<int> &signature = query.signature;
+  const vector<int> &runnerUp = query.runnerUp;
+  vector<int> candidates;
+  for (int band = 0; band < numBands; band++) {
+    vector<size_t> keys =
+        probeKeys(signature, runnerUp, numBands, band, probesPerBand);
+    size_t key;
+    if (bandKey(signature, numBands, band, key)) keys.push_back(key);
+    for (size_t probe : keys) {
+      auto it = bandBucketMap[band].find(probe);
+      if (it == bandBucketMap[band].end()) continue;
+      candidates.insert(candidates.end(), it->second.docIndices.begin(),
+                        it->second.docIndices.end());
     }
+  }
+  sort(candidates.begin(), candidates.end());
+  candidates.erase(unique(candidates.begin(), candidates.end()),
+                   candidates.end());
+
+  ThresholdComparator comparator(signature.size(), threshold, rejectConfidence);
+  vector<pair<int, float>> matches;
+  for (int doc : candidates) {
+    if (!pairReaches(query, documents[doc], comparator, threshold)) continue;
+    matches.push_back({doc, pairSimilarity(query, documents[doc])});
+  }
+  stable_sort(matches.begin(), matches.end(),
+              [](const pair<int, float> &a, const pair<int, float> &b) {
+                return a.second > b.second;
+              });
+  return matches;
+}
 
-    float similarity = estimatedJaccardSimilarity(
-        documents[pair.first].signature, documents[pair.second].signature);
+//---------------------------------------------------------------------------
+// Index build pipeline: read -> tokenize -> sign
+//---------------------------------------------------------------------------
+// Each stage runs on its own threads and hands documents to the next one
+// through a bounded queue, so disk reads overlap with shingling and hashing.
+// A document's shingles only live from the tokenizer to the signer (kept
+// with --exact), so the memory they take is bounded by the queue, not by
+// the corpus.
+struct RawDocument {
+  size_t slot = 0;  // position of the file in the corpus listing
+  string filename;
+  string content;
+};
+
+struct PendingDocument {
+  size_t slot = 0;
+  string filename;
+  vector<unordered_set<uint64_t>> kShingles;  // One set per shingle size
+};
+
+// Element i of the result holds the documents shingled with ks[i]; every k
+// comes from the same pass over the words. An empty ks means the global k.
+vector<vector<Document>> buildDocumentSets(const vector<string> &paths,
+                                           const PipelineConfig &config,
+                                           const vector<int> &ks) {
+  const size_t sets = ks.empty() ? 1 : ks.size();
+  const vector<unsigned> sizes(ks.begin(), ks.end());
+  BoundedQueue<RawDocument> readQueue(config.queueCapacity);
+  BoundedQueue<PendingDocument> shingleQueue(config.queueCapacity);
+  // One slot per input file keeps the document order independent of the
+  // thread interleaving
+  vector<vector<optional<Document>>> slots(
+      sets, vector<optional<Document>>(paths.size()));
+  atomic<size_t> nextPath(0);
+  vector<thread> workers;
+
+  // Stage 1: read files
+  launchStage(
+      workers, config.ioThreads, "read",
+      [&]() {
+        for (size_t i = nextPath++; i < paths.size(); i = nextPath++) {
+          RawDocument raw;
+          raw.slot = i;
+          raw.filename = paths[i];
+          raw.content = readFile(paths[i]);
+          if (raw.content.empty()) {
+            cerr << "Warning: File " << paths[i]
+                 << " is empty or could not be read. Skipping." << endl;
+            continue;
+          }
+          readQueue.push(move(raw));
+        }
+      },
+      [&]() { readQueue.close(); });
+
+  // Stage 2: extract shingles
+  launchStage(
+      workers, config.tokenizeThreads, "shingle",
+      [&]() {
+        RawDocument raw;
+        MultiShingler shingler(sizes);
+        while (readQueue.pop(raw)) {
+          PendingDocument pending;
+          pending.slot = raw.slot;
+          pending.filename = move(raw.filename);
+          pending.kShingles.resize(sets);
+          if (ks.empty()) {
+            tratar(raw.content, pending.kShingles[0]);
+          } else {
+            tratarMultiK(raw.content, shingler, pending.kShingles);
+          }
+          bool any = false;
+          for (size_t i = 0; i < sets; i++) {
+            if (!pending.kShingles[i].empty()) {
+              any = true;
+            } else if (!ks.empty()) {
+              cerr << "Warning: No valid shingles extracted from "
+                   << pending.filename << " with k=" << ks[i]
+                   << ". Skipping." << endl;
+            }
+          }
+          if (!any) {
+            if (ks.empty()) {
+              cerr << "Warning: No valid shingles extracted from "
+                   << pending.filename << ". Skipping." << endl;
+            }
+            continue;
+          }
+          shingleQueue.push(move(pending));
+        }
+      },
+      [&]() { shingleQueue.close(); });
+
+  // Stage 3: compute MinHash signatures
+  launchStage(
+      workers, config.signThreads, "sign",
+      [&]() {
+        PendingDocument pending;
+        while (shingleQueue.pop(pending)) {
+          for (size_t i = 0; i < sets; i++) {
+            if (pending.kShingles[i].empty()) continue;
+            Document doc(pending.filename);
+            doc.signature = computeMinHashSignature(
+                pending.kShingles[i],
+                probesPerBand > 0 ? &doc.runnerUp : nullptr);
+            if (exactVerify) doc.shingles = sortedKeys(pending.kShingles[i]);
+            slots[i][pending.slot] = move(doc);
+          }
+        }
+      },
+      []() {});
 
-    if (similarity >= threshold) {
-      filteredPairs.push_back(pair);
+  for (thread &worker : workers) {
+    worker.join();
+  }
+
+  vector<vector<Document>> documents(sets);
+  for (size_t i = 0; i < sets; i++) {
+    documents[i].reserve(paths.size());
+    for (optional<Document> &slot : slots[i]) {
+      if (slot) documents[i].push_back(move(*slot));
     }
   }
+  return documents;
+}
 
-  return filteredPairs;
+vector<Document> buildDocuments(const vector<string> &paths,
+                                const PipelineConfig &config) {
+  return move(buildDocumentSets(paths, config, {})[0]);
+}
+
+// Saves the signatures so later runs can skip reading and signing the corpus
+void saveSignatures(const string &path, const vector<Document> &documents) {
+  SignatureStoreInfo info;
+  info.k = k;
+  info.t = t;
+  info.seed = hashSeed;
+  info.hashFamily = hashFamily();
+  writeSignatureStore(
+      path, info, documents.size(),
+      [&](size_t i) -> const string & { return documents[i].filename; },
+      [&](size_t i) -> const vector<int> & { return documents[i].signature; });
 }
 
+// Documents from a signature store instead of the corpus. The store must
+// have the same k, at least t hash functions (the first t are used), the
+// same hash family and the same seed (checkSignatureStore).
+vector<Document> loadSignatures(const string &path) {
+  SignatureStore store(path);
+  checkSignatureStore(path, store.info(), k, t, hashFamily(), hashSeed);
+  vector<Document> documents(store.size());
+  for (size_t i = 0; i < store.size(); i++) {
+    documents[i].filename = string(store.name(i));
+    documents[i].signature.assign(store.row(i), store.row(i) + t);
+  }
+  return documents;
+}
 
 int extractNumber(const std::string& filename) {
     // Find the last underscore
@@ -529,6 +891,60 @@ int extractNumber(const std::string& filename) {
     }
 }
 
+// Operation,Time(ms) rows from timeResults
+void writeTimesToCSV(const string &filename) {
+  string timeFilename = filename;
+  if (timeFilename.substr(timeFilename.length() - 4) != ".csv") {
+    timeFilename += ".csv";
+  }
+
+  ofstream fileTime(timeFilename);
+  if (!fileTime.is_open()) {
+    cerr << "Error: Unable to open file " << timeFilename << " for writing"
+         << endl;
+    return;
+  }
+
+  // Write header
+  fileTime << "Operation,Time(ms)" << endl;
+  fileTime << fixed << setprecision(3);  // Milliseconds to the microsecond
+  for (const auto &pair : timeResults) {
+    fileTime << pair.first << "," << pair.second << endl;
+  }
+  if (!PerfCounters::instance().writeCSV(timeFilename)) {
+    cerr << "Error: Unable to write the counters next to " << timeFilename
+         << endl;
+  }
+  if (!MemoryReport::instance().writeCSV(timeFilename)) {
+    cerr << "Error: Unable to write the memory report next to " << timeFilename
+         << endl;
+  }
+}
+
+// --npy counterpart of the pair CSV: the same rows as uint32/float32
+// columns (common/npyWriter.hpp)
+void writeResultsToNpy(const string &csvFilename, const string &filename2,
+                       const vector<pair<int, int>> &similarPairs,
+                       const vector<Document> &documents) {
+  PairNpyWriter columns(npyBase(csvFilename));
+  if (!columns.isOpen()) {
+    cerr << "Error: Unable to open the .npy files of " << csvFilename
+         << " for writing" << endl;
+    return;
+  }
+  for (const auto &pair : similarPairs) {
+    columns.add(extractNumber(documents[pair.first].filename),
+                extractNumber(documents[pair.second].filename),
+                pairSimilarity(documents[pair.first], documents[pair.second]));
+  }
+  if (!columns.close()) {
+    cerr << "Error: Could not write the .npy files of " << csvFilename << endl;
+  }
+  writeTimesToCSV(filename2);
+  cout << "Results written to " << npyBase(csvFilename)
+       << ".{doc1,doc2,sim}.npy" << endl;
+}
+
 void writeResultsToCSV(const string &filename1,
   const string &filename2,
   const vector<pair<int, int>> &similarPairs,
@@ -541,17 +957,24 @@ if (csvFilename.substr(csvFilename.length() - 4) != ".csv")
 csvFilename += ".csv";
 }
 
-ofstream file(csvFilename);
-if (!file.is_open())
+if (npyOutput)
+{
+writeResultsToNpy(csvFilename, filename2, similarPairs, documents);
+return;
+}
+
+ResultWriter file(csvFilename);
+if (!file.isOpen())
 {
 cerr << "Error: Unable to open file " << csvFilename << " for writing" << endl;
 return;
 }
 
 // Write header
-file << "Doc1,Doc2,Sim%" << endl;
+file.append("Doc1,Doc2,Sim%\n");
 
 // Write data rows
+string row;
 for (const auto &pair : similarPairs)
 {
 // Extract document IDs from filenames
@@ -581,44 +1004,95 @@ else
 id2 = doc2;
 }
 
-// Calculate similarities
-float estSimilarity = estimatedJaccardSimilarity(
-documents[pair.first].signature,
-documents[pair.second].signature);
+// Calculate similarities (exact with --exact)
+float similarity = pairSimilarity(documents[pair.first], documents[pair.second]);
 
 // Write to CSV with fixed precision
-file << id1 << ","
-<< id2 << ","
-<< fixed << setprecision(6) << estSimilarity
-<< endl;
+row.clear();
+row += id1;
+row += ',';
+row += id2;
+row += ',';
+appendFixed(row, similarity);
+row += '\n';
+file.append(row);
 }
 
-file.close();
-
-// open new file to store the time results
-string timeFilename = filename2;
-if (timeFilename.substr(timeFilename.length() - 4) != ".csv")
+if (!file.close())
 {
-timeFilename += ".csv";
+cerr << "Error: Could not write " << csvFilename << endl;
 }
 
-ofstream fileTime(timeFilename);
-if (!fileTime.is_open())
-{
-cerr << "Error: Unable to open file TimeResults.csv for writing" << endl;
-return;
+writeTimesToCSV(filename2);
+cout << "Results written to " << csvFilename << endl;
 }
 
-// Write header
-fileTime << "Operation,Time(ms)" << endl;
+// Names and numbers of the documents, for the clusters and the graph
+// (common/clustering.hpp)
+DocumentIds documentIds(const vector<Document> &documents) {
+  DocumentIds ids;
+  ids.names.reserve(documents.size());
+  ids.numbers.reserve(documents.size());
+  for (const Document &doc : documents) {
+    ids.names.push_back(doc.filename);
+    ids.numbers.push_back(extractNumber(doc.filename));
+  }
+  return ids;
+}
 
-for (const auto &pair : timeResults)
-{
-fileTime << pair.first << "," << pair.second << endl;
+// The similar pairs as a sparse CSR matrix (common/csrGraph.hpp, --csr)
+// weighted with the similarities the CSV reports
+CsrGraph similarityGraph(const vector<Document> &documents,
+                         const vector<pair<int, int>> &pairs) {
+  DocumentIds ids = documentIds(documents);
+  return similarityGraph(documentRanks(ids), ids.numbers, pairs, [&](size_t p) {
+    return pairSimilarity(documents[pairs[p].first], documents[pairs[p].second]);
+  });
 }
 
-fileTime.close();
-cout << "Results written to " << csvFilename << endl;
+//---------------------------------------------------------------------------
+// Memory accounting (--memory)
+//---------------------------------------------------------------------------
+// The estimated heap bytes of the main structures once a query has run
+// (common/memoryReport.hpp): the documents, split by field, the band
+// buckets, the pairs and, when they are written, the clusters and the graph.
+size_t heapBytes(const Bucket &bucket) { return heapBytes(bucket.docIndices); }
+
+void measureStructures(const vector<Document> &documents,
+                       const vector<pair<int, int>> &pairs,
+                       const Clustering &clustering, const CsrGraph &graph) {
+  MemoryReport &memory = MemoryReport::instance();
+  if (!memory.isEnabled()) return;
+  size_t names = 0, shingles = 0, shingleCount = 0, signatures = 0,
+         runnerUps = 0;
+  for (const Document &doc : documents) {
+    names += heapBytes(doc.filename);
+    shingles += heapBytes(doc.shingles);
+    shingleCount += doc.shingles.size();
+    signatures += heapBytes(doc.signature);
+    runnerUps += heapBytes(doc.runnerUp);
+  }
+  memory.structure("documents", documents.size(),
+                   allocationBytes(documents.capacity() * sizeof(Document)));
+  memory.structure("documents.filename", documents.size(), names);
+  memory.structure("documents.shingles", shingleCount, shingles);
+  memory.structure("documents.signature", documents.size(), signatures);
+  memory.structure("documents.runnerUp", documents.size(), runnerUps);
+
+  size_t buckets = 0;
+  for (const BandBuckets &band : bandBucketMap) buckets += band.size();
+  memory.structure("bandBucketMap", buckets, heapBytes(bandBucketMap));
+  memory.structure("similarPairs", pairs.size(), heapBytes(pairs));
+  if (clusterOutput) {
+    memory.structure("clusters", clustering.cluster.size(),
+                     heapBytes(clustering.cluster) +
+                         heapBytes(clustering.representative));
+  }
+  if (csrOutput) {
+    memory.structure("graph", graph.column.size(),
+                     heapBytes(graph.rowPointer) + heapBytes(graph.column) +
+                         heapBytes(graph.value) + heapBytes(graph.rowDocument));
+  }
 }
 
 std::string determineCategory(const std::string &inputDirectory)
@@ -634,6 +1108,579 @@ std::string determineCategory(const std::string &inputDirectory)
 	return "unknown"; // Fallback case
 }
 
+// results/<category>/bucketing/bucketing<kind>_k.._t.._b.._threshold...csv
+string resultPath(const string &category, const string &kind, int b) {
+  stringstream ss;
+  ss << "results/" << category << "/bucketing/bucketing" << kind << "_k" << k
+     << "_t" << t << "_b" << b << "_threshold" << SIMILARITY_THRESHOLD
+     << ".csv";
+  return ss.str();
+}
+
+//---------------------------------------------------------------------------
+// Automatic band selection (--target-recall)
+//---------------------------------------------------------------------------
+// Calibrates the S-curve cost model on the signed corpus: the similarity
+// histogram of random document pairs, the time of verifying them, and the
+// time of adding a sample of documents to one band each.
+BandCalibration calibrateBands(const vector<Document> &documents) {
+  const size_t n = documents.size();
+  const size_t kMaxPairs = 20000;
+  BandCalibration calibration;
+  calibration.histogram.assign(t + 1, 0);
+  calibration.documents = n;
+  calibration.pairs = n * (n - 1) / 2.0;
+
+  // Every pair of a small corpus, a random sample of a large one
+  vector<pair<int, int>> sample;
+  if (calibration.pairs <= kMaxPairs) {
+    for (size_t i = 0; i < n; i++)
+      for (size_t j = i + 1; j < n; j++) sample.push_back({i, j});
+  } else {
+    mt19937_64 rng(hashSeed);
+    uniform_int_distribution<size_t> pick(0, n - 1);
+    while (sample.size() < kMaxPairs) {
+      size_t i = pick(rng), j = pick(rng);
+      if (i != j) sample.push_back({min(i, j), max(i, j)});
+    }
+  }
+
+  auto start = chrono::steady_clock::now();
+  for (const auto &pair : sample) {
+    float similarity = estimatedJaccardSimilarity(
+        documents[pair.first].signature, documents[pair.second].signature);
+    calibration.histogram[static_cast<size_t>(lround(similarity * t))]++;
+  }
+  auto end = chrono::steady_clock::now();
+  calibration.verifyNs =
+      chrono::duration<double, nano>(end - start).count() / sample.size();
+
+  // One row per band: the rows hashed per document add up to t whatever
+  // the band count, so only the per-band insertion is left to measure
+  size_t sampleDocs = min(n, max<size_t>(64, 200000 / t));
+  vector<BandBuckets> buckets(t);
+  start = chrono::steady_clock::now();
+  for (size_t i = 0; i < sampleDocs; i++) {
+    for (unsigned band = 0; band < t; band++) {
+      size_t key;
+      if (bandKey(documents[i].signature, t, band, key)) {
+        buckets[band][key].docIndices.push_back(i);
+      }
+    }
+  }
+  end = chrono::steady_clock::now();
+  calibration.insertNs = chrono::duration<double, nano>(end - start).count() /
+                         (double(sampleDocs) * t);
+  return calibration;
+}
+
+// Band count chosen by the cost model for the current t and threshold
+int autoBands(const vector<Document> &documents, double targetRecall) {
+  BandChoice choice = chooseBands(calibrateBands(documents), t,
+                                  SIMILARITY_THRESHOLD, targetRecall);
+  if (choice.recall < targetRecall) {
+    cerr << "Warning: No band count reaches recall " << targetRecall
+         << " at threshold " << SIMILARITY_THRESHOLD << " with t=" << t
+         << "; using the closest" << endl;
+  }
+  clog << "Auto bands: b=" << choice.bands << " r=" << choice.rows
+       << " (recall at threshold " << fixed << setprecision(3)
+       << choice.recall << ", ~" << setprecision(0) << choice.candidates
+       << " candidate pairs)" << defaultfloat << endl;
+  return choice.bands;
+}
+
+//---------------------------------------------------------------------------
+// Parameter sweep
+//---------------------------------------------------------------------------
+// Every (t, b, threshold) combination from one signing pass: buckets are
+// built once per (t, b) from signature prefixes and queried once per
+// threshold. Each combination writes the CSV pair a standalone run would,
+// with the shared reading and signing time counted in its index build.
+void runSweep(const vector<Document> &signedDocs, const SweepPlan &sweep,
+              const string &category) {
+  const map<string, double> shared = timeResults;
+  for (int sweepT : sweep.ts) {
+    t = sweepT;
+    vector<Document> documents(signedDocs.size());
+    for (size_t i = 0; i < signedDocs.size(); i++) {
+      documents[i].filename = signedDocs[i].filename;
+      documents[i].signature.assign(signedDocs[i].signature.begin(),
+                                    signedDocs[i].signature.begin() + t);
+      if (!signedDocs[i].runnerUp.empty()) {
+        documents[i].runnerUp.assign(signedDocs[i].runnerUp.begin(),
+                                     signedDocs[i].runnerUp.begin() + t);
+      }
+      documents[i].shingles = signedDocs[i].shingles;
+    }
+
+    for (const string &bands : sweep.bands) {
+      int b = SweepPlan::bandsFor(bands, t);
+      if (b <= 0 || b > sweepT) {
+        cerr << "Warning: Skipping b=" << b << " for t=" << t << endl;
+        continue;
+      }
+      timeResults = shared;
+      {
+        Timer timerLSH("index build");
+        initializeLSHBuckets(b);
+        ThreadPool::instance().parallelFor(0, b, [&](size_t band) {
+          ProfileScope scope("band insert");
+          for (size_t i = 0; i < documents.size(); i++) {
+            addToLSHBand(documents[i].signature, i, b, band);
+          }
+        });
+      }
+      const map<string, double> built = timeResults;
+
+      for (float threshold : sweep.thresholds) {
+        timeResults = built;
+        SIMILARITY_THRESHOLD = threshold;
+        vector<pair<int, int>> pairs;
+        {
+          Timer timerFindSimilar("query");
+          pairs = findSimilarDocumentPairs(documents, b, threshold);
+        }
+        Clustering clustering;
+        if (clusterOutput) {
+          Timer timerCluster("cluster");
+          clustering = clusterDocuments(documentIds(documents), pairs);
+        }
+        CsrGraph graph;
+        if (csrOutput) {
+          Timer timerGraph("graph");
+          graph = similarityGraph(documents, pairs);
+        }
+        measureStructures(documents, pairs, clustering, graph);
+        timeResults["time"] = timeResults["index build"] + timeResults["query"] +
+                              (clusterOutput ? timeResults["cluster"] : 0) +
+                              (csrOutput ? timeResults["graph"] : 0);
+        writeResultsToCSV(resultPath(category, "Similarities", b),
+                          resultPath(category, "Times", b), pairs, documents);
+        if (clusterOutput) {
+          writeClustersToCSV(resultPath(category, "Clusters", b),
+                             clustering, documentIds(documents));
+        }
+        if (csrOutput) {
+          writeGraph(resultPath(category, "Graph", b), graph);
+        }
+      }
+    }
+  }
+}
+
+//---------------------------------------------------------------------------
+// Query server (--serve, --socket PATH)
+//---------------------------------------------------------------------------
+// The corpus is signed and bucketed once, then near-duplicates of incoming
+// documents are looked up on the resident buckets (common/server.hpp):
+//
+//   QUERY <file>  near-duplicates of a document on disk
+//   TEXT <text>   near-duplicates of the text on the rest of the line
+//
+// answered with "OK <matches> <microseconds>" followed by one
+// "<doc> <similarity>" line per match, most similar first, or "ERR <why>".
+// Documents are named as in the CSVs. With --signatures the corpus comes from
+// the store and incoming documents are signed with its seed (main adopts it).
+string answerQuery(const string &request, const vector<Document> &documents,
+                   int numBands) {
+  auto start = chrono::steady_clock::now();
+  size_t space = request.find(' ');
+  string command = request.substr(0, space);
+  string argument = space == string::npos ? "" : request.substr(space + 1);
+
+  string text;
+  if (command == "QUERY") {
+    text = readFile(argument);
+    if (text.empty()) return "ERR cannot read " + argument + "\n";
+  } else if (command == "TEXT") {
+    text = argument;
+  } else {
+    return "ERR unknown command " + command + "\n";
+  }
+
+  unordered_set<uint64_t> kShingles;
+  tratar(text, kShingles);
+  if (kShingles.empty()) return "ERR no shingles in the document\n";
+  Document query;
+  query.signature = computeMinHashSignature(
+      kShingles, probesPerBand > 0 ? &query.runnerUp : nullptr);
+  if (exactVerify) query.shingles = sortedKeys(kShingles);
+  vector<pair<int, float>> matches =
+      queryBuckets(documents, query, numBands, SIMILARITY_THRESHOLD);
+
+  auto elapsed = chrono::duration_cast<chrono::microseconds>(
+                     chrono::steady_clock::now() - start)
+                     .count();
+  stringstream out;
+  out << "OK " << matches.size() << " " << elapsed << "\n";
+  for (const auto &match : matches) {
+    const string &name = documents[match.first].filename;
+    int number = extractNumber(name);
+    out << (number != -1 ? to_string(number) : name) << " " << fixed
+        << setprecision(6) << match.second << "\n";
+  }
+  return out.str();
+}
+
+int serveQueries(const vector<Document> &documents, int numBands,
+                 const string &socketPath) {
+  RequestHandler handler = [&](const string &request) {
+    return answerQuery(request, documents, numBands);
+  };
+  if (socketPath.empty()) {
+    cerr << "Serving " << documents.size() << " documents on stdin" << endl;
+    serveStream(cin, cout, handler);
+    return 0;
+  }
+  cerr << "Serving " << documents.size() << " documents on " << socketPath
+       << endl;
+  try {
+    serveUnixSocket(socketPath, handler);
+  } catch (const exception &e) {
+    cerr << "Error: " << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
+
+//---------------------------------------------------------------------------
+// Batch queries (--queries DIR)
+//---------------------------------------------------------------------------
+// R x S join: the corpus S is bucketed as usual and every document of R is
+// signed and probed against it, so the work grows with |R| and the pairs
+// inside S (or inside R) are never compared.
+
+// Matches of every query as (query, corpus document), in query order and
+// most similar first within a query
+vector<pair<int, int>> matchQueries(const vector<Document> &corpus,
+                                    const vector<Document> &queries,
+                                    int numBands, float threshold) {
+  vector<vector<pair<int, float>>> matches(queries.size());
+  ThreadPool::instance().parallelFor(0, queries.size(), [&](size_t q) {
+    matches[q] = queryBuckets(corpus, queries[q], numBands, threshold);
+  });
+
+  vector<pair<int, int>> pairs;
+  for (size_t q = 0; q < queries.size(); q++) {
+    for (const auto &match : matches[q]) {
+      pairs.push_back({static_cast<int>(q), match.first});
+    }
+  }
+  return pairs;
+}
+
+// Signs the files of queryDir and writes their matches in the corpus to
+// bucketingQuery{Similarities,Times}_*.csv. Returns the exit status.
+int runQueryBatch(vector<Document> &corpus, const string &queryDir,
+                  const string &corpusDir, int b,
+                  const PipelineConfig &pipeline) {
+  vector<Document> queries;
+  vector<pair<int, int>> pairs;
+  {
+    Timer timerQuery("query");
+    vector<string> paths;
+    for (const auto &entry : filesystem::directory_iterator(queryDir)) {
+      if (entry.is_regular_file() && isFilePath(entry.path().string())) {
+        paths.push_back(entry.path().string());
+      }
+    }
+    queries = buildDocuments(paths, pipeline);
+    pairs = matchQueries(corpus, queries, b, SIMILARITY_THRESHOLD);
+  }
+
+  // The CSV writer indexes one document list: queries go after the corpus
+  size_t offset = corpus.size();
+  for (Document &query : queries) corpus.push_back(move(query));
+  for (auto &pair : pairs) pair.first += offset;
+
+  Clustering clustering;
+  if (clusterOutput) {
+    Timer timerCluster("cluster");
+    clustering = clusterDocuments(documentIds(corpus), pairs);
+  }
+  timeResults["time"] = timeResults["index build"] + timeResults["query"] +
+                        (clusterOutput ? timeResults["cluster"] : 0);
+
+  string category = determineCategory(corpusDir);
+  if (category == "unknown") {
+    cerr << "Warning: Could not determine category from input directory!"
+         << endl;
+    return 1;
+  }
+  writeResultsToCSV(resultPath(category, "QuerySimilarities", b),
+                    resultPath(category, "QueryTimes", b), pairs, corpus);
+  if (clusterOutput) {
+    writeClustersToCSV(resultPath(category, "QueryClusters", b),
+                       clustering, documentIds(corpus));
+  }
+  return 0;
+}
+
+//---------------------------------------------------------------------------
+// Incremental index (--index DIR)
+//---------------------------------------------------------------------------
+// The corpus is compared against an index directory (common/corpusIndex.hpp)
+// instead of being signed from scratch. Files whose size and mtime match
+// the index are not even read; files that were touched but hash to the same
+// content keep their signature. Only new and modified files are signed, and
+// only pairs involving them are reported.
+struct RefreshStats {
+  size_t added = 0;
+  size_t modified = 0;
+  size_t deleted = 0;
+  size_t unchanged = 0;
+};
+
+// Brings the index in line with paths; returns the paths that were signed
+vector<string> refreshIndex(CorpusIndex &index, const vector<string> &paths,
+                            int numBands, RefreshStats &stats) {
+  // Fingerprint from the file system; a file whose size and mtime match the
+  // index is taken as unchanged without reading it
+  struct Scan {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    bool read = false;
+  };
+  vector<Scan> scans(paths.size());
+  vector<size_t> toRead;
+  for (size_t i = 0; i < paths.size(); i++) {
+    // Either one failing means the fingerprint is unknown: read the file
+    error_code sizeError, timeError;
+    scans[i].size = filesystem::file_size(paths[i], sizeError);
+    scans[i].mtime = filesystem::last_write_time(paths[i], timeError)
+                         .time_since_epoch()
+                         .count();
+    long id = index.find(paths[i]);
+    if (sizeError || timeError || id < 0 || index.documents()[id].size != scans[i].size ||
+        index.documents()[id].mtime != scans[i].mtime) {
+      scans[i].read = true;
+      toRead.push_back(i);
+    }
+  }
+
+  // Read, hash and (if the content changed) sign in parallel; the index is
+  // only read here
+  enum Outcome : char { kSkipped, kSameContent, kSigned };
+  vector<optional<IndexEntry>> updates(toRead.size());
+  vector<char> outcome(toRead.size(), kSkipped);
+  ThreadPool::instance().parallelFor(0, toRead.size(), [&](size_t r) {
+    const string &path = paths[toRead[r]];
+    string content = readFile(path);
+    if (content.empty()) {
+      cerr << "Warning: File " << path
+           << " is empty or could not be read. Skipping." << endl;
+      return;
+    }
+    uint64_t contentHash = XXH64(content.data(), content.size(), 0);
+
+    long id = index.find(path);
+    if (id >= 0 && index.documents()[id].contentHash == contentHash) {
+      IndexEntry entry = index.documents()[id];
+      entry.size = scans[toRead[r]].size;
+      entry.mtime = scans[toRead[r]].mtime;
+      updates[r] = move(entry);
+      outcome[r] = kSameContent;
+      return;
+    }
+
+    unordered_set<uint64_t> kShingles;
+    tratar(content, kShingles);
+    if (kShingles.empty()) {
+      cerr << "Warning: No valid shingles extracted from " << path
+           << ". Skipping." << endl;
+      return;
+    }
+    IndexEntry entry;
+    entry.path = path;
+    entry.size = scans[toRead[r]].size;
+    entry.mtime = scans[toRead[r]].mtime;
+    entry.contentHash = contentHash;
+    entry.signature = computeMinHashSignature(kShingles);
+    entry.bandKeys.resize(numBands);
+    for (int band = 0; band < numBands; band++) {
+      size_t key = 0;
+      bandKey(entry.signature, numBands, band, key);
+      entry.bandKeys[band] = key;
+    }
+    updates[r] = move(entry);
+    outcome[r] = kSigned;
+  });
+
+  vector<string> signedPaths;
+  unordered_set<string> present;
+  for (size_t r = 0; r < toRead.size(); r++) {
+    const string &path = paths[toRead[r]];
+    if (outcome[r] == kSkipped) continue;
+    if (outcome[r] == kSigned) {
+      (index.find(path) < 0 ? stats.added : stats.modified)++;
+      signedPaths.push_back(path);
+    } else {
+      stats.unchanged++;
+    }
+    index.put(move(*updates[r]));
+    present.insert(path);
+  }
+  for (size_t i = 0; i < paths.size(); i++) {
+    if (!scans[i].read) {
+      stats.unchanged++;
+      present.insert(paths[i]);
+    }
+  }
+
+  // Files that are gone (or no longer readable) get a tombstone
+  vector<string> gone;
+  for (const IndexEntry &entry : index.documents()) {
+    if (!present.count(entry.path)) gone.push_back(entry.path);
+  }
+  for (const string &path : gone) index.erase(path);
+  stats.deleted = gone.size();
+
+  index.flush();
+  if (index.tombstones() > index.documents().size()) index.compact();
+  return signedPaths;
+}
+
+// Similar pairs with at least one of the changed documents, from the band
+// keys stored in the index. Positions refer to index.documents().
+vector<pair<int, int>> findChangedPairs(const CorpusIndex &index,
+                                        const vector<string> &changed,
+                                        int numBands, float threshold) {
+  const vector<IndexEntry> &entries = index.documents();
+  initializeLSHBuckets(numBands);
+  ThreadPool::instance().parallelFor(0, numBands, [&](size_t band) {
+    for (size_t i = 0; i < entries.size(); i++) {
+      bandBucketMap[band][entries[i].bandKeys[band]].docIndices.push_back(i);
+    }
+  });
+
+  vector<vector<pair<int, int>>> candidates(changed.size());
+  ThreadPool::instance().parallelFor(0, changed.size(), [&](size_t c) {
+    int doc = static_cast<int>(index.find(changed[c]));
+    for (int band = 0; band < numBands; band++) {
+      const Bucket &bucket =
+          bandBucketMap[band].at(entries[doc].bandKeys[band]);
+      for (int other : bucket.docIndices) {
+        if (other != doc) {
+          candidates[c].push_back({min(doc, other), max(doc, other)});
+        }
+      }
+    }
+  });
+
+  vector<pair<int, int>> candidatePairs;
+  for (auto &list : candidates) {
+    candidatePairs.insert(candidatePairs.end(), list.begin(), list.end());
+  }
+  sort(candidatePairs.begin(), candidatePairs.end());
+  candidatePairs.erase(unique(candidatePairs.begin(), candidatePairs.end()),
+                       candidatePairs.end());
+
+  ThresholdComparator comparator(
+      entries.empty() ? 0 : entries[0].signature.size(), threshold,
+      rejectConfidence);
+  vector<pair<int, int>> pairs;
+  for (const auto &pair : candidatePairs) {
+    if (comparator.reaches(entries[pair.first].signature,
+                           entries[pair.second].signature)) {
+      pairs.push_back(pair);
+    }
+  }
+  return pairs;
+}
+
+// Refreshes the index in indexDir from corpusDir and writes the pairs that
+// involve new or modified documents. Returns the exit status.
+int runIndexed(const string &corpusDir, const string &indexDir, int b,
+               bool seedGiven) {
+  optional<CorpusIndex> index;
+  vector<string> changed;
+  RefreshStats stats;
+  {
+    Timer timerRefresh("index build");
+    CorpusIndexInfo info;
+    info.k = k;
+    info.t = t;
+    info.b = b;
+    info.seed = hashSeed;
+    info.hashFamily = hashFamily();
+    try {
+      index.emplace(indexDir, info);
+    } catch (const exception &e) {
+      cerr << "Error: " << e.what() << endl;
+      return 1;
+    }
+
+    // An existing index decides the seed; everything else has to match
+    const CorpusIndexInfo &stored = index->info();
+    if (stored.k != info.k || stored.t != info.t || stored.b != info.b ||
+        stored.hashFamily != info.hashFamily ||
+        (seedGiven && stored.seed != info.seed)) {
+      cerr << "Error: " << indexDir << " was built with k=" << stored.k
+           << ", t=" << stored.t << ", b=" << stored.b
+           << ", seed=" << stored.seed << ", " << stored.hashFamily
+           << "; use another directory for these parameters" << endl;
+      return 1;
+    }
+    if (stored.seed != hashSeed) {
+      hashSeed = stored.seed;
+      initializeHashFunctions();
+    }
+
+    vector<string> paths;
+    for (const auto &entry : filesystem::directory_iterator(corpusDir)) {
+      if (entry.is_regular_file() && isFilePath(entry.path().string())) {
+        paths.push_back(entry.path().string());
+      }
+    }
+    sort(paths.begin(), paths.end());
+
+    try {
+      changed = refreshIndex(*index, paths, b, stats);
+    } catch (const exception &e) {
+      cerr << "Error: Could not update " << indexDir << ": " << e.what()
+           << endl;
+      return 1;
+    }
+  }
+  cout << "Index " << indexDir << ": " << index->documents().size()
+       << " documents (" << stats.added << " added, " << stats.modified
+       << " modified, " << stats.deleted << " deleted, " << stats.unchanged
+       << " unchanged)" << endl;
+
+  vector<pair<int, int>> pairs;
+  {
+    Timer timerFindSimilar("query");
+    pairs = findChangedPairs(*index, changed, b, SIMILARITY_THRESHOLD);
+  }
+  timeResults["time"] = timeResults["index build"] + timeResults["query"];
+
+  // Only the documents of the reported pairs are needed for the CSV
+  vector<Document> documents;
+  unordered_map<int, int> position;
+  for (auto &pair : pairs) {
+    for (int *doc : {&pair.first, &pair.second}) {
+      auto it = position.find(*doc);
+      if (it == position.end()) {
+        const IndexEntry &entry = index->documents()[*doc];
+        it = position.emplace(*doc, static_cast<int>(documents.size())).first;
+        documents.emplace_back(entry.path);
+        documents.back().signature = entry.signature;
+      }
+      *doc = it->second;
+    }
+  }
+
+  string category = determineCategory(corpusDir);
+  if (category == "unknown") {
+    cerr << "Warning: Could not determine category from input directory!"
+         << endl;
+    return 1;
+  }
+  writeResultsToCSV(resultPath(category, "RefreshSimilarities", b),
+                    resultPath(category, "RefreshTimes", b), pairs, documents);
+  return 0;
+}
 
 //---------------------------------------------------------------------------
 // Main
@@ -648,27 +1695,121 @@ void printUsage(const char *programName) {
   cout << "  <t>: Number of hash functions" << endl;
   cout << "  <b>: Number of bands for LSH" << endl;
   cout << "  <sim_threshold>: Similarity threshold (0.0 to 1.0)" << endl;
+  cout << "options (after the positional arguments):" << endl;
+  cout << "  --threads N: Worker threads (default: all cores)" << endl;
+  cout << "  --io-threads N: Threads reading files (default 1)" << endl;
+  cout << "  --tokenize-threads N: Threads extracting shingles" << endl;
+  cout << "  --sign-threads N: Threads computing signatures" << endl;
+  cout << "  --queue-capacity N: Documents buffered between stages" << endl;
+  cout << "  --stopwords FILE: JSON stopword list (default: built-in list)"
+       << endl;
+  cout << "  --word-ids: Build shingles from dictionary word ids" << endl;
+  cout << "  --seed N: Seed of the hash functions (default: clock)" << endl;
+  cout << "  --save-signatures FILE: Save the signatures to a store" << endl;
+  cout << "  --signatures FILE: Band a saved store instead of reading "
+          "<corpus_dir>"
+       << endl;
+  cout << "  --sweep-t LIST, --sweep-b LIST, --sweep-thr LIST: Run every "
+          "combination in one process (b may be a percentage of t, e.g. 50%)"
+       << endl;
+  cout << "  --sweep-k LIST: Shingle once for every k in the list and run the "
+          "sweep per k"
+       << endl;
+  cout << "  --index DIR: Keep the signatures in DIR and only sign new or "
+          "changed files; reports the pairs involving them"
+       << endl;
+  cout << "  --serve: Build the index once and answer QUERY <file> / TEXT "
+          "<text> lines from stdin"
+       << endl;
+  cout << "  --socket PATH: Like --serve, on a Unix domain socket" << endl;
+  cout << "  --queries DIR: Match the files of DIR against the corpus (R x S) "
+          "instead of comparing the corpus with itself"
+       << endl;
+  cout << "  --probes N: Multi-probe LSH, also look into the N buckets next to "
+          "a document's own in every band"
+       << endl;
+  cout << "  --target-recall R: Ignore <b> and pick the cheapest band count "
+          "whose collision probability at <sim_threshold> is at least R"
+       << endl;
+  cout << "  --clusters: Also write bucketingClusters_*.csv with the cluster "
+          "and representative of every document"
+       << endl;
+  cout << "  --csr: Also write the similarity graph as a CSR matrix, "
+          "bucketingGraph_*.{indptr,indices,data,docs}.npy"
+       << endl;
+  cout << "  --exact: Keep the shingles and verify candidates with their exact "
+          "Jaccard similarity instead of the signature estimate"
+       << endl;
+  cout << "  --npy: Write the pairs as .npy columns (doc1, doc2, sim) instead "
+          "of a CSV"
+       << endl;
+  cout << "  --trace FILE: Write a Chrome trace of the timed stages to FILE "
+          "(and their totals to FILE.stages.csv)"
+       << endl;
+  cout << "  --perf-counters: Write hardware counters per stage (cycles, "
+          "instructions, cache and branch misses) to bucketingCounters_*.csv"
+       << endl;
+  cout << "  --memory: Write the estimated size of the main structures and the "
+          "peak RSS per stage to bucketingMemory_*.csv"
+       << endl;
+  cout << "  --reject-confidence C: Also drop candidates early with a "
+          "sequential test that keeps pairs at the threshold with probability "
+          "C (0 < C < 1)"
+       << endl;
 }
 
 int main(int argc, char *argv[]) {
   
-  string filename1, filename2,category;
+  string filename1, filename2, filename3, filename4, category;
   vector<Document> documents;
+  vector<vector<Document>> documentsPerK;  // --sweep-k
+  Clustering clustering;                  // --clusters
+  CsrGraph graph;                         // --csr
   
   {
     Timer timerGlobal("time");
   // Check command line arguments
-  if (argc != 6) {
+  Options opts = parseOptions(argc, argv);
+  if (opts.positional.size() != 5) {
     printUsage(argv[0]);
     return 1;
   }
 
   // Parse parameters
-  string corpusDir = argv[1];
-  k = stoi(argv[2]);                     // Shingle size
-  t = stoi(argv[3]);                     // Number of hash functions
-  int b = stoi(argv[4]);                 // Number of bands
-  SIMILARITY_THRESHOLD = stof(argv[5]);  // Similarity threshold
+  string corpusDir = opts.positional[0];
+  k = stoi(opts.positional[1]);                     // Shingle size
+  t = stoi(opts.positional[2]);                     // Number of hash functions
+  int b = stoi(opts.positional[3]);                 // Number of bands
+  SIMILARITY_THRESHOLD = stof(opts.positional[4]);  // Similarity threshold
+
+  unsigned threads;
+  try {
+    threads = opts.getPositiveInt("threads", thread::hardware_concurrency());
+  } catch (const exception &e) {
+    cerr << "Error: " << e.what() << endl;
+    return 1;
+  }
+  ThreadPool::setThreads(threads);
+  useWordIds = opts.has("word-ids");
+  hashSeed = opts.has("seed")
+                 ? stoull(opts.get("seed"))
+                 : static_cast<unsigned>(
+                       chrono::system_clock::now().time_since_epoch().count());
+  string signaturesIn = opts.get("signatures");
+  string signaturesOut = opts.get("save-signatures");
+  PipelineConfig pipeline = PipelineConfig::defaults(threads);
+  try {
+    pipeline.ioThreads = opts.getPositiveInt("io-threads", pipeline.ioThreads);
+    pipeline.tokenizeThreads =
+        opts.getPositiveInt("tokenize-threads", pipeline.tokenizeThreads);
+    pipeline.signThreads =
+        opts.getPositiveInt("sign-threads", pipeline.signThreads);
+    pipeline.queueCapacity =
+        opts.getPositiveInt("queue-capacity", pipeline.queueCapacity);
+  } catch (const exception &e) {
+    cerr << "Error: " << e.what() << endl;
+    return 1;
+  }
 
   // Validate inputs
   if (k <= 0 || b <= 0 || t <= 0 || SIMILARITY_THRESHOLD <= 0 ||
@@ -679,25 +1820,153 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  // Check if corpus directory exists
-  if (!filesystem::exists(corpusDir)) {
+  SweepPlan sweep;
+  try {
+    sweep = parseSweep(opts, t, b, SIMILARITY_THRESHOLD);
+  } catch (const exception &e) {
+    cerr << "Error: Invalid sweep list: " << e.what() << endl;
+    return 1;
+  }
+  if (sweep.active) t = sweep.maxT();  // Sign once for the largest t
+  if (!sweep.ks.empty() && (!signaturesIn.empty() || !signaturesOut.empty())) {
+    cerr << "Error: --sweep-k cannot be combined with --signatures or "
+            "--save-signatures"
+         << endl;
+    return 1;
+  }
+  string indexDir = opts.get("index");
+  probesPerBand = opts.getInt("probes", 0);
+  if (probesPerBand < 0) {
+    cerr << "Error: --probes must not be negative" << endl;
+    return 1;
+  }
+  if (probesPerBand > 0 && !signaturesIn.empty()) {
+    // A store keeps the signatures only, not the runner-up hashes
+    cerr << "Warning: --probes has no effect on signatures loaded with "
+            "--signatures"
+         << endl;
+  }
+  double targetRecall = 0;
+  if (opts.has("target-recall")) {
+    targetRecall = stod(opts.get("target-recall"));
+    if (targetRecall <= 0 || targetRecall >= 1) {
+      cerr << "Error: --target-recall must be between 0 and 1" << endl;
+      return 1;
+    }
+    if (sweep.active || !indexDir.empty()) {
+      cerr << "Error: --target-recall cannot be combined with --sweep-* or "
+              "--index"
+           << endl;
+      return 1;
+    }
+  }
+  string socketPath = opts.get("socket");
+  bool serving = opts.has("serve") || !socketPath.empty();
+  clusterOutput = opts.has("clusters");
+  csrOutput = opts.has("csr");
+  exactVerify = opts.has("exact");
+  npyOutput = opts.has("npy");
+  string tracePath = opts.get("trace");
+  if (!tracePath.empty()) Profiler::instance().traceTo(tracePath);
+  if (opts.has("perf-counters")) PerfCounters::instance().start();
+  if (opts.has("memory")) MemoryReport::instance().enable();
+  if (opts.has("reject-confidence")) {
+    rejectConfidence = stod(opts.get("reject-confidence"));
+    if (rejectConfidence <= 0 || rejectConfidence >= 1) {
+      cerr << "Error: --reject-confidence must be between 0 and 1" << endl;
+      return 1;
+    }
+  }
+  if (exactVerify && (!signaturesIn.empty() || !indexDir.empty())) {
+    // Neither a signature store nor the index keeps the shingles
+    cerr << "Error: --exact cannot be combined with --signatures or --index"
+         << endl;
+    return 1;
+  }
+  if (clusterOutput && (serving || !indexDir.empty())) {
+    cerr << "Error: --clusters cannot be combined with --serve, --socket or "
+            "--index"
+         << endl;
+    return 1;
+  }
+  if (csrOutput && (serving || !indexDir.empty() || opts.has("queries"))) {
+    cerr << "Error: --csr cannot be combined with --serve, --socket, --index "
+            "or --queries"
+         << endl;
+    return 1;
+  }
+  if (serving && (sweep.active || !indexDir.empty())) {
+    cerr << "Error: --serve and --socket cannot be combined with --sweep-* "
+            "or --index"
+         << endl;
+    return 1;
+  }
+  string queryDir = opts.get("queries");
+  if (!queryDir.empty()) {
+    if (sweep.active || !indexDir.empty() || serving) {
+      cerr << "Error: --queries cannot be combined with --sweep-*, --index, "
+              "--serve or --socket"
+           << endl;
+      return 1;
+    }
+    if (!filesystem::is_directory(queryDir)) {
+      cerr << "Error: " << queryDir << " is not a directory" << endl;
+      return 1;
+    }
+  }
+  if (useWordIds && !signaturesIn.empty() && (serving || !queryDir.empty())) {
+    // The store does not keep the word ids, so new documents would get others
+    cerr << "Error: --word-ids with --signatures cannot sign --queries, "
+            "--serve or --socket documents"
+         << endl;
+    return 1;
+  }
+  if (!indexDir.empty()) {
+    // Word ids are not kept between runs, so they cannot key an index
+    if (sweep.active || useWordIds || !signaturesIn.empty() ||
+        !signaturesOut.empty() || probesPerBand > 0) {
+      cerr << "Error: --index cannot be combined with --sweep-*, --word-ids, "
+              "--signatures, --save-signatures or --probes"
+           << endl;
+      return 1;
+    }
+    if (static_cast<unsigned>(b) > t) {
+      cerr << "Error: --index needs b <= t" << endl;
+      return 1;
+    }
+  }
+
+  // Check if corpus directory exists (only named for the category when
+  // signatures come from a store)
+  if (signaturesIn.empty() && !filesystem::exists(corpusDir)) {
     cerr << "Error: Directory " << corpusDir << " does not exist" << endl;
     return 1;
   }
 
-  if (!filesystem::is_directory(corpusDir)) {
+  if (signaturesIn.empty() && !filesystem::is_directory(corpusDir)) {
     cerr << "Error: " << corpusDir << " is not a directory" << endl;
     return 1;
   }
 
-  // Load stopwords - Handle potential missing file gracefully
-  try {
-    //cout << "Loading stopwords..." << endl;
-    stopwords = loadStopwords("stopwords-en.json");
-    //cout << "Loaded " << stopwords.size() << " stopwords" << endl;
-  } catch (const exception &e) {
-    cerr << "Warning: Error loading stopwords: " << e.what() << endl;
-    // Continue execution even if stopwords can't be loaded
+  // The built-in list is used unless --stopwords points to another one
+  if (opts.has("stopwords")) {
+    try {
+      stopwords = StopwordFilter(loadStopwords(opts.get("stopwords")));
+    } catch (const exception &e) {
+      cerr << "Warning: Error loading stopwords: " << e.what() << endl;
+      // Continue execution even if stopwords can't be loaded
+    }
+  }
+
+  // A store brings its own seed, so documents signed here (--queries,
+  // --serve) get the coefficients the stored signatures were made with
+  if (!signaturesIn.empty()) {
+    try {
+      hashSeed = storeSeed(signaturesIn, opts.has("seed"), hashSeed);
+    } catch (const exception &e) {
+      cerr << "Error: " << e.what() << endl;
+      return 1;
+    }
   }
 
   // Initialize hash functions - THIS WAS MISSING IN THE ORIGINAL CODE
@@ -708,79 +1977,114 @@ int main(int argc, char *argv[]) {
   //cout << "Initialized " << hashCoefficients.size() << " hash functions"
    //    << endl;
 
+  if (!indexDir.empty()) {
+    return runIndexed(corpusDir, indexDir, b, opts.has("seed"));
+  }
+
   // Process all files in the corpus directory
   
   {
     Timer timerProcessCorpus("index build");
-    //cout << "Processing files in directory: " << corpusDir << endl;
-
-    // Count how many files we'll process
-    int fileCount = 0;
-    for (const auto &entry : filesystem::directory_iterator(corpusDir)) {
-      if (entry.is_regular_file() && isFilePath(entry.path().string())) {
-        fileCount++;
+    if (!signaturesIn.empty()) {
+      try {
+        documents = loadSignatures(signaturesIn);
+      } catch (const exception &e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
       }
-    }
-    //cout << "Found " << fileCount << " files to process" << endl;
-
-    // Process each file
-    int processedCount = 0;
-    for (const auto &entry : filesystem::directory_iterator(corpusDir)) {
-      if (entry.is_regular_file() && isFilePath(entry.path().string())) {
-        string filename = entry.path().string();
-        Document doc(filename);
-
-        // Read and process file
-        string content = readFile(filename);
-        if (content.empty()) {
-          cerr << "Warning: File " << filename
-               << " is empty or could not be read. Skipping." << endl;
-          continue;
-        }
-
-        // Extract shingles
-        tratar(content, doc.kShingles);
-        if (doc.kShingles.empty()) {
-          cerr << "Warning: No valid shingles extracted from " << filename
-               << ". Skipping." << endl;
-          continue;
+    } else {
+      //cout << "Processing files in directory: " << corpusDir << endl;
+
+      // Collect the files we'll process
+      vector<string> paths;
+      for (const auto &entry : filesystem::directory_iterator(corpusDir)) {
+        if (entry.is_regular_file() && isFilePath(entry.path().string())) {
+          paths.push_back(entry.path().string());
         }
+      }
+      //cout << "Found " << paths.size() << " files to process" << endl;
 
-        // Compute MinHash signature
-        doc.signature = computeMinHashSignature(doc.kShingles);
-
-        // Add to documents collection
-        documents.push_back(doc);
+      if (!sweep.ks.empty()) {
+        documentsPerK = buildDocumentSets(paths, pipeline, sweep.ks);
+      } else {
+        documents = buildDocuments(paths, pipeline);
+      }
+    }
+  }
 
-        // Progress reporting
-        processedCount++;
-        if (processedCount % 10 == 0 || processedCount == fileCount) {
-         // cout << "Processed " << processedCount << "/" << fileCount << " files"
-          //     << endl;
-        }
+  if (!sweep.ks.empty()) {
+    category = determineCategory(corpusDir);
+    if (category == "unknown") {
+      cerr << "Warning: Could not determine category from input directory!"
+           << endl;
+      return 1;
+    }
+    for (size_t i = 0; i < sweep.ks.size(); i++) {
+      k = sweep.ks[i];
+      if (documentsPerK[i].size() < 2) {
+        cerr << "Warning: Skipping k=" << k << ", only "
+             << documentsPerK[i].size() << " valid documents" << endl;
+        continue;
       }
+      runSweep(documentsPerK[i], sweep, category);
+    }
+    return 0;
+  }
+
+  if (!signaturesOut.empty()) {
+    try {
+      saveSignatures(signaturesOut, documents);
+    } catch (const exception &e) {
+      cerr << "Warning: Could not save signatures: " << e.what() << endl;
     }
   }
 
-  // Check if we have enough documents
-  if (documents.size() < 2) {
+  // Check if we have enough documents (a batch of queries needs only one)
+  if (documents.size() < (queryDir.empty() ? 2u : 1u)) {
     cerr << "Error: Need at least 2 valid documents to compare. Found: "
          << documents.size() << endl;
     return 1;
   }
 
+  if (sweep.active) {
+    category = determineCategory(corpusDir);
+    if (category == "unknown") {
+      cerr << "Warning: Could not determine category from input directory!"
+           << endl;
+      return 1;
+    }
+    runSweep(documents, sweep, category);
+    return 0;
+  }
+
+  // Replace the positional b with the cheapest one for the target recall
+  if (targetRecall > 0) {
+    Timer timerTune("index build");
+    b = autoBands(documents, targetRecall);
+  }
+
   // Initialize LSH buckets
   {
     Timer timerInitBuckets("index build");
     initializeLSHBuckets(b);
   }
 
-  // Add documents to LSH buckets
+  // Add documents to LSH buckets, one band per task
   {
     Timer timerLSH("index build");
-    for (size_t i = 0; i < documents.size(); i++) {
-      addToLSHBuckets(documents[i].signature, i, b);
-    }
+    ThreadPool::instance().parallelFor(0, b, [&](size_t band) {
+      ProfileScope scope("band insert");
+      for (size_t i = 0; i < documents.size(); i++) {
+        addToLSHBand(documents[i].signature, i, b, band);
+      }
+    });
+  }
+
+  if (serving) {
+    return serveQueries(documents, b, socketPath);
+  }
+  if (!queryDir.empty()) {
+    return runQueryBatch(documents, queryDir, corpusDir, b, pipeline);
   }
 
   // Find similar document pairs
@@ -788,8 +2092,17 @@ int main(int argc, char *argv[]) {
     Timer timerFindSimilar("query");
     similarPairs = findSimilarDocumentPairs(documents, b, SIMILARITY_THRESHOLD);
   }
+  if (clusterOutput) {
+    Timer timerCluster("cluster");
+    clustering = clusterDocuments(documentIds(documents), similarPairs);
+  }
+  if (csrOutput) {
+    Timer timerGraph("graph");
+    graph = similarityGraph(documents, similarPairs);
+  }
+  measureStructures(documents, similarPairs, clustering, graph);
 
- category = determineCategory(argv[1]);
+ category = determineCategory(corpusDir);
 
  // Ensure the category is valid
  if (category == "unknown") {
@@ -797,24 +2110,20 @@ int main(int argc, char *argv[]) {
    return 1;
  }
 
- std::stringstream ss;
- ss << "results/" << category << "/bucketing/bucketingSimilarities_k" << k
- << "_t" << t
- << "_b" << b
-    << "_threshold" << SIMILARITY_THRESHOLD << ".csv";
-
- filename1 = ss.str();
+ filename1 = resultPath(category, "Similarities", b);
 
- // Generate the second filename with the same structure (e.g., for time measurements)
- std::stringstream ss2;
- ss2 << "results/" << category << "/bucketing/bucketingTimes_k" << k
- << "_t" << t
- << "_b" << b
-   << "_threshold" << SIMILARITY_THRESHOLD << ".csv";
-
- filename2 = ss2.str();
+ // Second file with the same structure, for the time measurements
+ filename2 = resultPath(category, "Times", b);
+ filename3 = resultPath(category, "Clusters", b);
+ filename4 = resultPath(category, "Graph", b);
   }
  writeResultsToCSV(filename1, filename2, similarPairs, documents);
+ if (clusterOutput) {
+   writeClustersToCSV(filename3, clustering, documentIds(documents));
+ }
+ if (csrOutput) {
+   writeGraph(filename4, graph);
+ }
 
 
   return 0;
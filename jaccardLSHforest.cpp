@@ -1,15 +1,37 @@
+#include <atomic>
 #include <cctype>
 #include <chrono>
 #include <climits>
 #include <cmath>
 #include <fstream>
 #include <iostream>
+#include "common/clustering.hpp"
+#include "common/csrGraph.hpp"
+#include "common/dictionary.hpp"
+#include "common/npyWriter.hpp"
+#include "common/options.hpp"
+#include "common/resultWriter.hpp"
+#include "common/pipeline.hpp"
+#include "common/memoryReport.hpp"
+#include "common/perfCounters.hpp"
+#include "common/profiler.hpp"
+#include "common/server.hpp"
+#include "common/shingler.hpp"
+#include "common/signatureCompare.hpp"
+#include "common/signatureStore.hpp"
+#include "common/sweep.hpp"
+#include "common/stopwords.hpp"
+#include "common/threadPool.hpp"
+#include "common/tokenizer.hpp"
+#include "common/topK.hpp"
 #include "deps/nlohmann/json.hpp"
 #include "deps/xxhash/xxhash.h"
+#include <optional>
 #include <queue>
 #include <random>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <set>
@@ -18,6 +40,7 @@
 #include <algorithm>
 #include <iomanip>
 #include <functional>
+#include <numeric>
 #include <regex>
 
 using namespace std;
@@ -27,17 +50,24 @@ unsigned int t; // Numero de funciones hash para el minhash (replaces numHashFun
 float SIMILARITY_THRESHOLD;
 vector<pair<int, int>> hashCoefficients; // [a, b] for funcionhash(x) = (ax + b) % p
 int p;									 // Prime number for hash functions
-unordered_set<string> stopwords;		 // Stopwords
+uint64_t hashSeed;						 // Seed of the coefficients (--seed)
+StopwordFilter stopwords;			 // Stopwords
+bool useWordIds = false;			 // Shingles from word ids (--word-ids)
+WordDictionary dictionary;			 // Word -> id, shared by all documents
 vector<pair<int, int>> similarPairs;	 // Similar pairs of documents
-map<string, int> timeResults;			 // Map to store execution times
+bool clusterOutput = false;			 // Also write the clusters (--clusters)
+bool csrOutput = false;				 // Also write the similarity graph (--csr)
+double rejectConfidence = 0;		 // Sequential rejection test (--reject-confidence)
+bool npyOutput = false;				 // Pairs as .npy columns (--npy)
+map<string, double> timeResults;			 // Map to store execution times
 
 // Document structure to store document information
 struct Document
 {
 	string filename;
-	unordered_set<string> kShingles;
-	vector<int> signature;
+	vector<int> signature; // The shingles are dropped once it is computed
 
+	Document() = default;
 	Document(const string &name) : filename(name) {}
 };
 
@@ -65,29 +95,21 @@ vector<LSHForestNode *> lshForest;
 class Timer
 {
 private:
-  chrono::high_resolution_clock::time_point startTime;
+  ProfileScope scope;  // Also the scope of the trace (common/profiler.hpp)
+  StageCounters counters;  // --perf-counters (common/perfCounters.hpp)
+  StageMemory memory;  // --memory (common/memoryReport.hpp)
   string operationName;
 
 public:
-  Timer(const string &name) : operationName(name)
-  {
-    startTime = chrono::high_resolution_clock::now();
-  }
+  Timer(const string &name)
+    : scope(Profiler::instance().intern(name)),
+      counters(Profiler::instance().intern(name)),
+      memory(Profiler::instance().intern(name)),
+      operationName(name) {}
 
   ~Timer()
   {
-    auto endTime = chrono::high_resolution_clock::now();
-    auto duration =
-        chrono::duration_cast<chrono::milliseconds>(endTime - startTime)
-            .count();
-    if (timeResults.count(operationName) == 0)
-    {
-      timeResults[operationName] = duration;
-    }
-    else
-    {
-      timeResults[operationName] += duration;
-    }
+    timeResults[operationName] += scope.elapsedMs();
   }
 };
 
@@ -131,7 +153,7 @@ void initializeLSHForest(int numTrees)
 // Check if a word is a stopword
 bool is_stopword(const string &word)
 {
-	return stopwords.find(word) != stopwords.end();
+	return stopwords.contains(word);
 }
 
 // load stopwords from a file into stopword set
@@ -160,21 +182,6 @@ unordered_set<string> loadStopwords(const string &filename)
 // Treating Format
 //---------------------------------------------------------------------------
 
-// Quita signos de puntuacion y mayusculas
-string normalize(const string &word)
-{
-	string result;
-	result.reserve(word.length());
-	for (char c : word)
-	{
-		if (isalpha(c))
-		{
-			result += tolower(c);
-		}
-	}
-	return result;
-}
-
 // Read content from file
 string readFile(const string &filename)
 {
@@ -249,9 +256,8 @@ void initializeHashFunctions()
 {
 	p = nextPrime(INT_MAX / 2); // A larger prime number for better distribution
 
-	// Use a time-based seed for better randomness
-	unsigned seed = chrono::system_clock::now().time_since_epoch().count();
-	mt19937_64 gen(seed); // Using 64-bit Mersenne Twister
+	// Seeded from --seed (the clock by default) so runs can be reproduced
+	mt19937_64 gen(hashSeed); // Using 64-bit Mersenne Twister
 	uniform_int_distribution<int64_t> dis(1, p - 1);
 
 	hashCoefficients.reserve(t);
@@ -261,58 +267,56 @@ void initializeHashFunctions()
 	}
 }
 
+// How shingles are hashed and signed, recorded in signature stores
+string hashFamily()
+{
+	return string(useWordIds ? "word-ids" : "xxh64-words") + "/mt19937_64/p" + to_string(p);
+}
+
 //---------------------------------------------------------------------------
 // Jaccard Locality-Sensitive Hashing Algorithm
 //---------------------------------------------------------------------------
 
-// Function to process text and extract k-shingles
-void tratar(const string &texto, unordered_set<string> &kShingles)
-{
-	queue<string> palabras; // cola para tener las k palabras consecutivas
-	string word;
-	stringstream ss(texto);
-
-	while (ss >> word)
-	{ // leer palabra del stringstream
-		// quitar singnos de puntuacion y mayusculas
-		word = normalize(word);
-		if (!word.empty() && !is_stopword(word))
-		{ // Skip empty words and stopwords
-			palabras.push(word);
-			if (palabras.size() == k)
-			{ // si ya tenemos k palabras en la cola tenemos un k shingle!
-				// Optimización: construir el shingle directamente con un string estimado
-				string shingle;
-				shingle.reserve(k * 10); // Reservar espacio aproximado
-
-				queue<string> temp = palabras;
-				for (size_t i = 0; i < k; i++)
-				{
-					shingle += temp.front();
-					temp.pop();
-					if (i < k - 1)
-						shingle += " ";
-				}
+// Function to process text and extract k-shingles, stored as 64-bit keys.
+// Words are keyed by their dictionary id with --word-ids, by their xxHash
+// otherwise, and a shingle by mixing the keys of its k words
+// (common/shingler.hpp): the keys tratarMultiK gives for the same k, so a
+// --sweep-k run finds the same shingles as one run per k.
+void tratar(const string &texto, unordered_set<uint64_t> &kShingles)
+{
+	vector<uint64_t> words;
+	forEachWord(texto, [&](const string &word)
+	{
+		if (word.empty() || is_stopword(word))
+			return;
+		words.push_back(useWordIds ? dictionary.intern(word) : xxHashFunction(word));
+	});
+	forEachShingle(words, k, [&](uint64_t key) { kShingles.insert(key); });
+}
 
-				kShingles.insert(shingle);
-				// Quitamos la primera para avanzar (sliding window approach)
-				palabras.pop();
-			}
-		}
-	}
+// Shingles for every k of the shingler in one pass over the words (--sweep-k).
+// Words are keyed by their dictionary id with --word-ids, by their xxHash
+// otherwise; kShingles[i] gets the shingles for shingler.sizes()[i].
+void tratarMultiK(const string &texto, MultiShingler &shingler, vector<unordered_set<uint64_t>> &kShingles)
+{
+	shingler.reset();
+	forEachWord(texto, [&](const string &word)
+	{
+		if (word.empty() || is_stopword(word))
+			return;
+		uint64_t wordHash = useWordIds ? dictionary.intern(word) : xxHashFunction(word);
+		shingler.push(wordHash, [&](size_t i, uint64_t key) { kShingles[i].insert(key); });
+	});
 }
 
 // Improved function to compute MinHash signatures using xxHash
-vector<int> computeMinHashSignature(const unordered_set<string> &kShingles)
+vector<int> computeMinHashSignature(const unordered_set<uint64_t> &kShingles)
 {
 	vector<int> signature(t, INT_MAX);
 
 	// For each shingle in the set
-	for (const string &shingle : kShingles)
+	for (uint64_t shingleID : kShingles)
 	{
-		// Use xxHash for better distribution and performance
-		uint64_t shingleID = xxHashFunction(shingle);
-
 		// Apply each hash function
 		for (unsigned int i = 0; i < t; i++)
 		{
@@ -357,42 +361,50 @@ size_t hashBand(const vector<int> &band)
 	return hashValue;
 }
 
-void insertIntoLSHForest(const vector<int> &signature, int docIndex, int numTrees)
+// Insert a document into a single tree. Trees are independent, so each one
+// can be filled by a different thread.
+void insertIntoLSHTree(const vector<int> &signature, int docIndex, int numTrees, int t)
 {
 	// Calculate prefix length for each tree
 	int prefixLength = signature.size() / numTrees;
 	if (prefixLength == 0)
 		prefixLength = 1;
 
-	// cout << "Adding document " << docIndex << " to LSH Forest (signature size: "
-	//     << signature.size() << ", prefix length: " << prefixLength << ")" << endl;
+	// Extract the signature prefix for this tree
+	int startIdx = t * prefixLength;
+	int endIdx = min((t + 1) * prefixLength, static_cast<int>(signature.size()));
 
-	// For each tree in the forest
-	for (int t = 0; t < numTrees; t++)
-	{
-		// Extract the signature prefix for this tree
-		int startIdx = t * prefixLength;
-		int endIdx = min((t + 1) * prefixLength, static_cast<int>(signature.size()));
+	// Navigate the trie and insert document
+	LSHForestNode *currentNode = lshForest[t];
 
-		// Navigate the trie and insert document
-		LSHForestNode *currentNode = lshForest[t];
+	for (int i = startIdx; i < endIdx; i++)
+	{
+		int hashValue = signature[i];
 
-		for (int i = startIdx; i < endIdx; i++)
+		// Create path if it doesn't exist
+		LSHForestNode *&child = currentNode->children[hashValue];
+		if (child == nullptr)
 		{
-			int hashValue = signature[i];
+			child = new LSHForestNode();
+		}
 
-			// Create path if it doesn't exist
-			if (currentNode->children.find(hashValue) == currentNode->children.end())
-			{
-				currentNode->children[hashValue] = new LSHForestNode();
-			}
+		// Move to next node
+		currentNode = child;
 
-			// Move to next node
-			currentNode = currentNode->children[hashValue];
+		// Add document to each node along the path
+		currentNode->docIndices.push_back(docIndex);
+	}
+}
 
-			// Add document to each node along the path
-			currentNode->docIndices.push_back(docIndex);
-		}
+void insertIntoLSHForest(const vector<int> &signature, int docIndex, int numTrees)
+{
+	// cout << "Adding document " << docIndex << " to LSH Forest (signature size: "
+	//     << signature.size() << ")" << endl;
+
+	// For each tree in the forest
+	for (int t = 0; t < numTrees; t++)
+	{
+		insertIntoLSHTree(signature, docIndex, numTrees, t);
 	}
 }
 
@@ -412,6 +424,70 @@ void collectDocumentIndices(LSHForestNode *node, int depth, int maxDepth, unorde
 	}
 }
 
+// Candidates for a signature in one tree: the documents under the deepest
+// node matching its prefix there, down to maxDepth levels further
+void probeLSHTree(const vector<int> &signature, int numTrees, int tree, int maxDepth,
+				  unordered_set<int> &candidates)
+{
+	int prefixLength = signature.size() / numTrees;
+	if (prefixLength == 0)
+		prefixLength = 1;
+
+	// Calculate start index for this tree's prefix
+	int startIdx = tree * prefixLength;
+
+	// Navigate the trie to find matching prefix
+	LSHForestNode *currentNode = lshForest[tree];
+	int depth = 0;
+
+	// Follow exact path as far as possible
+	while (depth < prefixLength && currentNode)
+	{
+		int hashValue = signature[startIdx + depth];
+
+		auto child = currentNode->children.find(hashValue);
+		if (child != currentNode->children.end())
+		{
+			currentNode = child->second;
+			depth++;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	// Collect candidate documents at this depth and below (up to maxDepth)
+	collectDocumentIndices(currentNode, depth, depth + maxDepth, candidates);
+}
+
+// Documents whose estimated similarity with signature reaches threshold, as
+// (position in documents, similarity), most similar first. Only reads the
+// forest built for documents, so queries can run in parallel.
+vector<pair<int, float>> queryForest(const vector<Document> &documents, const vector<int> &signature,
+									 int numTrees, float threshold)
+{
+	int maxDepth = static_cast<int>((1.0 - threshold) * (signature.size() / numTrees));
+	unordered_set<int> candidates;
+	for (int tree = 0; tree < numTrees; tree++)
+	{
+		probeLSHTree(signature, numTrees, tree, maxDepth, candidates);
+	}
+
+	vector<int> sorted(candidates.begin(), candidates.end());
+	sort(sorted.begin(), sorted.end());
+	ThresholdComparator comparator(signature.size(), threshold, rejectConfidence);
+	vector<pair<int, float>> matches;
+	for (int doc : sorted)
+	{
+		if (comparator.reaches(signature, documents[doc].signature))
+			matches.push_back({doc, estimatedJaccardSimilarity(signature, documents[doc].signature)});
+	}
+	stable_sort(matches.begin(), matches.end(), [](const pair<int, float> &a, const pair<int, float> &b)
+				{ return a.second > b.second; });
+	return matches;
+}
+
 // Query the LSH Forest for similar documents (replaces findSimilarDocumentPairs)
 vector<pair<int, int>> queryLSHForest(const vector<Document> &documents, int numTrees)
 {
@@ -424,88 +500,457 @@ vector<pair<int, int>> queryLSHForest(const vector<Document> &documents, int num
 
 	// cout << "Using max depth of " << maxDepth << " for SIMILARITY_THRESHOLD " << SIMILARITY_THRESHOLD << endl;
 
-	// Set to store pairs of similar documents (to avoid duplicates)
-	set<pair<int, int>> similarPairsSet;
+	ThreadPool &pool = ThreadPool::instance();
 
-	// For each document, query the forest
-	for (size_t i = 0; i < documents.size(); i++)
+	vector<pair<int, int>> similarPairs;
 	{
-		const Document &doc = documents[i];
-		int prefixLength = doc.signature.size() / numTrees;
-		if (prefixLength == 0)
-			prefixLength = 1;
+		ProfileScope scope("candidates");
+		// Candidate pairs found by each document's query, collected in parallel
+		vector<vector<pair<int, int>>> docCandidates(documents.size());
 
-		// For each tree
-		for (int t = 0; t < numTrees; t++)
+		// For each document, query the forest
+		pool.parallelFor(0, documents.size(), [&](size_t i)
 		{
-			// Calculate start index for this tree's prefix
-			int startIdx = t * prefixLength;
+			const Document &doc = documents[i];
 
-			// Navigate the trie to find matching prefix
-			LSHForestNode *currentNode = lshForest[t];
-			int depth = 0;
-
-			// Follow exact path as far as possible
-			while (depth < prefixLength && currentNode)
+			// For each tree
+			for (int t = 0; t < numTrees; t++)
 			{
-				int hashValue = doc.signature[startIdx + depth];
+				unordered_set<int> candidates;
+				probeLSHTree(doc.signature, numTrees, t, maxDepth, candidates);
 
-				if (currentNode->children.find(hashValue) != currentNode->children.end())
+				// Generate document pairs
+				for (int docId : candidates)
 				{
-					currentNode = currentNode->children[hashValue];
-					depth++;
-				}
-				else
-				{
-					break;
+					// Skip self-comparison
+					if (docId == static_cast<int>(i))
+						continue;
+
+					// Ensure consistent ordering (smaller index first)
+					int doc1 = static_cast<int>(i);
+					int doc2 = docId;
+					if (doc1 > doc2)
+						swap(doc1, doc2);
+
+					docCandidates[i].push_back({doc1, doc2});
 				}
 			}
+		});
+
+		// Merge and drop pairs found by both documents or by several trees
+		for (auto &candidates : docCandidates)
+		{
+			similarPairs.insert(similarPairs.end(), candidates.begin(), candidates.end());
+			vector<pair<int, int>>().swap(candidates);
+		}
+		sort(similarPairs.begin(), similarPairs.end());
+		similarPairs.erase(unique(similarPairs.begin(), similarPairs.end()), similarPairs.end());
+	}
 
-			// Collect candidate documents at this depth and below (up to maxDepth)
-			unordered_set<int> candidates;
-			collectDocumentIndices(currentNode, depth, depth + maxDepth, candidates);
+	// cout << "Found " << similarPairs.size() << " candidate pairs" << endl;
+
+	// Filter pairs based on actual similarity, stopping each comparison as
+	// soon as the threshold is reached or out of reach
+	ProfileScope scope("verify");
+	ThresholdComparator comparator(documents[0].signature.size(), SIMILARITY_THRESHOLD, rejectConfidence);
+	vector<char> keep(similarPairs.size(), 0);
+	pool.parallelFor(0, similarPairs.size(), [&](size_t c)
+	{
+		keep[c] = comparator.reaches(
+			documents[similarPairs[c].first].signature,
+			documents[similarPairs[c].second].signature);
+	}, 256);
+
+	vector<pair<int, int>> filteredPairs;
+	for (size_t c = 0; c < similarPairs.size(); c++)
+	{
+		if (keep[c])
+			filteredPairs.push_back(similarPairs[c]);
+	}
 
-			// Generate document pairs
-			for (int docId : candidates)
+	return filteredPairs;
+}
+
+//---------------------------------------------------------------------------
+// Top-k queries (--top-k K, --top-pairs N)
+//---------------------------------------------------------------------------
+// LSH Forest's own nearest-neighbour search, independent of the threshold:
+// a document descends every tree along its prefix, then all the trees
+// ascend together one level at a time, gathering the documents under the
+// current nodes, until there are kCandidateFactor * K candidates. They are
+// ranked by estimated similarity with a bounded heap. When even the first
+// level of every tree holds fewer than K other documents, the document is
+// compared with the whole corpus, so every document gets exactly K
+// neighbours (or all the others in a smaller corpus).
+const size_t kCandidateFactor = 2;
+
+// Documents other than self met while ascending from signature's deepest
+// prefix nodes, stopping at the first level that yields want of them
+vector<int> forestCandidates(const vector<int> &signature, int numTrees, size_t want, int self)
+{
+	int prefixLength = signature.size() / numTrees;
+	if (prefixLength == 0)
+		prefixLength = 1;
+
+	// paths[tree][d]: node at depth d + 1 along the signature's prefix
+	vector<vector<LSHForestNode *>> paths(numTrees);
+	size_t deepest = 0;
+	for (int tree = 0; tree < numTrees; tree++)
+	{
+		LSHForestNode *currentNode = lshForest[tree];
+		int startIdx = tree * prefixLength;
+		for (int depth = 0; depth < prefixLength && startIdx + depth < static_cast<int>(signature.size()); depth++)
+		{
+			auto child = currentNode->children.find(signature[startIdx + depth]);
+			if (child == currentNode->children.end())
+				break;
+			currentNode = child->second;
+			paths[tree].push_back(currentNode);
+		}
+		deepest = max(deepest, paths[tree].size());
+	}
+
+	unordered_set<int> candidates;
+	for (size_t depth = deepest; depth >= 1; depth--)
+	{
+		for (const auto &path : paths)
+		{
+			if (path.size() < depth)
+				continue;
+			for (int doc : path[depth - 1]->docIndices)
 			{
-				// Skip self-comparison
-				if (docId == static_cast<int>(i))
-					continue;
+				if (doc != self)
+					candidates.insert(doc);
+			}
+		}
+		if (candidates.size() >= want)
+			break;
+	}
+	return vector<int>(candidates.begin(), candidates.end());
+}
+
+// The k nearest neighbours of documents[i] found through the forest,
+// closest first
+vector<Neighbour> forestNeighbours(const vector<Document> &documents, int numTrees, size_t i, size_t k)
+{
+	NeighbourHeap heap(min(k, documents.size() - 1));
+	vector<int> candidates = forestCandidates(documents[i].signature, numTrees, kCandidateFactor * k, i);
+	if (candidates.size() < min(k, documents.size() - 1))
+	{
+		// Too few documents share even one prefix value: fall back to all
+		candidates.clear();
+		for (size_t j = 0; j < documents.size(); j++)
+		{
+			if (j != i)
+				candidates.push_back(j);
+		}
+	}
+	for (int doc : candidates)
+		heap.offer({doc, estimatedJaccardSimilarity(documents[i].signature, documents[doc].signature)});
+	return heap.take();
+}
+
+vector<vector<Neighbour>> nearestNeighbours(const vector<Document> &documents, int numTrees, size_t k)
+{
+	vector<vector<Neighbour>> neighbours(documents.size());
+	ThreadPool::instance().parallelFor(0, documents.size(), [&](size_t i)
+	{
+		neighbours[i] = forestNeighbours(documents, numTrees, i, k);
+	});
+	return neighbours;
+}
 
-				// Ensure consistent ordering (smaller index first)
-				int doc1 = static_cast<int>(i);
-				int doc2 = docId;
-				if (doc1 > doc2)
-					swap(doc1, doc2);
+// The n most similar pairs, most similar first. A pair among them is among
+// the n nearest neighbours of both its documents, so each document's top n
+// is merged into a global heap, a block of documents at a time. A pair can
+// arrive from both of its documents, so the heap keeps 2n entries and the
+// duplicates (adjacent once sorted) are dropped at the end.
+vector<pair<int, int>> mostSimilarPairs(const vector<Document> &documents, int numTrees, size_t n)
+{
+	ThreadPool &pool = ThreadPool::instance();
+	PairHeap best(2 * n);
+	const size_t blockDocs = 64;
+	vector<vector<Neighbour>> found(blockDocs);
+	for (size_t block = 0; block < documents.size(); block += blockDocs)
+	{
+		size_t blockEnd = min(documents.size(), block + blockDocs);
+		pool.parallelFor(block, blockEnd, [&](size_t i)
+		{
+			found[i - block] = forestNeighbours(documents, numTrees, i, n);
+		});
 
-				similarPairsSet.insert({doc1, doc2});
+		for (size_t i = block; i < blockEnd; i++)
+		{
+			for (const Neighbour &neighbour : found[i - block])
+			{
+				int doc = static_cast<int>(i);
+				best.offer({min(doc, neighbour.doc), max(doc, neighbour.doc), neighbour.similarity});
 			}
 		}
 	}
 
-	// Convert set to vector
-	vector<pair<int, int>> similarPairs(similarPairsSet.begin(), similarPairsSet.end());
+	vector<pair<int, int>> pairs;
+	for (const ScoredPair &pair : best.take())
+	{
+		if (pairs.size() == n)
+			break;
+		if (pairs.empty() || pairs.back() != make_pair(pair.first, pair.second))
+			pairs.push_back({pair.first, pair.second});
+	}
+	return pairs;
+}
 
-	// cout << "Found " << similarPairs.size() << " candidate pairs" << endl;
+//---------------------------------------------------------------------------
+// Query server (--serve, --socket PATH)
+//---------------------------------------------------------------------------
+// The corpus is signed and planted in the forest once, then near-duplicates
+// of incoming documents are looked up on the resident trees
+// (common/server.hpp):
+//
+//   QUERY <file>  near-duplicates of a document on disk
+//   TEXT <text>   near-duplicates of the text on the rest of the line
+//
+// answered with "OK <matches> <microseconds>" followed by one
+// "<doc> <similarity>" line per match, most similar first, or "ERR <why>".
+// Documents are named as in the CSVs. With --signatures the corpus comes from
+// the store and incoming documents are signed with its seed (main adopts it).
+string answerQuery(const string &request, const vector<Document> &documents, int numTrees)
+{
+	auto start = chrono::steady_clock::now();
+	size_t space = request.find(' ');
+	string command = request.substr(0, space);
+	string argument = space == string::npos ? "" : request.substr(space + 1);
 
-	// Filter pairs based on actual similarity
-	vector<pair<int, int>> filteredPairs;
-	for (const auto &pair : similarPairs)
+	string text;
+	if (command == "QUERY")
 	{
-		float similarity = estimatedJaccardSimilarity(
-			documents[pair.first].signature,
-			documents[pair.second].signature);
+		text = readFile(argument);
+		if (text.empty())
+			return "ERR cannot read " + argument + "\n";
+	}
+	else if (command == "TEXT")
+	{
+		text = argument;
+	}
+	else
+	{
+		return "ERR unknown command " + command + "\n";
+	}
 
-		if (similarity >= SIMILARITY_THRESHOLD)
+	unordered_set<uint64_t> kShingles;
+	tratar(text, kShingles);
+	if (kShingles.empty())
+		return "ERR no shingles in the document\n";
+	vector<pair<int, float>> matches =
+		queryForest(documents, computeMinHashSignature(kShingles), numTrees, SIMILARITY_THRESHOLD);
+
+	auto elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+	stringstream out;
+	out << "OK " << matches.size() << " " << elapsed << "\n";
+	for (const auto &match : matches)
+	{
+		const string &name = documents[match.first].filename;
+		int number = extractNumber(name);
+		out << (number != -1 ? to_string(number) : name) << " " << fixed << setprecision(6) << match.second << "\n";
+	}
+	return out.str();
+}
+
+int serveQueries(const vector<Document> &documents, int numTrees, const string &socketPath)
+{
+	RequestHandler handler = [&](const string &request)
+	{ return answerQuery(request, documents, numTrees); };
+	if (socketPath.empty())
+	{
+		cerr << "Serving " << documents.size() << " documents on stdin" << endl;
+		serveStream(cin, cout, handler);
+		return 0;
+	}
+	cerr << "Serving " << documents.size() << " documents on " << socketPath << endl;
+	try
+	{
+		serveUnixSocket(socketPath, handler);
+	}
+	catch (const exception &e)
+	{
+		cerr << "Error: " << e.what() << endl;
+		return 1;
+	}
+	return 0;
+}
+
+//---------------------------------------------------------------------------
+// Batch queries (--queries DIR)
+//---------------------------------------------------------------------------
+// R x S join: the corpus S is planted in the forest as usual and every
+// document of R is signed and probed against it, so the work grows with |R|
+// and the pairs inside S (or inside R) are never compared.
+
+// Matches of every query as (query, corpus document), in query order and
+// most similar first within a query
+vector<pair<int, int>> matchQueries(const vector<Document> &corpus, const vector<Document> &queries,
+									int numTrees, float threshold)
+{
+	vector<vector<pair<int, float>>> matches(queries.size());
+	ThreadPool::instance().parallelFor(0, queries.size(), [&](size_t q)
+	{ matches[q] = queryForest(corpus, queries[q].signature, numTrees, threshold); });
+
+	vector<pair<int, int>> pairs;
+	for (size_t q = 0; q < queries.size(); q++)
+	{
+		for (const auto &match : matches[q])
 		{
-			filteredPairs.push_back(pair);
-			// cout << "Confirmed similar pair: " << documents[pair.first].filename
-			//     << " and " << documents[pair.second].filename
-			//    << " (similarity: " << similarity << ")" << endl;
+			pairs.push_back({static_cast<int>(q), match.first});
 		}
 	}
+	return pairs;
+}
 
-	return filteredPairs;
+//---------------------------------------------------------------------------
+// Index build pipeline: read -> tokenize -> sign
+//---------------------------------------------------------------------------
+// Each stage runs on its own threads and hands documents to the next one
+// through a bounded queue, so disk reads overlap with shingling and hashing.
+// A document's shingles only live from the tokenizer to the signer, so the
+// memory they take is bounded by the queue, not by the corpus.
+struct RawDocument
+{
+	size_t slot = 0; // position of the file in the corpus listing
+	string filename;
+	string content;
+};
+
+struct PendingDocument
+{
+	size_t slot = 0;
+	string filename;
+	vector<unordered_set<uint64_t>> kShingles; // One set per shingle size
+};
+
+// Element i of the result holds the documents shingled with ks[i]; every k
+// comes from the same pass over the words. An empty ks means the global k.
+vector<vector<Document>> buildDocumentSets(const vector<string> &paths, const PipelineConfig &config,
+										   const vector<int> &ks)
+{
+	const size_t sets = ks.empty() ? 1 : ks.size();
+	const vector<unsigned> sizes(ks.begin(), ks.end());
+	BoundedQueue<RawDocument> readQueue(config.queueCapacity);
+	BoundedQueue<PendingDocument> shingleQueue(config.queueCapacity);
+	// One slot per input file keeps the document order independent of the thread interleaving
+	vector<vector<optional<Document>>> slots(sets, vector<optional<Document>>(paths.size()));
+	atomic<size_t> nextPath(0);
+	vector<thread> workers;
+
+	// Stage 1: read files
+	launchStage(
+		workers, config.ioThreads, "read",
+		[&]()
+		{
+			for (size_t i = nextPath++; i < paths.size(); i = nextPath++)
+			{
+				RawDocument raw;
+				raw.slot = i;
+				raw.filename = paths[i];
+				raw.content = readFile(paths[i]);
+				readQueue.push(move(raw));
+			}
+		},
+		[&]()
+		{ readQueue.close(); });
+
+	// Stage 2: extract shingles
+	launchStage(
+		workers, config.tokenizeThreads, "shingle",
+		[&]()
+		{
+			RawDocument raw;
+			MultiShingler shingler(sizes);
+			while (readQueue.pop(raw))
+			{
+				PendingDocument pending;
+				pending.slot = raw.slot;
+				pending.filename = move(raw.filename);
+				pending.kShingles.resize(sets);
+				if (ks.empty())
+					tratar(raw.content, pending.kShingles[0]);
+				else
+					tratarMultiK(raw.content, shingler, pending.kShingles);
+				shingleQueue.push(move(pending));
+			}
+		},
+		[&]()
+		{ shingleQueue.close(); });
+
+	// Stage 3: compute MinHash signatures
+	launchStage(
+		workers, config.signThreads, "sign",
+		[&]()
+		{
+			PendingDocument pending;
+			while (shingleQueue.pop(pending))
+			{
+				for (size_t i = 0; i < sets; i++)
+				{
+					Document doc(pending.filename);
+					doc.signature = computeMinHashSignature(pending.kShingles[i]);
+					slots[i][pending.slot] = move(doc);
+				}
+			}
+		},
+		[]() {});
+
+	for (thread &worker : workers)
+	{
+		worker.join();
+	}
+
+	vector<vector<Document>> documents(sets);
+	for (size_t i = 0; i < sets; i++)
+	{
+		documents[i].reserve(paths.size());
+		for (optional<Document> &slot : slots[i])
+		{
+			if (slot)
+				documents[i].push_back(move(*slot));
+		}
+	}
+	return documents;
+}
+
+vector<Document> buildDocuments(const vector<string> &paths, const PipelineConfig &config)
+{
+	return move(buildDocumentSets(paths, config, {})[0]);
+}
+
+// Saves the signatures so later runs can skip reading and signing the corpus
+void saveSignatures(const string &path, const vector<Document> &documents)
+{
+	SignatureStoreInfo info;
+	info.k = k;
+	info.t = t;
+	info.seed = hashSeed;
+	info.hashFamily = hashFamily();
+	writeSignatureStore(path, info, documents.size(),
+		[&](size_t i) -> const string & { return documents[i].filename; },
+		[&](size_t i) -> const vector<int> & { return documents[i].signature; });
+}
+
+// Documents from a signature store instead of the corpus. The store must
+// have the same k, at least t hash functions (the first t are used), the
+// same hash family and the same seed (checkSignatureStore).
+vector<Document> loadSignatures(const string &path)
+{
+	SignatureStore store(path);
+	checkSignatureStore(path, store.info(), k, t, hashFamily(), hashSeed);
+	vector<Document> documents;
+	documents.reserve(store.size());
+	for (size_t i = 0; i < store.size(); i++)
+	{
+		Document doc(string(store.name(i)));
+		doc.signature.assign(store.row(i), store.row(i) + t);
+		documents.push_back(move(doc));
+	}
+	return documents;
 }
 
 void cleanupLSHForest()
@@ -518,6 +963,69 @@ void cleanupLSHForest()
 }
 
 // Function to write similarity results to CSV
+// Operation,Time(ms) rows from timeResults
+void writeTimesToCSV(const string &filename)
+{
+	string timeFilename = filename;
+	if (timeFilename.substr(timeFilename.length() - 4) != ".csv")
+	{
+		timeFilename += ".csv";
+	}
+
+	ofstream fileTime(timeFilename);
+	if (!fileTime.is_open())
+	{
+		cerr << "Error: Unable to open file " << timeFilename << " for writing" << endl;
+		return;
+	}
+
+	// Write header
+	fileTime << "Operation,Time(ms)" << endl;
+	fileTime << fixed << setprecision(3);  // Milliseconds to the microsecond
+
+	for (const auto &pair : timeResults)
+	{
+		fileTime << pair.first << "," << pair.second << endl;
+	}
+	if (!PerfCounters::instance().writeCSV(timeFilename))
+	{
+		cerr << "Error: Unable to write the counters next to " << timeFilename << endl;
+	}
+	if (!MemoryReport::instance().writeCSV(timeFilename))
+	{
+		cerr << "Error: Unable to write the memory report next to " << timeFilename << endl;
+	}
+
+	fileTime.close();
+}
+
+// --npy counterpart of the pair CSV: the same rows as uint32/float32
+// columns (common/npyWriter.hpp)
+void writeResultsToNpy(const string &csvFilename,
+					   const string &filename2,
+					   const vector<pair<int, int>> &similarPairs,
+					   const vector<Document> &documents)
+{
+	PairNpyWriter columns(npyBase(csvFilename));
+	if (!columns.isOpen())
+	{
+		cerr << "Error: Unable to open the .npy files of " << csvFilename << " for writing" << endl;
+		return;
+	}
+	for (const auto &pair : similarPairs)
+	{
+		columns.add(extractNumber(documents[pair.first].filename),
+					extractNumber(documents[pair.second].filename),
+					estimatedJaccardSimilarity(documents[pair.first].signature, documents[pair.second].signature));
+	}
+	if (!columns.close())
+	{
+		cerr << "Error: Could not write the .npy files of " << csvFilename << endl;
+	}
+	writeTimesToCSV(filename2);
+	cout << "Results written to " << npyBase(csvFilename) << ".{doc1,doc2,sim}.npy" << endl;
+}
+
 void writeResultsToCSV(const string &filename1,
 					   const string &filename2,
 					   const vector<pair<int, int>> &similarPairs,
@@ -530,17 +1038,24 @@ void writeResultsToCSV(const string &filename1,
 		csvFilename += ".csv";
 	}
 
-	ofstream file(csvFilename);
-	if (!file.is_open())
+	if (npyOutput)
+	{
+		writeResultsToNpy(csvFilename, filename2, similarPairs, documents);
+		return;
+	}
+
+	ResultWriter file(csvFilename);
+	if (!file.isOpen())
 	{
 		cerr << "Error: Unable to open file " << csvFilename << " for writing" << endl;
 		return;
 	}
 
 	// Write header
-	file << "Doc1,Doc2,Sim%" << endl;
+	file.append("Doc1,Doc2,Sim%\n");
 
 	// Write data rows
+	string row;
 	for (const auto &pair : similarPairs)
 	{
 		// Extract document IDs from filenames
@@ -576,38 +1091,71 @@ void writeResultsToCSV(const string &filename1,
 			documents[pair.second].signature);
 
 		// Write to CSV with fixed precision
-		file << id1 << ","
-			 << id2 << ","
-			 << fixed << setprecision(6) << estSimilarity
-			 << endl;
+		row.clear();
+		row += id1;
+		row += ',';
+		row += id2;
+		row += ',';
+		appendFixed(row, estSimilarity);
+		row += '\n';
+		file.append(row);
 	}
 
-	file.close();
+	if (!file.close())
+	{
+		cerr << "Error: Could not write " << csvFilename << endl;
+	}
 
-	// open new file to store the time results
-	string timeFilename = filename2;
-	if (timeFilename.substr(timeFilename.length() - 4) != ".csv")
+	writeTimesToCSV(filename2);
+	cout << "Results written to " << csvFilename << endl;
+}
+
+// One row per neighbour: Doc,Neighbour,Rank,Sim% with rank 1 the closest
+void writeNeighboursToCSV(const string &filename1,
+						  const string &filename2,
+						  const vector<vector<Neighbour>> &neighbours,
+						  const vector<Document> &documents)
+{
+	vector<string> ids(documents.size());
+	for (size_t i = 0; i < documents.size(); i++)
 	{
-		timeFilename += ".csv";
+		int number = extractNumber(documents[i].filename);
+		ids[i] = number != -1 ? to_string(number) : documents[i].filename;
 	}
 
-	ofstream fileTime(timeFilename);
-	if (!fileTime.is_open())
+	ResultWriter file(filename1);
+	if (!file.isOpen())
 	{
-		cerr << "Error: Unable to open file TimeResults.csv for writing" << endl;
+		cerr << "Error: Unable to open file " << filename1 << " for writing" << endl;
 		return;
 	}
 
-	// Write header
-	fileTime << "Operation,Time(ms)" << endl;
-
-	for (const auto &pair : timeResults)
+	file.append("Doc,Neighbour,Rank,Sim%\n");
+	string row;
+	for (size_t i = 0; i < neighbours.size(); i++)
 	{
-		fileTime << pair.first << "," << pair.second << endl;
+		for (size_t rank = 0; rank < neighbours[i].size(); rank++)
+		{
+			const Neighbour &neighbour = neighbours[i][rank];
+			row.clear();
+			row += ids[i];
+			row += ',';
+			row += ids[neighbour.doc];
+			row += ',';
+			appendInt(row, rank + 1);
+			row += ',';
+			appendFixed(row, neighbour.similarity);
+			row += '\n';
+			file.append(row);
+		}
+	}
+	if (!file.close())
+	{
+		cerr << "Error: Could not write " << filename1 << endl;
 	}
 
-	fileTime.close();
-	cout << "Results written to " << csvFilename << endl;
+	writeTimesToCSV(filename2);
+	cout << "Results written to " << filename1 << endl;
 }
 
 //---------------------------------------------------------------------------
@@ -624,6 +1172,117 @@ void printUsage(const char *programName)
 	cout << "  <t>: Number of hash functions" << endl;
 	cout << "  <b>: Number of bands for LSH" << endl;
 	cout << "  <sim_threshold>: Similarity threshold (0.0 to 1.0)" << endl;
+	cout << "options (after the positional arguments):" << endl;
+	cout << "  --threads N: Worker threads (default: all cores)" << endl;
+	cout << "  --io-threads N: Threads reading files (default 1)" << endl;
+	cout << "  --tokenize-threads N: Threads extracting shingles" << endl;
+	cout << "  --sign-threads N: Threads computing signatures" << endl;
+	cout << "  --queue-capacity N: Documents buffered between stages" << endl;
+	cout << "  --stopwords FILE: JSON stopword list (default: built-in list)" << endl;
+	cout << "  --word-ids: Build shingles from dictionary word ids" << endl;
+	cout << "  --seed N: Seed of the hash functions (default: clock)" << endl;
+	cout << "  --save-signatures FILE: Save the signatures to a store" << endl;
+	cout << "  --signatures FILE: Band a saved store instead of reading <corpus_dir>" << endl;
+	cout << "  --sweep-t LIST, --sweep-b LIST, --sweep-thr LIST: Run every combination in one process"
+		 << " (b may be a percentage of t, e.g. 50%)" << endl;
+	cout << "  --sweep-k LIST: Shingle once for every k in the list and run the sweep per k" << endl;
+	cout << "  --serve: Build the forest once and answer QUERY <file> / TEXT <text> lines from stdin" << endl;
+	cout << "  --socket PATH: Like --serve, on a Unix domain socket" << endl;
+	cout << "  --queries DIR: Match the files of DIR against the corpus (R x S) instead of comparing the corpus with itself"
+		 << endl;
+	cout << "  --clusters: Also write forestClusters_*.csv with the cluster and representative of every document" << endl;
+	cout << "  --csr: Also write the similarity graph as a CSR matrix, forestGraph_*.{indptr,indices,data,docs}.npy" << endl;
+	cout << "  --top-k K: Write the K most similar documents to each document (forestTopK_*.csv), whatever the threshold" << endl;
+	cout << "  --top-pairs N: Write the N most similar pairs (forestTopPairs_*.csv), whatever the threshold" << endl;
+	cout << "  --npy: Write the pairs as .npy columns (doc1, doc2, sim) instead of a CSV" << endl;
+	cout << "  --trace FILE: Write a Chrome trace of the timed stages to FILE (and their totals to FILE.stages.csv)" << endl;
+	cout << "  --perf-counters: Write hardware counters per stage (cycles, instructions, cache and branch misses) to forestCounters_*.csv" << endl;
+	cout << "  --memory: Write the estimated size of the main structures and the peak RSS per stage to forestMemory_*.csv" << endl;
+	cout << "  --reject-confidence C: Also drop candidates early with a sequential test that keeps pairs at the threshold with probability C (0 < C < 1)" << endl;
+}
+
+// Names and numbers of the documents, for the clusters and the graph
+// (common/clustering.hpp)
+DocumentIds documentIds(const vector<Document> &documents)
+{
+	DocumentIds ids;
+	ids.names.reserve(documents.size());
+	ids.numbers.reserve(documents.size());
+	for (const Document &doc : documents)
+	{
+		ids.names.push_back(doc.filename);
+		ids.numbers.push_back(extractNumber(doc.filename));
+	}
+	return ids;
+}
+
+// The similar pairs as a sparse CSR matrix (common/csrGraph.hpp, --csr)
+// weighted with the estimated similarities the CSV reports
+CsrGraph similarityGraph(const vector<Document> &documents, const vector<pair<int, int>> &pairs)
+{
+	DocumentIds ids = documentIds(documents);
+	return similarityGraph(documentRanks(ids), ids.numbers, pairs, [&](size_t p)
+	{
+		return estimatedJaccardSimilarity(documents[pairs[p].first].signature,
+										  documents[pairs[p].second].signature);
+	});
+}
+
+//---------------------------------------------------------------------------
+// Memory accounting (--memory)
+//---------------------------------------------------------------------------
+// The estimated heap bytes of the main structures once a query has run
+// (common/memoryReport.hpp): the documents, split by field, the forest
+// nodes, the pairs and, when they are written, the clusters and the graph.
+
+// Bytes of node and everything below it; nodes counts them
+size_t forestBytes(const LSHForestNode *node, size_t &nodes)
+{
+	if (!node)
+		return 0;
+	nodes++;
+	size_t bytes = allocationBytes(sizeof(LSHForestNode)) + heapBytes(node->children) + heapBytes(node->docIndices);
+	for (const auto &child : node->children)
+	{
+		bytes += forestBytes(child.second, nodes);
+	}
+	return bytes;
+}
+
+void measureStructures(const vector<Document> &documents, const vector<pair<int, int>> &pairs,
+					   const Clustering &clustering, const CsrGraph &graph)
+{
+	MemoryReport &memory = MemoryReport::instance();
+	if (!memory.isEnabled())
+		return;
+	size_t names = 0, signatures = 0;
+	for (const Document &doc : documents)
+	{
+		names += heapBytes(doc.filename);
+		signatures += heapBytes(doc.signature);
+	}
+	memory.structure("documents", documents.size(), allocationBytes(documents.capacity() * sizeof(Document)));
+	memory.structure("documents.filename", documents.size(), names);
+	memory.structure("documents.signature", documents.size(), signatures);
+
+	size_t nodes = 0, forest = heapBytes(lshForest);
+	for (const LSHForestNode *tree : lshForest)
+	{
+		forest += forestBytes(tree, nodes);
+	}
+	memory.structure("lshForest", nodes, forest);
+	memory.structure("similarPairs", pairs.size(), heapBytes(pairs));
+	if (clusterOutput)
+	{
+		memory.structure("clusters", clustering.cluster.size(),
+						 heapBytes(clustering.cluster) + heapBytes(clustering.representative));
+	}
+	if (csrOutput)
+	{
+		memory.structure("graph", graph.column.size(),
+						 heapBytes(graph.rowPointer) + heapBytes(graph.column) + heapBytes(graph.value) +
+							 heapBytes(graph.rowDocument));
+	}
 }
 
 std::string determineCategory(const std::string &inputDirectory)
@@ -639,16 +1298,117 @@ std::string determineCategory(const std::string &inputDirectory)
 	return "unknown"; // Fallback case
 }
 
+// results/<category>/forest/forest<kind>_k.._t.._b.._threshold...csv, with
+// _top<N> in place of the threshold for the top-k modes
+string resultPath(const string &category, const string &kind, int b, size_t top = 0)
+{
+	stringstream ss;
+	ss << "results/" << category << "/forest/forest" << kind << "_k" << k
+	   << "_t" << t << "_b" << b;
+	if (top > 0)
+		ss << "_top" << top; // The threshold plays no part in the top-k modes
+	else
+		ss << "_threshold" << SIMILARITY_THRESHOLD;
+	ss << ".csv";
+	return ss.str();
+}
+
+//---------------------------------------------------------------------------
+// Parameter sweep
+//---------------------------------------------------------------------------
+// Every (t, b, threshold) combination from one signing pass: the forest is
+// built once per (t, b) from signature prefixes and queried once per
+// threshold. Each combination writes the CSV pair a standalone run would,
+// with the shared reading and signing time counted in its index build.
+void runSweep(const vector<Document> &signedDocs, const SweepPlan &sweep, const string &category)
+{
+	const map<string, double> shared = timeResults;
+	for (int sweepT : sweep.ts)
+	{
+		t = sweepT;
+		vector<Document> documents;
+		documents.reserve(signedDocs.size());
+		for (const Document &signedDoc : signedDocs)
+		{
+			Document doc(signedDoc.filename);
+			doc.signature.assign(signedDoc.signature.begin(), signedDoc.signature.begin() + t);
+			documents.push_back(move(doc));
+		}
+
+		for (const string &bands : sweep.bands)
+		{
+			int b = SweepPlan::bandsFor(bands, t);
+			if (b <= 0 || b > sweepT)
+			{
+				cerr << "Warning: Skipping b=" << b << " for t=" << t << endl;
+				continue;
+			}
+			timeResults = shared;
+			{
+				Timer timerLSH("index build");
+				initializeLSHForest(b);
+				ThreadPool::instance().parallelFor(0, b, [&](size_t tree)
+				{
+					ProfileScope scope("tree insert");
+					for (size_t i = 0; i < documents.size(); i++)
+					{
+						insertIntoLSHTree(documents[i].signature, i, b, tree);
+					}
+				});
+			}
+			const map<string, double> built = timeResults;
+
+			for (float threshold : sweep.thresholds)
+			{
+				timeResults = built;
+				SIMILARITY_THRESHOLD = threshold;
+				vector<pair<int, int>> pairs;
+				{
+					Timer timerFindSimilar("query");
+					pairs = queryLSHForest(documents, b);
+				}
+				Clustering clustering;
+				if (clusterOutput)
+				{
+					Timer timerCluster("cluster");
+					clustering = clusterDocuments(documentIds(documents), pairs);
+				}
+				CsrGraph graph;
+				if (csrOutput)
+				{
+					Timer timerGraph("graph");
+					graph = similarityGraph(documents, pairs);
+				}
+				measureStructures(documents, pairs, clustering, graph);
+				timeResults["time"] = timeResults["index build"] + timeResults["query"] +
+									  (clusterOutput ? timeResults["cluster"] : 0) +
+									  (csrOutput ? timeResults["graph"] : 0);
+				writeResultsToCSV(resultPath(category, "Similarities", b),
+								  resultPath(category, "Times", b), pairs, documents);
+				if (clusterOutput)
+					writeClustersToCSV(resultPath(category, "Clusters", b), clustering, documentIds(documents));
+				if (csrOutput)
+					writeGraph(resultPath(category, "Graph", b), graph);
+			}
+		}
+	}
+	cleanupLSHForest();
+}
+
 int main(int argc, char *argv[])
 {
 	vector<Document> documents;
-	string filename1,filename2, category;
+	vector<vector<Document>> documentsPerK; // --sweep-k
+	string filename1,filename2, filename3, filename4, category;
+	Clustering clustering; // --clusters
+	CsrGraph graph;		   // --csr
+	vector<vector<Neighbour>> neighbours; // --top-k
+	size_t topK = 0, topN = 0;			  // --top-k, --top-pairs
 	{
 		Timer timerTotal("time");
-		stopwords = loadStopwords("stopwords-en.json");
-
 		// Check command line arguments
-		if (argc != 6)
+		Options opts = parseOptions(argc, argv);
+		if (opts.positional.size() != 5)
 		{
 			printUsage(argv[0]);
 			return 1;
@@ -659,16 +1419,18 @@ int main(int argc, char *argv[])
 		string path1, path2;
 		;
 
-		path1 = argv[1];
-		if (!filesystem::is_directory(path1))
+		path1 = opts.positional[0];
+		string signaturesIn = opts.get("signatures");
+		string signaturesOut = opts.get("save-signatures");
+		// With a store the directory only names the category
+		if (signaturesIn.empty() && !filesystem::is_directory(path1))
 		{
 			cerr << "Error: " << path1 << " is not a directory" << endl;
 			return 1;
 		}
-		paramOffset = 1;
 
 		// Get k value from command line
-		k = stoi(argv[1 + paramOffset]);
+		k = stoi(opts.positional[1 + paramOffset]);
 		if (k <= 0)
 		{
 			cerr << "Error: k must be positive" << endl;
@@ -676,7 +1438,7 @@ int main(int argc, char *argv[])
 		}
 
 		// Get t value from command line
-		t = stoi(argv[2 + paramOffset]);
+		t = stoi(opts.positional[2 + paramOffset]);
 		if (t <= 0)
 		{
 			cerr << "Error: t must be positive" << endl;
@@ -684,7 +1446,7 @@ int main(int argc, char *argv[])
 		}
 		
 		// Get b value from command line
-		int b = stoi(argv[3 + paramOffset]);
+		int b = stoi(opts.positional[3 + paramOffset]);
 		if (b <= 0)
 		{
 			cerr << "Error: b must be positive" << endl;
@@ -692,8 +1454,7 @@ int main(int argc, char *argv[])
 		}
 
 		// Get t value from command line
-		SIMILARITY_THRESHOLD = stof(argv[4 + paramOffset]);
-		cout << "Using " << b << " bands with threshold " << SIMILARITY_THRESHOLD << endl;
+		SIMILARITY_THRESHOLD = stof(opts.positional[4 + paramOffset]);
 		if (t <= 0)
 		{
 			cerr << "Error: similarity threshold must be positive" << endl;
@@ -703,13 +1464,157 @@ int main(int argc, char *argv[])
 		// Adjust number of bands based on threshold
 		// cout << "Using " << b << " bands with threshold " << SIMILARITY_THRESHOLD << endl;
 
+		unsigned threads;
+		try
+		{
+			threads = opts.getPositiveInt("threads", thread::hardware_concurrency());
+		}
+		catch (const exception &e)
+		{
+			cerr << "Error: " << e.what() << endl;
+			return 1;
+		}
+		ThreadPool::setThreads(threads);
+		useWordIds = opts.has("word-ids");
+		hashSeed = opts.has("seed") ? stoull(opts.get("seed"))
+									: static_cast<unsigned>(chrono::system_clock::now().time_since_epoch().count());
+		if (opts.has("stopwords"))
+		{
+			stopwords = StopwordFilter(loadStopwords(opts.get("stopwords")));
+		}
+		PipelineConfig pipeline = PipelineConfig::defaults(threads);
+		try
+		{
+			pipeline.ioThreads = opts.getPositiveInt("io-threads", pipeline.ioThreads);
+			pipeline.tokenizeThreads = opts.getPositiveInt("tokenize-threads", pipeline.tokenizeThreads);
+			pipeline.signThreads = opts.getPositiveInt("sign-threads", pipeline.signThreads);
+			pipeline.queueCapacity = opts.getPositiveInt("queue-capacity", pipeline.queueCapacity);
+		}
+		catch (const exception &e)
+		{
+			cerr << "Error: " << e.what() << endl;
+			return 1;
+		}
+
+		SweepPlan sweep;
+		try
+		{
+			sweep = parseSweep(opts, t, b, SIMILARITY_THRESHOLD);
+		}
+		catch (const exception &e)
+		{
+			cerr << "Error: Invalid sweep list: " << e.what() << endl;
+			return 1;
+		}
+		if (sweep.active)
+			t = sweep.maxT(); // Sign once for the largest t
+		if (!sweep.ks.empty() && (!signaturesIn.empty() || !signaturesOut.empty()))
+		{
+			cerr << "Error: --sweep-k cannot be combined with --signatures or --save-signatures" << endl;
+			return 1;
+		}
+		string socketPath = opts.get("socket");
+		bool serving = opts.has("serve") || !socketPath.empty();
+		// On --serve stdout carries the protocol only
+		if (!serving)
+			cout << "Using " << b << " bands with threshold " << SIMILARITY_THRESHOLD << endl;
+		if (serving && sweep.active)
+		{
+			cerr << "Error: --serve and --socket cannot be combined with --sweep-*" << endl;
+			return 1;
+		}
+		clusterOutput = opts.has("clusters");
+		csrOutput = opts.has("csr");
+		if (opts.has("reject-confidence"))
+		{
+			rejectConfidence = stod(opts.get("reject-confidence"));
+			if (rejectConfidence <= 0 || rejectConfidence >= 1)
+			{
+				cerr << "Error: --reject-confidence must be between 0 and 1" << endl;
+				return 1;
+			}
+		}
+		if (clusterOutput && serving)
+		{
+			cerr << "Error: --clusters cannot be combined with --serve or --socket" << endl;
+			return 1;
+		}
+		int topKOption = opts.getInt("top-k", 0), topPairsOption = opts.getInt("top-pairs", 0);
+		if ((opts.has("top-k") && topKOption <= 0) || (opts.has("top-pairs") && topPairsOption <= 0))
+		{
+			cerr << "Error: --top-k and --top-pairs must be positive" << endl;
+			return 1;
+		}
+		topK = topKOption;
+		topN = topPairsOption;
+		if (topK > 0 && topN > 0)
+		{
+			cerr << "Error: --top-k and --top-pairs cannot be combined" << endl;
+			return 1;
+		}
+		npyOutput = opts.has("npy");
+		string tracePath = opts.get("trace");
+		if (!tracePath.empty())
+			Profiler::instance().traceTo(tracePath);
+		if (opts.has("perf-counters"))
+			PerfCounters::instance().start();
+		if (opts.has("memory"))
+			MemoryReport::instance().enable();
+		if (npyOutput && topK > 0)
+		{
+			cerr << "Error: --npy writes pairs and cannot be combined with --top-k" << endl;
+			return 1;
+		}
+		string queryDir = opts.get("queries");
+		if ((topK > 0 || topN > 0) && (sweep.active || serving || clusterOutput || !queryDir.empty()))
+		{
+			cerr << "Error: --top-k and --top-pairs cannot be combined with --sweep-*, --serve, --socket, --clusters or --queries" << endl;
+			return 1;
+		}
+		if (csrOutput && (serving || topK > 0 || topN > 0 || !queryDir.empty()))
+		{
+			cerr << "Error: --csr cannot be combined with --serve, --socket, --top-k, --top-pairs or --queries" << endl;
+			return 1;
+		}
+		if (!queryDir.empty() && (sweep.active || serving))
+		{
+			cerr << "Error: --queries cannot be combined with --sweep-*, --serve or --socket" << endl;
+			return 1;
+		}
+		if (!queryDir.empty() && !filesystem::is_directory(queryDir))
+		{
+			cerr << "Error: " << queryDir << " is not a directory" << endl;
+			return 1;
+		}
+		if (useWordIds && !signaturesIn.empty() && (serving || !queryDir.empty()))
+		{
+			// The store does not keep the word ids, so new documents would get others
+			cerr << "Error: --word-ids with --signatures cannot sign --queries, --serve or --socket documents" << endl;
+			return 1;
+		}
+
 		// If threshold is very low, suggest using more bands
-		if (SIMILARITY_THRESHOLD < 0.1 && b < 50)
+		if (SIMILARITY_THRESHOLD < 0.1 && b < 50 && !serving)
 		{
 			cout << "Warning: For low threshold (" << SIMILARITY_THRESHOLD
 				 << "), consider using more bands (current: " << b << ")" << endl;
 		}
 
+		// A store brings its own seed, so documents signed here (--queries,
+		// --serve) get the coefficients the stored signatures were made with
+		if (!signaturesIn.empty())
+		{
+			try
+			{
+				hashSeed = storeSeed(signaturesIn, opts.has("seed"), hashSeed);
+			}
+			catch (const exception &e)
+			{
+				cerr << "Error: " << e.what() << endl;
+				return 1;
+			}
+		}
+
 		// bloque de codigo para que al finalizar se destruya el timer (y mida el tiempo automaticamente)
 		{ // Initialize hash functions
 			Timer timerInit("index build");
@@ -719,53 +1624,164 @@ int main(int argc, char *argv[])
 		// Process documents
 		
 
-		cout << "\nFormat: " << endl;
-		cout << "doc1 | doc2 | estimated_similarity" << endl;
+		// stdout carries the responses when serving on stdin
+		if (!serving)
+		{
+			cout << "\nFormat: " << endl;
+			cout << "doc1 | doc2 | estimated_similarity" << endl;
+		}
 		// Process all files in corpus directory
 		{
 			Timer timerProcessCorpus("index build");
-			// cout << "Processing files in directory: " << path1 << endl;
-
-			for (const auto &entry : filesystem::directory_iterator(path1))
+			if (!signaturesIn.empty())
 			{
-				if (entry.is_regular_file() && isFilePath(entry.path().string()))
+				try
+				{
+					documents = loadSignatures(signaturesIn);
+				}
+				catch (const exception &e)
 				{
-					string filename = entry.path().string();
-					Document doc(filename);
+					cerr << "Error: " << e.what() << endl;
+					return 1;
+				}
+			}
+			else
+			{
+				// cout << "Processing files in directory: " << path1 << endl;
 
-					// Read and process file
-					string content = readFile(filename);
-					tratar(content, doc.kShingles);
+				vector<string> paths;
+				for (const auto &entry : filesystem::directory_iterator(path1))
+				{
+					if (entry.is_regular_file() && isFilePath(entry.path().string()))
+					{
+						paths.push_back(entry.path().string());
+					}
+				}
 
-					// Compute MinHash signature
-					doc.signature = computeMinHashSignature(doc.kShingles);
+				if (!sweep.ks.empty())
+					documentsPerK = buildDocumentSets(paths, pipeline, sweep.ks);
+				else
+					documents = buildDocuments(paths, pipeline);
+			}
+		}
 
-					documents.push_back(doc);
-					// cout << "Processed: " << filename << " - " << doc.kShingles.size() << " shingles" << endl;
-				}
+		if (!sweep.ks.empty())
+		{
+			category = determineCategory(path1);
+			if (category == "unknown")
+			{
+				std::cerr << "Warning: Could not determine category from input directory!" << std::endl;
+				return 1;
+			}
+			for (size_t i = 0; i < sweep.ks.size(); i++)
+			{
+				k = sweep.ks[i];
+				runSweep(documentsPerK[i], sweep, category);
+			}
+			return 0;
+		}
+
+		if (!signaturesOut.empty())
+		{
+			try
+			{
+				saveSignatures(signaturesOut, documents);
+			}
+			catch (const exception &e)
+			{
+				cerr << "Warning: Could not save signatures: " << e.what() << endl;
+			}
+		}
+
+		if (sweep.active)
+		{
+			category = determineCategory(path1);
+			if (category == "unknown")
+			{
+				std::cerr << "Warning: Could not determine category from input directory!" << std::endl;
+				return 1;
 			}
+			runSweep(documents, sweep, category);
+			return 0;
 		}
 
 		// Initialize LSH forest
-		cout << "Initializing LSH Forest with " << b << " trees" << endl;
+		if (!serving)
+			cout << "Initializing LSH Forest with " << b << " trees" << endl;
 		initializeLSHForest(b);
 
 		{
 			// Add documents to LSH forest
+			// One tree per task
 			Timer timerLSH("index build");
-			for (size_t i = 0; i < documents.size(); i++)
+			ThreadPool::instance().parallelFor(0, b, [&](size_t tree)
 			{
-				insertIntoLSHForest(documents[i].signature, i, b);
-			}
+				ProfileScope scope("tree insert");
+				for (size_t i = 0; i < documents.size(); i++)
+				{
+					insertIntoLSHTree(documents[i].signature, i, b, tree);
+				}
+			});
 		}
 
+		if (serving)
+		{
+			int status = serveQueries(documents, b, socketPath);
+			cleanupLSHForest();
+			return status;
+		}
+
+		if (!queryDir.empty())
+		{
+			// Sign the queries and probe the forest with them; they go after
+			// the corpus in the document list the CSV writer indexes
+			Timer timerFindSimilar("query");
+			vector<string> paths;
+			for (const auto &entry : filesystem::directory_iterator(queryDir))
+			{
+				if (entry.is_regular_file() && isFilePath(entry.path().string()))
+				{
+					paths.push_back(entry.path().string());
+				}
+			}
+			vector<Document> queries = buildDocuments(paths, pipeline);
+			similarPairs = matchQueries(documents, queries, b, SIMILARITY_THRESHOLD);
+			size_t offset = documents.size();
+			for (Document &query : queries)
+				documents.push_back(move(query));
+			for (auto &pair : similarPairs)
+				pair.first += offset;
+		}
+		else if (topK > 0)
+		{
+			Timer timerFindSimilar("query");
+			neighbours = nearestNeighbours(documents, b, topK);
+		}
+		else if (topN > 0)
+		{
+			// Most similar first; the CSV writer keeps the order
+			Timer timerFindSimilar("query");
+			similarPairs = mostSimilarPairs(documents, b, topN);
+		}
+		else
 		{
 			// Find similar document pairs
 			Timer timerFindSimilar("query");
 			similarPairs = queryLSHForest(documents, b);
 		}
+		if (clusterOutput)
+		{
+			Timer timerCluster("cluster");
+			clustering = clusterDocuments(documentIds(documents), similarPairs);
+		}
+		if (csrOutput)
+		{
+			Timer timerGraph("graph");
+			graph = similarityGraph(documents, similarPairs);
+		}
+		measureStructures(documents, similarPairs, clustering, graph);
 
-		category = determineCategory(argv[1]);
+		category = determineCategory(path1);
 
 		// Ensure the category is valid
 		if (category == "unknown")
@@ -777,24 +1793,23 @@ int main(int argc, char *argv[])
 		// Report results
 		// cout << "\nFound " << similarPairs.size() << " similar document pairs:" << endl;
 		// Construct filename using a stringstream
-		std::stringstream ss;
-		ss << "results/" << category << "/forest/forestSimilarities_k" << k
-		<< "_t" << t
-		<< "_b" << b
-		   << "_threshold" << SIMILARITY_THRESHOLD << ".csv";
-
-		filename1 = ss.str();
-
-		// Generate the second filename with the same structure (e.g., for time measurements)
-		std::stringstream ss2;
-		ss2 << "results/" << category << "/forest/forestTimes_k" << k
-		<< "_t" << t
-		<< "_b" << b
-			<< "_threshold" << SIMILARITY_THRESHOLD << ".csv";
-
-		filename2 = ss2.str();
+		string prefix = !queryDir.empty() ? "Query" : topK > 0 ? "TopK" : topN > 0 ? "TopPairs" : "";
+		string kind = topK > 0 || topN > 0 ? prefix : prefix + "Similarities";
+		filename1 = resultPath(category, kind, b, topK + topN);
+
+		// Second file with the same structure, for the time measurements
+		filename2 = resultPath(category, prefix + "Times", b, topK + topN);
+		filename3 = resultPath(category, prefix + "Clusters", b);
+		filename4 = resultPath(category, "Graph", b);
 	}
-	writeResultsToCSV(filename1, filename2, similarPairs, documents);
+	if (topK > 0)
+		writeNeighboursToCSV(filename1, filename2, neighbours, documents);
+	else
+		writeResultsToCSV(filename1, filename2, similarPairs, documents);
+	if (clusterOutput)
+		writeClustersToCSV(filename3, clustering, documentIds(documents));
+	if (csrOutput)
+		writeGraph(filename4, graph);
 
 	return 0;
 }
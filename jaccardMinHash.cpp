@@ -8,10 +8,27 @@
 #include <climits>
 #include <cctype>
 #include <fstream>
+#include <iomanip>
 #include <chrono>
 #include <cmath>
 #include <filesystem>
 #include <regex>
+#include <optional>
+#include <thread>
+#include "common/dictionary.hpp"
+#include "common/npyWriter.hpp"
+#include "common/options.hpp"
+#include "common/memoryReport.hpp"
+#include "common/perfCounters.hpp"
+#include "common/profiler.hpp"
+#include "common/resultWriter.hpp"
+#include "common/shingler.hpp"
+#include "common/signatureStore.hpp"
+#include "common/sweep.hpp"
+#include "common/stopwords.hpp"
+#include "common/threadPool.hpp"
+#include "common/tokenizer.hpp"
+#include "common/topK.hpp"
 #include "deps/nlohmann/json.hpp"
 
 using namespace std;
@@ -22,14 +39,18 @@ unsigned int k;                          // Size of k-shingles
 int t;                                   // Number of hash functions for minhash (now configurable)
 vector<pair<int, int>> hashCoefficients; // [a, b] for hashFunction(x) = (ax + b) % p
 int p;                                   // Prime number for hash functions
-unordered_set<string> stopwords;         // Stopwords
-map<string, int> timeResults;            // Map to store execution times
+uint64_t hashSeed;                       // Seed of the coefficients (--seed)
+StopwordFilter stopwords;                // Stopwords
+bool useWordIds = false;                 // Shingles from word ids (--word-ids)
+bool npyOutput = false;                  // Pairs as .npy columns (--npy)
+WordDictionary dictionary;               // Word -> id, shared by all documents
+map<string, double> timeResults;            // Map to store execution times
 
 // Document structure to store document information
 struct Document
 {
     string filename;
-    unordered_set<string> kShingles;
+    unordered_set<uint64_t> kShingles;
     vector<int> signature;
 
     Document(const string &name) : filename(name) {}
@@ -40,29 +61,21 @@ struct Document
 class Timer
 {
 private:
-  chrono::high_resolution_clock::time_point startTime;
+  ProfileScope scope;  // Also the scope of the trace (common/profiler.hpp)
+  StageCounters counters;  // --perf-counters (common/perfCounters.hpp)
+  StageMemory memory;  // --memory (common/memoryReport.hpp)
   string operationName;
 
 public:
-  Timer(const string &name) : operationName(name)
-  {
-    startTime = chrono::high_resolution_clock::now();
-  }
+  Timer(const string &name)
+    : scope(Profiler::instance().intern(name)),
+      counters(Profiler::instance().intern(name)),
+      memory(Profiler::instance().intern(name)),
+      operationName(name) {}
 
   ~Timer()
   {
-    auto endTime = chrono::high_resolution_clock::now();
-    auto duration =
-        chrono::duration_cast<chrono::milliseconds>(endTime - startTime)
-            .count();
-    if (timeResults.count(operationName) == 0)
-    {
-      timeResults[operationName] = duration;
-    }
-    else
-    {
-      timeResults[operationName] += duration;
-    }
+    timeResults[operationName] += scope.elapsedMs();
   }
 };
 
@@ -83,7 +96,7 @@ int extractNumber(const std::string &filename)
 // Check if a word is a stopword
 bool is_stopword(const string &word)
 {
-    return stopwords.find(word) != stopwords.end();
+    return stopwords.contains(word);
 }
 
 // load stopwords from a file into stopword set
@@ -112,21 +125,6 @@ unordered_set<string> loadStopwords(const string &filename)
 
 // Format Zone ----------------------------------------------------------------------------
 
-// Remove punctuation and convert to lowercase
-string normalize(const string &word)
-{
-    string result;
-    result.reserve(word.length());
-    for (char c : word)
-    {
-        if (isalpha(c))
-        {
-            result += tolower(c);
-        }
-    }
-    return result;
-}
-
 // Function to read text from a file
 string readFromFile(const string &filename)
 {
@@ -208,9 +206,8 @@ void initializeHashFunctions()
 {
     p = nextPrime(10000); // A prime number larger than maximum possible shingle ID
 
-    // Use a time-based seed for better randomness
-    unsigned seed = chrono::system_clock::now().time_since_epoch().count();
-    mt19937 gen(seed);
+    // Seeded from --seed (the clock by default) so runs can be reproduced
+    mt19937 gen(hashSeed);
     uniform_int_distribution<> dis(1, p - 1);
 
     hashCoefficients.reserve(t);
@@ -220,58 +217,82 @@ void initializeHashFunctions()
     }
 }
 
-// Function to process text and extract k-shingles
-void tratar(const string &texto, unordered_set<string> &kShingles)
+// How shingles are hashed and signed, recorded in signature stores
+string hashFamily()
 {
-    queue<string> palabras; // queue to hold k consecutive words
-    string word;
-    stringstream ss(texto);
+    return string(useWordIds ? "word-ids" : "std-hash-words") + "/mt19937/p" + to_string(p);
+}
 
-    while (ss >> word)
-    {
-        // Remove punctuation and convert to lowercase
-        word = normalize(word);
-        if (!is_stopword(word))
-        {
-            if (word.empty())
-                continue; // Skip empty words after normalization
+// Saves the signatures so later runs can skip reading and signing the corpus
+void saveSignatures(const string &path, const vector<pair<string, vector<int>>> &signatures)
+{
+    SignatureStoreInfo info;
+    info.k = k;
+    info.t = t;
+    info.seed = hashSeed;
+    info.hashFamily = hashFamily();
+    writeSignatureStore(path, info, signatures.size(),
+        [&](size_t i) -> const string & { return signatures[i].first; },
+        [&](size_t i) -> const vector<int> & { return signatures[i].second; });
+}
 
-            palabras.push(word);
-            if (palabras.size() == k)
-            { // If we have k words in the queue, we have a k-shingle!
-                // Optimization: build the shingle directly with an estimated string size
-                string shingle;
-                shingle.reserve(k * 10); // Reserve approximate space
+// Signatures from a store instead of the corpus. The store must have the
+// same k, at least t hash functions (the first t are used), the same hash
+// family and the same seed (checkSignatureStore).
+vector<pair<string, vector<int>>> loadSignatures(const string &path)
+{
+    SignatureStore store(path);
+    checkSignatureStore(path, store.info(), k, t, hashFamily(), hashSeed);
+    vector<pair<string, vector<int>>> signatures(store.size());
+    for (size_t i = 0; i < store.size(); i++)
+    {
+        signatures[i].first = string(store.name(i));
+        signatures[i].second.assign(store.row(i), store.row(i) + t);
+    }
+    return signatures;
+}
 
-                queue<string> temp = palabras;
-                for (size_t i = 0; i < k; i++)
-                {
-                    shingle += temp.front();
-                    temp.pop();
-                    if (i < k - 1)
-                        shingle += " ";
-                }
+// Function to process text and extract k-shingles, stored as 64-bit keys.
+// Words are keyed by their dictionary id with --word-ids, by their hash
+// otherwise, and a shingle by mixing the keys of its k words
+// (common/shingler.hpp): the keys tratarMultiK gives for the same k, so a
+// --sweep-k run finds the same shingles as one run per k.
+void tratar(const string &texto, unordered_set<uint64_t> &kShingles)
+{
+    vector<uint64_t> words;
+    forEachWord(texto, [&](const string &word)
+    {
+        if (word.empty() || is_stopword(word))
+            return;
+        words.push_back(useWordIds ? dictionary.intern(word) : hash<string>{}(word));
+    });
+    forEachShingle(words, k, [&](uint64_t key) { kShingles.insert(key); });
+}
 
-                kShingles.insert(shingle);
-                // Remove the first word to advance (sliding window approach)
-                palabras.pop();
-            }
-        }
-    }
+// Shingles for every k of the shingler in one pass over the words (--sweep-k).
+// Words are keyed by their dictionary id with --word-ids, by their hash
+// otherwise; kShingles[i] gets the shingles for shingler.sizes()[i].
+void tratarMultiK(const string &texto, MultiShingler &shingler, vector<unordered_set<uint64_t>> &kShingles)
+{
+    shingler.reset();
+    forEachWord(texto, [&](const string &word)
+    {
+        if (word.empty() || is_stopword(word))
+            return;
+        uint64_t wordHash = useWordIds ? dictionary.intern(word) : hash<string>{}(word);
+        shingler.push(wordHash, [&](size_t i, uint64_t key) { kShingles[i].insert(key); });
+    });
 }
 
 // Function to compute MinHash signatures
-vector<int> computeMinHashSignature(const unordered_set<string> &kShingles)
+vector<int> computeMinHashSignature(const unordered_set<uint64_t> &kShingles)
 {
     vector<int> signature(t, INT_MAX);
 
-    // Cache hash values to avoid recomputation
-    hash<string> hasher;
-
     // For each shingle in the set
-    for (const string &shingle : kShingles)
+    for (uint64_t key : kShingles)
     {
-        int shingleID = hasher(shingle); // Convert shingle to a unique integer
+        int shingleID = static_cast<int>(key); // Shingle as an integer
 
         // Apply each hash function
         for (int i = 0; i < t; i++)
@@ -306,6 +327,102 @@ float SimilaridadDeJaccard(const vector<int> &signature1, const vector<int> &sig
     return static_cast<float>(iguales) / t;
 }
 
+// Operation,Time(ms) rows from timeResults
+void writeTimesToCSV(const string &filename)
+{
+    string timeFilename = filename;
+    if (timeFilename.substr(timeFilename.length() - 4) != ".csv")
+    {
+        timeFilename += ".csv";
+    }
+
+    // Create directory if it doesn't exist
+    fs::path timePath(timeFilename);
+    if (!fs::exists(timePath.parent_path()))
+    {
+        fs::create_directories(timePath.parent_path());
+    }
+
+    ofstream fileTime(timeFilename);
+    if (!fileTime.is_open())
+    {
+        cerr << "Error: Unable to open file " << timeFilename << " for writing" << endl;
+        return;
+    }
+
+    // Write header
+    fileTime << "Operation,Time(ms)" << endl;
+    fileTime << fixed << setprecision(3);  // Milliseconds to the microsecond
+
+    for (const auto &pair : timeResults)
+    {
+        fileTime << pair.first << "," << pair.second << endl;
+    }
+    if (!PerfCounters::instance().writeCSV(timeFilename))
+    {
+        cerr << "Error: Unable to write the counters next to " << timeFilename << endl;
+    }
+    if (!MemoryReport::instance().writeCSV(timeFilename))
+    {
+        cerr << "Error: Unable to write the memory report next to " << timeFilename << endl;
+    }
+
+    fileTime.close();
+}
+
+// --npy counterpart of the all-pairs CSV: the same rows as uint32/float32
+// columns (common/npyWriter.hpp). Each row of a block fills a vector of
+// similarities in parallel; the document numbers follow from the indices.
+void writeResultsToNpy(const string &csvFilename,
+                       const string &filename2,
+                       const vector<pair<string, vector<int>>> &signatures)
+{
+    PairNpyWriter file(npyBase(csvFilename));
+    if (!file.isOpen())
+    {
+        cerr << "Error: Unable to open the .npy files of " << csvFilename << " for writing" << endl;
+        return;
+    }
+
+    vector<int> docNums(signatures.size());
+    for (size_t i = 0; i < signatures.size(); i++)
+    {
+        docNums[i] = extractNumber(fs::path(signatures[i].first).filename().string());
+    }
+
+    ThreadPool &pool = ThreadPool::instance();
+    const size_t blockRows = 64;
+    vector<vector<float>> rows(blockRows);
+    for (size_t block = 0; block < signatures.size(); block += blockRows)
+    {
+        size_t blockEnd = min(signatures.size(), block + blockRows);
+        pool.parallelFor(block, blockEnd, [&](size_t i)
+        {
+            vector<float> &row = rows[i - block];
+            row.clear();
+            for (size_t j = i + 1; j < signatures.size(); j++)
+            {
+                row.push_back(SimilaridadDeJaccard(signatures[i].second, signatures[j].second));
+            }
+        });
+
+        for (size_t i = block; i < blockEnd; i++)
+        {
+            for (size_t j = i + 1; j < signatures.size(); j++)
+            {
+                file.add(docNums[i], docNums[j], rows[i - block][j - i - 1]);
+            }
+        }
+    }
+
+    if (!file.close())
+    {
+        cerr << "Error: Could not write the .npy files of " << csvFilename << endl;
+    }
+    writeTimesToCSV(filename2);
+    cout << "Results written to " << npyBase(csvFilename) << ".{doc1,doc2,sim}.npy" << endl;
+}
+
 void writeResultsToCSV(const string &filename1,
                        const string &filename2,
                        const vector<pair<string, vector<int>>> &signatures)
@@ -324,76 +441,251 @@ void writeResultsToCSV(const string &filename1,
         fs::create_directories(csvPath.parent_path());
     }
 
-    ofstream file(csvFilename);
-    if (!file.is_open())
+    if (npyOutput)
+    {
+        writeResultsToNpy(csvFilename, filename2, signatures);
+        return;
+    }
+
+    ResultWriter file(csvFilename);
+    if (!file.isOpen())
     {
         cerr << "Error: Unable to open file " << csvFilename << " for writing" << endl;
         return;
     }
 
     // Write header
-    file << "Doc1,Doc2,Sim%" << endl;
+    file.append("Doc1,Doc2,Sim%\n");
 
-    // Write data rows - compare all pairs
+    // Document numbers only depend on the file, not on the pair
+    vector<int> docNums(signatures.size());
     for (size_t i = 0; i < signatures.size(); i++)
     {
-        for (size_t j = i + 1; j < signatures.size(); j++)
+        docNums[i] = extractNumber(fs::path(signatures[i].first).filename().string());
+    }
+
+    // Write data rows - compare all pairs. Rows are computed in parallel a
+    // block at a time and written in order; the strings keep their capacity
+    // from one block to the next, and the writer thread saves the previous
+    // block while the next one is computed.
+    ThreadPool &pool = ThreadPool::instance();
+    const size_t blockRows = 64;
+    vector<string> rows(blockRows);
+    for (size_t block = 0; block < signatures.size(); block += blockRows)
+    {
+        size_t blockEnd = min(signatures.size(), block + blockRows);
+        pool.parallelFor(block, blockEnd, [&](size_t i)
         {
-            // Extract document paths
-            string doc1 = signatures[i].first;
-            string doc2 = signatures[j].first;
+            string &row = rows[i - block];
+            row.clear();
+            for (size_t j = i + 1; j < signatures.size(); j++)
+            {
+                // Calculate similarities
+                float similarity = SimilaridadDeJaccard(signatures[i].second, signatures[j].second);
+
+                // Write to CSV with fixed precision
+                appendInt(row, docNums[i]);
+                row += ',';
+                appendInt(row, docNums[j]);
+                row += ',';
+                appendFixed(row, similarity);
+                row += '\n';
+            }
+        });
 
-            // Extract document number from filename
-            string fileA = fs::path(doc1).filename().string();
-            string fileB = fs::path(doc2).filename().string();
+        for (size_t i = block; i < blockEnd; i++)
+        {
+            file.append(rows[i - block]);
+        }
+    }
 
-            int docNum1 = extractNumber(fileA);
-            int docNum2 = extractNumber(fileB);
+    if (!file.close())
+    {
+        cerr << "Error: Could not write " << csvFilename << endl;
+    }
+
+    writeTimesToCSV(filename2);
+    cout << "Results written to " << csvFilename << endl;
+}
 
-            // Calculate similarities
-            float similarity = SimilaridadDeJaccard(signatures[i].second, signatures[j].second);
+//---------------------------------------------------------------------------
+// Top-k queries (--top-k K, --top-pairs N)
+//---------------------------------------------------------------------------
+// Instead of every pair, the K most similar documents to each document or
+// the N most similar pairs of the corpus, selected with bounded heaps while
+// the pairs are compared, so the output is O(n K) or O(N) rows.
+
+// The k nearest neighbours of every document, closest first. Each row
+// compares its document with all the others and owns its heap, so rows run
+// in parallel without sharing state (every pair is compared from both
+// sides).
+vector<vector<Neighbour>> nearestNeighbours(const vector<pair<string, vector<int>>> &signatures, size_t k)
+{
+    vector<vector<Neighbour>> neighbours(signatures.size());
+    ThreadPool::instance().parallelFor(0, signatures.size(), [&](size_t i)
+    {
+        NeighbourHeap heap(min(k, signatures.size() - 1));
+        for (size_t j = 0; j < signatures.size(); j++)
+        {
+            if (j == i)
+                continue;
+            heap.offer({static_cast<int>(j), SimilaridadDeJaccard(signatures[i].second, signatures[j].second)});
+        }
+        neighbours[i] = heap.take();
+    });
+    return neighbours;
+}
+
+// The n most similar pairs (i < j), most similar first. Rows are scanned in
+// parallel a block at a time into heaps of their own, merged into the
+// global heap between blocks; a row skips pairs the global heap would
+// already reject.
+vector<ScoredPair> mostSimilarPairs(const vector<pair<string, vector<int>>> &signatures, size_t n)
+{
+    ThreadPool &pool = ThreadPool::instance();
+    PairHeap best(n);
+    const size_t blockRows = 64;
+    vector<vector<ScoredPair>> rows(blockRows);
+    for (size_t block = 0; block < signatures.size(); block += blockRows)
+    {
+        size_t blockEnd = min(signatures.size(), block + blockRows);
+        pool.parallelFor(block, blockEnd, [&](size_t i)
+        {
+            PairHeap row(n);
+            for (size_t j = i + 1; j < signatures.size(); j++)
+            {
+                ScoredPair pair{static_cast<int>(i), static_cast<int>(j),
+                                SimilaridadDeJaccard(signatures[i].second, signatures[j].second)};
+                if (best.admits(pair))
+                    row.offer(pair);
+            }
+            rows[i - block] = row.take();
+        });
 
-            // Write to CSV with fixed precision
-            file << docNum1 << ","
-                 << docNum2 << ","
-                 << fixed << setprecision(6) << similarity
-                 << endl;
+        for (size_t i = block; i < blockEnd; i++)
+        {
+            for (const ScoredPair &pair : rows[i - block])
+                best.offer(pair);
         }
     }
+    return best.take();
+}
 
-    file.close();
+// One row per neighbour: Doc,Neighbour,Rank,Sim% with rank 1 the closest
+void writeNeighboursToCSV(const string &filename1,
+                          const string &filename2,
+                          const vector<vector<Neighbour>> &neighbours,
+                          const vector<pair<string, vector<int>>> &signatures)
+{
+    fs::path csvPath(filename1);
+    if (!fs::exists(csvPath.parent_path()))
+    {
+        fs::create_directories(csvPath.parent_path());
+    }
 
-    // Open new file to store the time results
-    string timeFilename = filename2;
-    if (timeFilename.substr(timeFilename.length() - 4) != ".csv")
+    ResultWriter file(filename1);
+    if (!file.isOpen())
     {
-        timeFilename += ".csv";
+        cerr << "Error: Unable to open file " << filename1 << " for writing" << endl;
+        return;
     }
 
-    // Create directory if it doesn't exist
-    fs::path timePath(timeFilename);
-    if (!fs::exists(timePath.parent_path()))
+    vector<int> docNums(signatures.size());
+    for (size_t i = 0; i < signatures.size(); i++)
     {
-        fs::create_directories(timePath.parent_path());
+        docNums[i] = extractNumber(fs::path(signatures[i].first).filename().string());
     }
 
-    ofstream fileTime(timeFilename);
-    if (!fileTime.is_open())
+    file.append("Doc,Neighbour,Rank,Sim%\n");
+    string row;
+    for (size_t i = 0; i < neighbours.size(); i++)
     {
-        cerr << "Error: Unable to open file " << timeFilename << " for writing" << endl;
+        for (size_t rank = 0; rank < neighbours[i].size(); rank++)
+        {
+            const Neighbour &neighbour = neighbours[i][rank];
+            row.clear();
+            appendInt(row, docNums[i]);
+            row += ',';
+            appendInt(row, docNums[neighbour.doc]);
+            row += ',';
+            appendInt(row, rank + 1);
+            row += ',';
+            appendFixed(row, neighbour.similarity);
+            row += '\n';
+            file.append(row);
+        }
+    }
+    if (!file.close())
+    {
+        cerr << "Error: Could not write " << filename1 << endl;
+    }
+
+    writeTimesToCSV(filename2);
+    cout << "Results written to " << filename1 << endl;
+}
+
+// Same columns as the all-pairs CSV, most similar pair first
+void writePairsToCSV(const string &filename1,
+                     const string &filename2,
+                     const vector<ScoredPair> &pairs,
+                     const vector<pair<string, vector<int>>> &signatures)
+{
+    fs::path csvPath(filename1);
+    if (!fs::exists(csvPath.parent_path()))
+    {
+        fs::create_directories(csvPath.parent_path());
+    }
+
+    if (npyOutput)
+    {
+        PairNpyWriter columns(npyBase(filename1));
+        if (!columns.isOpen())
+        {
+            cerr << "Error: Unable to open the .npy files of " << filename1 << " for writing" << endl;
+            return;
+        }
+        for (const ScoredPair &pair : pairs)
+        {
+            columns.add(extractNumber(fs::path(signatures[pair.first].first).filename().string()),
+                        extractNumber(fs::path(signatures[pair.second].first).filename().string()),
+                        pair.similarity);
+        }
+        if (!columns.close())
+        {
+            cerr << "Error: Could not write the .npy files of " << filename1 << endl;
+        }
+        writeTimesToCSV(filename2);
+        cout << "Results written to " << npyBase(filename1) << ".{doc1,doc2,sim}.npy" << endl;
         return;
     }
 
-    // Write header
-    fileTime << "Operation,Time(ms)" << endl;
+    ResultWriter file(filename1);
+    if (!file.isOpen())
+    {
+        cerr << "Error: Unable to open file " << filename1 << " for writing" << endl;
+        return;
+    }
 
-    for (const auto &pair : timeResults)
+    file.append("Doc1,Doc2,Sim%\n");
+    string row;
+    for (const ScoredPair &pair : pairs)
     {
-        fileTime << pair.first << "," << pair.second << endl;
+        row.clear();
+        appendInt(row, extractNumber(fs::path(signatures[pair.first].first).filename().string()));
+        row += ',';
+        appendInt(row, extractNumber(fs::path(signatures[pair.second].first).filename().string()));
+        row += ',';
+        appendFixed(row, pair.similarity);
+        row += '\n';
+        file.append(row);
+    }
+    if (!file.close())
+    {
+        cerr << "Error: Could not write " << filename1 << endl;
     }
 
-    fileTime.close();
-    cout << "Results written to " << csvFilename << endl;
+    writeTimesToCSV(filename2);
+    cout << "Results written to " << filename1 << endl;
 }
 
 std::string determineCategory(const std::string &inputDirectory)
@@ -409,6 +701,86 @@ std::string determineCategory(const std::string &inputDirectory)
     return "unknown"; // Fallback case
 }
 
+// results/<category>/MinHash/MinHash<kind>_k.._t...csv, with _top<N> for
+// the top-k modes
+string resultPath(const string &category, const string &kind, size_t top = 0)
+{
+    std::stringstream ss;
+    ss << "results/" << category << "/MinHash/MinHash" << kind << "_k" << k
+       << "_t" << t;
+    if (top > 0)
+        ss << "_top" << top;
+    ss << ".csv";
+    return ss.str();
+}
+
+// Parameter sweep: every t from one signing pass at the largest t, using
+// signature prefixes. Each t writes the CSV pair a standalone run would,
+// with the shared reading and signing time in its index build.
+void runSweep(const vector<pair<string, vector<int>>> &signedFiles, const SweepPlan &sweep,
+              const string &category)
+{
+    const map<string, double> shared = timeResults;
+    for (int sweepT : sweep.ts)
+    {
+        t = sweepT;
+        vector<pair<string, vector<int>>> signatures;
+        signatures.reserve(signedFiles.size());
+        for (const auto &entry : signedFiles)
+        {
+            signatures.push_back({entry.first, vector<int>(entry.second.begin(), entry.second.begin() + t)});
+        }
+        timeResults = shared;
+        timeResults["time"] = timeResults["index build"];
+        writeResultsToCSV(resultPath(category, "Similarities"), resultPath(category, "Times"), signatures);
+    }
+}
+
+// Reads and signs every file once for all the k values of --sweep-k;
+// element i holds the signatures for ks[i], in file order
+vector<vector<pair<string, vector<int>>>> signFilesMultiK(const vector<string> &files, const vector<int> &ks)
+{
+    const vector<unsigned> sizes(ks.begin(), ks.end());
+    vector<vector<optional<vector<int>>>> slots(ks.size(), vector<optional<vector<int>>>(files.size()));
+    ThreadPool::instance().parallelFor(0, files.size(), [&](size_t f)
+    {
+        const string &file = files[f];
+        string text = readFile(file);
+
+        if (text.empty())
+        {
+            std::cerr << "Warning: File " << file << " is empty or could not be read. Skipping." << std::endl;
+            return;
+        }
+
+        MultiShingler shingler(sizes);
+        vector<unordered_set<uint64_t>> kShingles(ks.size());
+        tratarMultiK(text, shingler, kShingles);
+
+        for (size_t i = 0; i < ks.size(); i++)
+        {
+            if (kShingles[i].empty())
+            {
+                std::cerr << "Warning: No k-shingles could be extracted from file " << file
+                          << " with k=" << ks[i] << ". Skipping." << std::endl;
+                continue;
+            }
+            slots[i][f] = computeMinHashSignature(kShingles[i]);
+        }
+    });
+
+    vector<vector<pair<string, vector<int>>>> signatures(ks.size());
+    for (size_t i = 0; i < ks.size(); i++)
+    {
+        for (size_t f = 0; f < files.size(); f++)
+        {
+            if (slots[i][f])
+                signatures[i].push_back({files[f], move(*slots[i][f])});
+        }
+    }
+    return signatures;
+}
+
 //-------------------------------------------------------------------------------------------
 
 // Function to check if a file is a text file
@@ -421,23 +793,55 @@ bool isTextFile(const string &filename)
 int main(int argc, char *argv[])
 {
     vector<pair<string, vector<int>>> signatures;
+    vector<vector<pair<string, vector<int>>>> signaturesPerK; // --sweep-k
+    vector<vector<Neighbour>> neighbours;                     // --top-k
+    vector<ScoredPair> topPairs;                              // --top-pairs
+    size_t topK = 0, topN = 0;
     string filename2,filename1, category;
     auto startTime = chrono::high_resolution_clock::now();
     {
         Timer timerStopwords("time");
-        stopwords = loadStopwords("stopwords-en.json");
-
-        if (argc != 4)
+        Options opts = parseOptions(argc, argv);
+        if (opts.positional.size() != 3)
         {
-            std::cout << "Usage: " << argv[0] << " <directory> <k> <t>" << std::endl;
+            std::cout << "Usage: " << argv[0] << " <directory> <k> <t> [--threads N] [--stopwords FILE] [--word-ids]"
+                      << " [--seed N] [--save-signatures FILE] [--signatures FILE] [--sweep-k LIST] [--sweep-t LIST]"
+                      << " [--top-k K] [--top-pairs N] [--npy] [--trace FILE] [--perf-counters] [--memory]" << std::endl;
             std::cout << "where k is the shingle size and t is the number of hash functions" << std::endl;
+            std::cout << "--signatures reads a store saved with --save-signatures instead of <directory>" << std::endl;
+            std::cout << "--sweep-t 100,200,... writes the results for every t from one signing pass" << std::endl;
+            std::cout << "--sweep-k 1,2,3,... does the same for every k from one shingling pass" << std::endl;
+            std::cout << "--top-k K writes the K most similar documents to each document instead of every pair" << std::endl;
+            std::cout << "--top-pairs N writes the N most similar pairs instead of every pair" << std::endl;
+            std::cout << "--npy writes the pairs as .npy columns (doc1, doc2, sim) instead of a CSV" << std::endl;
+            std::cout << "--trace FILE writes a Chrome trace of the timed stages to FILE" << std::endl;
+            std::cout << "--perf-counters writes hardware counters per stage to a Counters CSV next to the times" << std::endl;
+            std::cout << "--memory writes the size of the signatures and the peak RSS per stage to a Memory CSV next to the times" << std::endl;
             return 1;
         }
 
-        string directory = argv[1];
+        string directory = opts.positional[0];
+        try
+        {
+            ThreadPool::setThreads(opts.getPositiveInt("threads", thread::hardware_concurrency()));
+        }
+        catch (const exception &e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        useWordIds = opts.has("word-ids");
+        hashSeed = opts.has("seed") ? stoull(opts.get("seed"))
+                                    : static_cast<unsigned>(chrono::system_clock::now().time_since_epoch().count());
+        string signaturesIn = opts.get("signatures");
+        string signaturesOut = opts.get("save-signatures");
+        if (opts.has("stopwords"))
+        {
+            stopwords = StopwordFilter(loadStopwords(opts.get("stopwords")));
+        }
 
         // Get k value from command line
-        k = std::stoi(argv[2]);
+        k = std::stoi(opts.positional[1]);
         if (k <= 0)
         {
             std::cerr << "Error: k must be positive" << std::endl;
@@ -445,37 +849,76 @@ int main(int argc, char *argv[])
         }
 
         // Get t value from command line
-        t = std::stoi(argv[3]);
+        t = std::stoi(opts.positional[2]);
         if (t <= 0)
         {
             std::cerr << "Error: Number of hash functions must be positive" << std::endl;
             return 1;
         }
 
-        // Check if directory exists
-        if (!fs::exists(directory) || !fs::is_directory(directory))
+        SweepPlan sweep;
+        try
         {
-            std::cerr << "Error: Directory " << directory << " does not exist" << std::endl;
+            sweep = parseSweep(opts, t, 0, 0.0f);
+        }
+        catch (const exception &e)
+        {
+            std::cerr << "Error: Invalid sweep list: " << e.what() << std::endl;
             return 1;
         }
+        if (sweep.active)
+            t = sweep.maxT(); // Sign once for the largest t
 
-        // Collect all text files in the directory
-        vector<string> files;
-        for (const auto &entry : fs::directory_iterator(directory))
+        int topKOption = opts.getInt("top-k", 0), topPairsOption = opts.getInt("top-pairs", 0);
+        if ((opts.has("top-k") && topKOption <= 0) || (opts.has("top-pairs") && topPairsOption <= 0))
         {
-            if (entry.is_regular_file() && isTextFile(entry.path().string()))
-            {
-                files.push_back(entry.path().string());
-            }
+            std::cerr << "Error: --top-k and --top-pairs must be positive" << std::endl;
+            return 1;
         }
-
-        if (files.empty())
+        topK = topKOption;
+        topN = topPairsOption;
+        if (topK > 0 && topN > 0)
         {
-            std::cerr << "Error: No text files found in directory " << directory << std::endl;
+            std::cerr << "Error: --top-k and --top-pairs cannot be combined" << std::endl;
+            return 1;
+        }
+        npyOutput = opts.has("npy");
+        string tracePath = opts.get("trace");
+        if (!tracePath.empty())
+            Profiler::instance().traceTo(tracePath);
+        if (opts.has("perf-counters"))
+            PerfCounters::instance().start();
+        if (opts.has("memory"))
+            MemoryReport::instance().enable();
+        if (npyOutput && topK > 0)
+        {
+            std::cerr << "Error: --npy writes pairs and cannot be combined with --top-k" << std::endl;
+            return 1;
+        }
+        if ((topK > 0 || topN > 0) && (sweep.active || !sweep.ks.empty()))
+        {
+            std::cerr << "Error: --top-k and --top-pairs cannot be combined with --sweep-*" << std::endl;
+            return 1;
+        }
+        if (!sweep.ks.empty() && (!signaturesIn.empty() || !signaturesOut.empty()))
+        {
+            std::cerr << "Error: --sweep-k cannot be combined with --signatures or --save-signatures" << std::endl;
             return 1;
         }
 
-        // std::cout << "Found " << files.size() << " text files in directory" << std::endl;
+        // A store brings its own seed, so the run matches the stored signatures
+        if (!signaturesIn.empty())
+        {
+            try
+            {
+                hashSeed = storeSeed(signaturesIn, opts.has("seed"), hashSeed);
+            }
+            catch (const exception &e)
+            {
+                std::cerr << "Error: " << e.what() << std::endl;
+                return 1;
+            }
+        }
 
         // Initialize hash functions
         {
@@ -483,58 +926,121 @@ int main(int argc, char *argv[])
             initializeHashFunctions();
         }
 
-        // Process each file and compute MinHash signatures
-        
-        vector<pair<string, unordered_set<string>>> shingleSets;
-
+        if (!signaturesIn.empty())
         {
             Timer timerProcess("index build");
-            for (const auto &file : files)
+            try
             {
-                // std::cout << "Processing file: " << file << std::endl;
-                string text = readFile(file);
+                signatures = loadSignatures(signaturesIn);
+            }
+            catch (const exception &e)
+            {
+                std::cerr << "Error: " << e.what() << std::endl;
+                return 1;
+            }
+        }
+        else
+        {
+            // Check if directory exists
+            if (!fs::exists(directory) || !fs::is_directory(directory))
+            {
+                std::cerr << "Error: Directory " << directory << " does not exist" << std::endl;
+                return 1;
+            }
 
-                if (text.empty())
+            // Collect all text files in the directory
+            vector<string> files;
+            for (const auto &entry : fs::directory_iterator(directory))
+            {
+                if (entry.is_regular_file() && isTextFile(entry.path().string()))
                 {
-                    std::cerr << "Warning: File " << file << " is empty or could not be read. Skipping." << std::endl;
-                    continue;
+                    files.push_back(entry.path().string());
                 }
+            }
 
-                unordered_set<string> kShingles;
-                size_t estimatedSize = max(1UL, (unsigned long)text.length() / 10);
-                kShingles.reserve(estimatedSize);
-
-                tratar(text, kShingles);
+            if (files.empty())
+            {
+                std::cerr << "Error: No text files found in directory " << directory << std::endl;
+                return 1;
+            }
 
-                if (kShingles.empty())
-                {
-                    std::cerr << "Warning: No k-shingles could be extracted from file " << file
-                              << ". Make sure the file has at least " << k << " words. Skipping." << std::endl;
-                    continue;
-                }
+            // std::cout << "Found " << files.size() << " text files in directory" << std::endl;
 
-                vector<int> signature = computeMinHashSignature(kShingles);
-                signatures.push_back({file, signature});
-                shingleSets.push_back({file, kShingles});
+            // Process each file and compute MinHash signatures
+            if (!sweep.ks.empty())
+            {
+                Timer timerProcess("index build");
+                signaturesPerK = signFilesMultiK(files, sweep.ks);
             }
-
-            for (size_t i = 0; i < signatures.size(); i++)
+            else
             {
-                for (size_t j = i + 1; j < signatures.size(); j++)
+                Timer timerProcess("index build");
+                ThreadPool &pool = ThreadPool::instance();
+
+                // Files are shingled and signed in parallel; one slot per file
+                // keeps the original order
+                vector<optional<vector<int>>> slots(files.size());
+                pool.parallelFor(0, files.size(), [&](size_t f)
                 {
-                    float similarity = SimilaridadDeJaccard(signatures[i].second, signatures[j].second);
+                    const string &file = files[f];
+                    // std::cout << "Processing file: " << file << std::endl;
+                    string text = readFile(file);
+
+                    if (text.empty())
+                    {
+                        std::cerr << "Warning: File " << file << " is empty or could not be read. Skipping." << std::endl;
+                        return;
+                    }
 
-                    // Get just the filenames without the full path for better readability
-                    string fileA = fs::path(signatures[i].first).filename().string();
-                    string fileB = fs::path(signatures[j].first).filename().string();
+                    unordered_set<uint64_t> kShingles;
+                    size_t estimatedSize = max(1UL, (unsigned long)text.length() / 10);
+                    kShingles.reserve(estimatedSize);
 
-                    int numA = extractNumber(fileA);
-                    int numB = extractNumber(fileB);
+                    tratar(text, kShingles);
+
+                    if (kShingles.empty())
+                    {
+                        std::cerr << "Warning: No k-shingles could be extracted from file " << file
+                                  << ". Make sure the file has at least " << k << " words. Skipping." << std::endl;
+                        return;
+                    }
+
+                    slots[f] = computeMinHashSignature(kShingles);
+                });
+
+                for (size_t f = 0; f < files.size(); f++)
+                {
+                    if (slots[f])
+                        signatures.push_back({files[f], move(*slots[f])});
                 }
             }
         }
 
-        category = determineCategory(argv[1]);
+        if (!signaturesOut.empty())
+        {
+            try
+            {
+                saveSignatures(signaturesOut, signatures);
+            }
+            catch (const exception &e)
+            {
+                std::cerr << "Warning: Could not save signatures: " << e.what() << std::endl;
+            }
+        }
+
+        // --memory: the signatures are what grows with the corpus
+        if (MemoryReport::instance().isEnabled())
+        {
+            size_t count = signatures.size(), bytes = heapBytes(signatures);
+            for (const auto &perK : signaturesPerK)
+            {
+                count += perK.size();
+                bytes += heapBytes(perK);
+            }
+            MemoryReport::instance().structure("signatures", count, bytes);
+        }
+
+        category = determineCategory(directory);
 
         // Ensure the category is valid
         if (category == "unknown")
@@ -543,23 +1049,43 @@ int main(int argc, char *argv[])
             return 1;
         }
 
-        std::stringstream ss;
-        ss << "results/" << category << "/MinHash/MinHashSimilarities_k" << k
-           << "_t" << t
-           << ".csv";
+        if (!sweep.ks.empty())
+        {
+            for (size_t i = 0; i < sweep.ks.size(); i++)
+            {
+                k = sweep.ks[i];
+                runSweep(signaturesPerK[i], sweep, category);
+            }
+            return 0;
+        }
+        if (sweep.active)
+        {
+            runSweep(signatures, sweep, category);
+            return 0;
+        }
 
-        filename1 = ss.str();
+        if (topK > 0 || topN > 0)
+        {
+            Timer timerQuery("query");
+            if (topK > 0)
+                neighbours = nearestNeighbours(signatures, topK);
+            else
+                topPairs = mostSimilarPairs(signatures, topN);
+        }
 
-        // Generate the second filename with the same structure (e.g., for time measurements)
-        std::stringstream ss2;
-        ss2 << "results/" << category << "/MinHash/MinHashTimes_k" << k
-            << "_t" << t
-            << ".csv";
+        string kind = topK > 0 ? "TopK" : topN > 0 ? "TopPairs" : "";
+        filename1 = resultPath(category, kind.empty() ? "Similarities" : kind, topK + topN);
 
-        filename2 = ss2.str();
+        // Second file with the same structure, for the time measurements
+        filename2 = resultPath(category, kind + "Times", topK + topN);
     }
 
-    writeResultsToCSV(filename1, filename2, signatures);
+    if (topK > 0)
+        writeNeighboursToCSV(filename1, filename2, neighbours, signatures);
+    else if (topN > 0)
+        writePairsToCSV(filename1, filename2, topPairs, signatures);
+    else
+        writeResultsToCSV(filename1, filename2, signatures);
 
     // Calculate and display total execution time
     auto endTime = chrono::high_resolution_clock::now();
@@ -0,0 +1,649 @@
+#include <iostream>
+#include <vector>
+#include <unordered_set>
+#include <string>
+#include <queue>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <optional>
+#include <thread>
+#include "common/dictionary.hpp"
+#include "common/npyWriter.hpp"
+#include "common/options.hpp"
+#include "common/memoryReport.hpp"
+#include "common/perfCounters.hpp"
+#include "common/profiler.hpp"
+#include "common/resultWriter.hpp"
+#include "common/shingler.hpp"
+#include "common/stopwords.hpp"
+#include "common/threadPool.hpp"
+#include "common/tokenizer.hpp"
+#include "deps/nlohmann/json.hpp"
+
+using namespace std;
+using namespace nlohmann;
+namespace fs = std::filesystem;
+
+unsigned int k;                 // Size of k-shingles
+unsigned int f;                 // Fingerprint bits (64 or 128)
+float SIMILARITY_THRESHOLD;     // Jaccard similarity threshold
+int maxDistance;                // Hamming distance that reaches the threshold
+uint64_t hashSeed;              // Seed mixed into the shingle hashes (--seed)
+StopwordFilter stopwords;       // Stopwords
+bool useWordIds = false;        // Shingles from word ids (--word-ids)
+bool npyOutput = false;         // Pairs as .npy columns (--npy)
+WordDictionary dictionary;      // Word -> id, shared by all documents
+map<string, double> timeResults;   // Map to store execution times
+
+// A SimHash fingerprint; with f = 64 only the low word is used
+struct Fingerprint
+{
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+
+    Fingerprint operator&(const Fingerprint &other) const { return {lo & other.lo, hi & other.hi}; }
+    bool operator==(const Fingerprint &other) const { return lo == other.lo && hi == other.hi; }
+    bool operator<(const Fingerprint &other) const
+    {
+        return hi != other.hi ? hi < other.hi : lo < other.lo;
+    }
+};
+
+// Document structure to store document information
+struct Document
+{
+    string filename;
+    Fingerprint fingerprint;
+
+    Document(const string &name) : filename(name) {}
+};
+
+// Timer class to measure execution time
+class Timer
+{
+private:
+    ProfileScope scope;  // Also the scope of the trace (common/profiler.hpp)
+    StageCounters counters;  // --perf-counters (common/perfCounters.hpp)
+    StageMemory memory;  // --memory (common/memoryReport.hpp)
+    string operationName;
+
+public:
+    Timer(const string &name)
+        : scope(Profiler::instance().intern(name)),
+          counters(Profiler::instance().intern(name)),
+          memory(Profiler::instance().intern(name)),
+          operationName(name) {}
+
+    ~Timer()
+    {
+        timeResults[operationName] += scope.elapsedMs();
+    }
+};
+
+int extractNumber(const std::string &filename)
+{
+    // Number between the last underscore and the extension
+    size_t underscorePos = filename.find_last_of('_');
+    if (underscorePos == std::string::npos)
+    {
+        return -1;
+    }
+    size_t dotPos = filename.find('.', underscorePos);
+    if (dotPos == std::string::npos)
+    {
+        dotPos = filename.length();
+    }
+    try
+    {
+        return std::stoi(filename.substr(underscorePos + 1, dotPos - underscorePos - 1));
+    }
+    catch (...)
+    {
+        return -1;
+    }
+}
+
+// StopWordsZone ------------------------------------------------------------------------
+
+// Check if a word is a stopword
+bool is_stopword(const string &word)
+{
+    return stopwords.contains(word);
+}
+
+// load stopwords from a file into stopword set
+unordered_set<string> loadStopwords(const string &filename)
+{
+    unordered_set<string> stopwords;
+    ifstream file(filename);
+    if (!file)
+    {
+        cerr << "Error opening file: " << filename << endl;
+        return stopwords;
+    }
+
+    json j;
+    file >> j; // Parse JSON
+
+    for (const auto &word : j)
+    {
+        stopwords.insert(word.get<string>());
+    }
+
+    return stopwords;
+}
+
+//-----------------------------------------------------------------------------------------
+
+// Format Zone ----------------------------------------------------------------------------
+
+// Read content from file
+std::string readFile(const std::string &filename)
+{
+    std::ifstream file(filename);
+    if (!file.is_open())
+    {
+        std::cerr << "Error opening file: " << filename << std::endl;
+        return "";
+    }
+
+    std::string content;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        content += line + " ";
+    }
+
+    return content;
+}
+
+// Function to check if a file is a text file
+bool isTextFile(const string &filename)
+{
+    string extension = fs::path(filename).extension().string();
+    return (extension == ".txt" || extension == ".doc" || extension == ".md" || extension == ".text");
+}
+
+//----------------------------------------------------------------------------------------
+
+// Algoritmo Zone ---------------------------------------------------------------------------
+
+// Function to process text and extract k-shingles, stored as 64-bit keys
+void tratar(const string &texto, unordered_set<uint64_t> &kShingles)
+{
+    vector<uint64_t> words;
+    forEachWord(texto, [&](const string &word)
+    {
+        if (!word.empty() && !is_stopword(word))
+            words.push_back(useWordIds ? dictionary.intern(word) : hash<string>{}(word));
+    });
+    forEachShingle(words, k, [&](uint64_t key) { kShingles.insert(key); });
+}
+
+// splitmix64 finalizer: spreads a shingle key over all 64 bits
+uint64_t mixBits(uint64_t h)
+{
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+// Charikar's SimHash: every shingle votes +1 or -1 on each bit with the
+// bits of its (seeded) hash, and the fingerprint keeps the sign of each
+// vote. Two documents differ in a bit with probability angle / pi, where
+// angle is the angle between their shingle vectors.
+Fingerprint computeSimHash(const unordered_set<uint64_t> &kShingles)
+{
+    int votes[128] = {0};
+    for (uint64_t key : kShingles)
+    {
+        uint64_t words[2];
+        words[0] = mixBits(key ^ hashSeed);
+        words[1] = mixBits(words[0] ^ 0x9e3779b97f4a7c15ULL);
+        for (unsigned bit = 0; bit < f; bit++)
+        {
+            votes[bit] += (words[bit >> 6] >> (bit & 63)) & 1 ? 1 : -1;
+        }
+    }
+
+    Fingerprint fingerprint;
+    for (unsigned bit = 0; bit < f; bit++)
+    {
+        if (votes[bit] > 0)
+        {
+            (bit < 64 ? fingerprint.lo : fingerprint.hi) |= uint64_t(1) << (bit & 63);
+        }
+    }
+    return fingerprint;
+}
+
+int hammingDistance(const Fingerprint &a, const Fingerprint &b)
+{
+    return __builtin_popcountll(a.lo ^ b.lo) + __builtin_popcountll(a.hi ^ b.hi);
+}
+
+// SimHash measures the cosine of the shingle sets; for sets of similar size
+// cosine c and Jaccard J are related by J = c / (2 - c). Both conversions
+// below use that relation so the threshold and the CSV stay on the Jaccard
+// scale of the other engines.
+float estimatedJaccardSimilarity(int distance)
+{
+    double cosine = cos(M_PI * distance / f);
+    return static_cast<float>(max(0.0, cosine / (2.0 - cosine)));
+}
+
+int distanceForThreshold(float threshold)
+{
+    double cosine = 2.0 * threshold / (1.0 + threshold);
+    return static_cast<int>(floor(f * acos(cosine) / M_PI + 1e-9));
+}
+
+// Permuted tables (Manku, Jain and Das Sarma): the f bits are cut into B
+// blocks, and two fingerprints within maxDistance bits agree on at least
+// B - maxDistance whole blocks. Every choice of B - maxDistance blocks makes
+// one table, sorted by those blocks (the table's mask), so every
+// near-duplicate pair is adjacent in at least one table. More blocks make
+// longer keys and fewer false candidates, but C(B, maxDistance) tables;
+// B is the largest that keeps the tables within maxTables.
+vector<Fingerprint> buildTableMasks(int maxTables)
+{
+    int blocks = 0;
+    for (int B = maxDistance + 1; B <= static_cast<int>(min(f, 63u)); B++)
+    {
+        double tables = 1;
+        for (int i = 0; i < maxDistance; i++)
+            tables = tables * (B - i) / (i + 1);
+        if (tables > maxTables && blocks != 0)
+            break;
+        blocks = B;
+    }
+
+    // Too many differing bits for any block split: one table with an empty
+    // mask, which compares every pair
+    if (blocks == 0)
+        return {Fingerprint()};
+
+    vector<Fingerprint> blockMasks(blocks);
+    for (int j = 0; j < blocks; j++)
+    {
+        for (unsigned bit = j * f / blocks; bit < (j + 1) * f / blocks; bit++)
+        {
+            (bit < 64 ? blockMasks[j].lo : blockMasks[j].hi) |= uint64_t(1) << (bit & 63);
+        }
+    }
+
+    // Every subset of blocks - maxDistance blocks (Gosper's hack)
+    vector<Fingerprint> masks;
+    int keyBlocks = blocks - maxDistance;
+    for (uint64_t set = (uint64_t(1) << keyBlocks) - 1; set < (uint64_t(1) << blocks);)
+    {
+        Fingerprint mask;
+        for (int j = 0; j < blocks; j++)
+        {
+            if (set >> j & 1)
+            {
+                mask.lo |= blockMasks[j].lo;
+                mask.hi |= blockMasks[j].hi;
+            }
+        }
+        masks.push_back(mask);
+        uint64_t lowest = set & -set;
+        uint64_t ripple = set + lowest;
+        set = (((ripple ^ set) >> 2) / lowest) | ripple;
+    }
+    return masks;
+}
+
+// Pairs of documents within maxDistance bits. Tables are sorted and scanned
+// in parallel; a pair found by several tables is reported once.
+vector<pair<int, int>> findSimilarDocumentPairs(const vector<Document> &documents,
+                                                const vector<Fingerprint> &masks)
+{
+    vector<vector<pair<int, int>>> tablePairs(masks.size());
+    ThreadPool::instance().parallelFor(0, masks.size(), [&](size_t m)
+    {
+        const Fingerprint &mask = masks[m];
+        vector<pair<Fingerprint, int>> table(documents.size());
+        for (size_t i = 0; i < documents.size(); i++)
+        {
+            table[i] = {documents[i].fingerprint & mask, static_cast<int>(i)};
+        }
+        sort(table.begin(), table.end(), [](const pair<Fingerprint, int> &a, const pair<Fingerprint, int> &b)
+        {
+            return a.first < b.first || (a.first == b.first && a.second < b.second);
+        });
+
+        // Runs of equal keys hold the candidates of this table
+        for (size_t start = 0; start < table.size();)
+        {
+            size_t end = start + 1;
+            while (end < table.size() && table[end].first == table[start].first)
+                end++;
+            for (size_t i = start; i < end; i++)
+            {
+                for (size_t j = i + 1; j < end; j++)
+                {
+                    int doc1 = table[i].second, doc2 = table[j].second;
+                    if (hammingDistance(documents[doc1].fingerprint, documents[doc2].fingerprint) <= maxDistance)
+                        tablePairs[m].push_back({doc1, doc2});
+                }
+            }
+            start = end;
+        }
+    });
+
+    vector<pair<int, int>> similarPairs;
+    for (auto &pairs : tablePairs)
+    {
+        similarPairs.insert(similarPairs.end(), pairs.begin(), pairs.end());
+        vector<pair<int, int>>().swap(pairs);
+    }
+    sort(similarPairs.begin(), similarPairs.end());
+    similarPairs.erase(unique(similarPairs.begin(), similarPairs.end()), similarPairs.end());
+    return similarPairs;
+}
+
+//-------------------------------------------------------------------------------------------
+
+// Operation,Time(ms) rows from timeResults
+void writeTimesToCSV(const string &filename)
+{
+    ofstream fileTime(filename);
+    if (!fileTime.is_open())
+    {
+        cerr << "Error: Unable to open file " << filename << " for writing" << endl;
+        return;
+    }
+
+    // Write header
+    fileTime << "Operation,Time(ms)" << endl;
+    fileTime << fixed << setprecision(3);  // Milliseconds to the microsecond
+
+    for (const auto &pair : timeResults)
+    {
+        fileTime << pair.first << "," << pair.second << endl;
+    }
+    if (!PerfCounters::instance().writeCSV(filename))
+    {
+        cerr << "Error: Unable to write the counters next to " << filename << endl;
+    }
+    if (!MemoryReport::instance().writeCSV(filename))
+    {
+        cerr << "Error: Unable to write the memory report next to " << filename << endl;
+    }
+}
+
+// --npy counterpart of the pair CSV: the same rows as uint32/float32
+// columns (common/npyWriter.hpp)
+void writeResultsToNpy(const string &filename1,
+                       const string &filename2,
+                       const vector<pair<int, int>> &similarPairs,
+                       const vector<Document> &documents)
+{
+    PairNpyWriter columns(npyBase(filename1));
+    if (!columns.isOpen())
+    {
+        cerr << "Error: Unable to open the .npy files of " << filename1 << " for writing" << endl;
+        return;
+    }
+    for (const auto &pair : similarPairs)
+    {
+        columns.add(extractNumber(documents[pair.first].filename),
+                    extractNumber(documents[pair.second].filename),
+                    estimatedJaccardSimilarity(
+                        hammingDistance(documents[pair.first].fingerprint, documents[pair.second].fingerprint)));
+    }
+    if (!columns.close())
+    {
+        cerr << "Error: Could not write the .npy files of " << filename1 << endl;
+    }
+    writeTimesToCSV(filename2);
+    cout << "Results written to " << npyBase(filename1) << ".{doc1,doc2,sim}.npy" << endl;
+}
+
+void writeResultsToCSV(const string &filename1,
+                       const string &filename2,
+                       const vector<pair<int, int>> &similarPairs,
+                       const vector<Document> &documents)
+{
+    fs::path csvPath(filename1);
+    if (!fs::exists(csvPath.parent_path()))
+    {
+        fs::create_directories(csvPath.parent_path());
+    }
+
+    if (npyOutput)
+    {
+        writeResultsToNpy(filename1, filename2, similarPairs, documents);
+        return;
+    }
+
+    ResultWriter file(filename1);
+    if (!file.isOpen())
+    {
+        cerr << "Error: Unable to open file " << filename1 << " for writing" << endl;
+        return;
+    }
+
+    // Write header
+    file.append("Doc1,Doc2,Sim%\n");
+
+    string row;
+    for (const auto &pair : similarPairs)
+    {
+        const string &doc1 = documents[pair.first].filename;
+        const string &doc2 = documents[pair.second].filename;
+        int docNum1 = extractNumber(doc1);
+        int docNum2 = extractNumber(doc2);
+
+        float similarity = estimatedJaccardSimilarity(
+            hammingDistance(documents[pair.first].fingerprint, documents[pair.second].fingerprint));
+
+        row.clear();
+        if (docNum1 != -1)
+            appendInt(row, docNum1);
+        else
+            row += doc1;
+        row += ',';
+        if (docNum2 != -1)
+            appendInt(row, docNum2);
+        else
+            row += doc2;
+        row += ',';
+        appendFixed(row, similarity);
+        row += '\n';
+        file.append(row);
+    }
+
+    if (!file.close())
+    {
+        cerr << "Error: Could not write " << filename1 << endl;
+    }
+
+    writeTimesToCSV(filename2);
+    cout << "Results written to " << filename1 << endl;
+}
+
+std::string determineCategory(const std::string &inputDirectory)
+{
+    if (inputDirectory.find("real") != std::string::npos)
+    {
+        return "real";
+    }
+    else if (inputDirectory.find("virtual") != std::string::npos)
+    {
+        return "virtual";
+    }
+    return "unknown"; // Fallback case
+}
+
+// results/<category>/simhash/simhash<kind>_k.._f.._threshold...csv
+string resultPath(const string &category, const string &kind)
+{
+    std::stringstream ss;
+    ss << "results/" << category << "/simhash/simhash" << kind << "_k" << k
+       << "_f" << f << "_threshold" << SIMILARITY_THRESHOLD << ".csv";
+    return ss.str();
+}
+
+int main(int argc, char *argv[])
+{
+    vector<Document> documents;
+    vector<pair<int, int>> similarPairs;
+    string filename1, filename2, category;
+    {
+        Timer timerGlobal("time");
+        Options opts = parseOptions(argc, argv);
+        if (opts.positional.size() != 4)
+        {
+            std::cout << "Usage: " << argv[0] << " <directory> <k> <f> <sim_threshold> [--threads N] [--stopwords FILE]"
+                      << " [--word-ids] [--seed N] [--max-tables N] [--npy] [--trace FILE] [--perf-counters] [--memory]" << std::endl;
+            std::cout << "where k is the shingle size, f the fingerprint bits (64 or 128) and sim_threshold" << std::endl;
+            std::cout << "the Jaccard similarity threshold (0.0 to 1.0)" << std::endl;
+            std::cout << "--max-tables N limits the permuted tables of the Hamming search (default 32)" << std::endl;
+            std::cout << "--npy writes the pairs as .npy columns (doc1, doc2, sim) instead of a CSV" << std::endl;
+            std::cout << "--trace FILE writes a Chrome trace of the timed stages to FILE" << std::endl;
+            std::cout << "--perf-counters writes hardware counters per stage to a Counters CSV next to the times" << std::endl;
+            std::cout << "--memory writes the size of the documents and pairs and the peak RSS per stage to a Memory CSV next to the times" << std::endl;
+            return 1;
+        }
+
+        string directory = opts.positional[0];
+        try
+        {
+            ThreadPool::setThreads(opts.getPositiveInt("threads", thread::hardware_concurrency()));
+        }
+        catch (const exception &e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        useWordIds = opts.has("word-ids");
+        npyOutput = opts.has("npy");
+        string tracePath = opts.get("trace");
+        if (!tracePath.empty())
+            Profiler::instance().traceTo(tracePath);
+        if (opts.has("perf-counters"))
+            PerfCounters::instance().start();
+        if (opts.has("memory"))
+            MemoryReport::instance().enable();
+        hashSeed = opts.has("seed") ? stoull(opts.get("seed"))
+                                    : static_cast<unsigned>(chrono::system_clock::now().time_since_epoch().count());
+        if (opts.has("stopwords"))
+        {
+            stopwords = StopwordFilter(loadStopwords(opts.get("stopwords")));
+        }
+
+        k = std::stoi(opts.positional[1]);
+        f = std::stoi(opts.positional[2]);
+        SIMILARITY_THRESHOLD = std::stof(opts.positional[3]);
+        int maxTables = opts.getInt("max-tables", 32);
+        if (k <= 0 || (f != 64 && f != 128) || SIMILARITY_THRESHOLD <= 0 || SIMILARITY_THRESHOLD > 1.0 || maxTables <= 0)
+        {
+            std::cerr << "Error: k and --max-tables must be positive, f must be 64 or 128 and the similarity "
+                         "threshold must be between 0 and 1"
+                      << std::endl;
+            return 1;
+        }
+        maxDistance = distanceForThreshold(SIMILARITY_THRESHOLD);
+
+        if (!fs::exists(directory) || !fs::is_directory(directory))
+        {
+            std::cerr << "Error: Directory " << directory << " does not exist" << std::endl;
+            return 1;
+        }
+
+        vector<string> files;
+        for (const auto &entry : fs::directory_iterator(directory))
+        {
+            if (entry.is_regular_file() && isTextFile(entry.path().string()))
+            {
+                files.push_back(entry.path().string());
+            }
+        }
+
+        // Fingerprint the files in parallel; one slot per file keeps the order
+        {
+            Timer timerProcess("index build");
+            vector<optional<Fingerprint>> slots(files.size());
+            ThreadPool::instance().parallelFor(0, files.size(), [&](size_t i)
+            {
+                string text = readFile(files[i]);
+                if (text.empty())
+                {
+                    std::cerr << "Warning: File " << files[i] << " is empty or could not be read. Skipping." << std::endl;
+                    return;
+                }
+
+                unordered_set<uint64_t> kShingles;
+                tratar(text, kShingles);
+                if (kShingles.empty())
+                {
+                    std::cerr << "Warning: No k-shingles could be extracted from file " << files[i]
+                              << ". Make sure the file has at least " << k << " words. Skipping." << std::endl;
+                    return;
+                }
+                slots[i] = computeSimHash(kShingles);
+            });
+
+            for (size_t i = 0; i < files.size(); i++)
+            {
+                if (!slots[i])
+                    continue;
+                documents.emplace_back(files[i]);
+                documents.back().fingerprint = *slots[i];
+            }
+        }
+
+        if (documents.size() < 2)
+        {
+            std::cerr << "Error: Need at least 2 valid documents to compare. Found: " << documents.size() << std::endl;
+            return 1;
+        }
+
+        vector<Fingerprint> masks;
+        {
+            Timer timerTables("index build");
+            masks = buildTableMasks(maxTables);
+        }
+
+        {
+            Timer timerQuery("query");
+            similarPairs = findSimilarDocumentPairs(documents, masks);
+        }
+
+        // --memory: the fingerprinted documents and the pairs
+        if (MemoryReport::instance().isEnabled())
+        {
+            size_t bytes = allocationBytes(documents.capacity() * sizeof(Document));
+            for (const Document &doc : documents)
+                bytes += heapBytes(doc.filename);
+            MemoryReport::instance().structure("documents", documents.size(), bytes);
+            MemoryReport::instance().structure("similarPairs", similarPairs.size(), heapBytes(similarPairs));
+        }
+
+        category = determineCategory(directory);
+        if (category == "unknown")
+        {
+            std::cerr << "Warning: Could not determine category from input directory!" << std::endl;
+            return 1;
+        }
+
+        filename1 = resultPath(category, "Similarities");
+
+        // Second file with the same structure, for the time measurements
+        filename2 = resultPath(category, "Times");
+    }
+
+    writeResultsToCSV(filename1, filename2, similarPairs, documents);
+    return 0;
+}
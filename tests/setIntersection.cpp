@@ -0,0 +1,56 @@
+// The AVX2 intersection kernel against the scalar merge on random sorted
+// arrays of distinct keys, with every length from 0 to 40 on each side so
+// that all the tails left after the 4 x 4 blocks are covered. Keys come from
+// a small range so the arrays overlap a lot. Run by make check.
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "../common/setIntersection.hpp"
+
+using namespace std;
+
+vector<uint64_t> randomKeys(mt19937_64 &gen, size_t n, uint64_t range) {
+  set<uint64_t> keys;
+  uniform_int_distribution<uint64_t> key(0, range - 1);
+  while (keys.size() < n) keys.insert(key(gen));
+  return vector<uint64_t>(keys.begin(), keys.end());
+}
+
+int main() {
+#ifdef COMMON_SET_INTERSECTION_AVX2
+  if (!set_detail::hasAvx2()) {
+    printf("skipped: setIntersection (no AVX2 on this CPU)\n");
+    return 0;
+  }
+  mt19937_64 gen(12345);
+  size_t cases = 0;
+  for (size_t na = 0; na <= 40; na++) {
+    for (size_t nb = 0; nb <= 40; nb++) {
+      for (int round = 0; round < 8; round++) {
+        // Dense ranges give many matches, sparse ones long runs without any
+        uint64_t range = round % 2 ? 4 * (na + nb) + 8 : 1ULL << 62;
+        vector<uint64_t> a = randomKeys(gen, na, max<uint64_t>(range, na));
+        vector<uint64_t> b = randomKeys(gen, nb, max<uint64_t>(range, nb));
+        size_t expected = set_detail::intersectScalar(a.data(), a.size(),
+                                                      b.data(), b.size());
+        size_t actual = set_detail::intersectAvx2(a.data(), a.size(),
+                                                  b.data(), b.size());
+        if (actual != expected) {
+          printf("FAIL: setIntersection |a|=%zu |b|=%zu: AVX2 %zu, scalar %zu\n",
+                 na, nb, actual, expected);
+          return 1;
+        }
+        cases++;
+      }
+    }
+  }
+  printf("ok: setIntersection (%zu cases)\n", cases);
+#else
+  printf("skipped: setIntersection (not an x86 build)\n");
+#endif
+  return 0;
+}
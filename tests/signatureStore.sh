@@ -0,0 +1,69 @@
+#!/usr/bin/env bash
+# Signature store round trip for the bucketing and forest tools: a store saved
+# with --seed 1 is queried (--queries, --serve) without --seed, which must sign
+# the queries with the store's seed and find them, and with a different
+# --seed, which must be refused. Run from the repository root after building: make check
+set -euo pipefail
+
+bin="$(pwd)/bin"
+work="$(mktemp -d)"
+trap 'rm -rf "$work"' EXIT
+cd "$work"
+
+# Near-duplicate corpus: one text with a different word changed in each copy
+mkdir -p real queries results/real/bucketing results/real/forest
+for i in $(seq 1 8); do
+  for w in $(seq 1 300); do
+    if ((w % 40 == i)); then printf 'changed%d ' "$w"; else printf 'word%d ' "$w"; fi
+  done >"real/docExp1_$i.txt"
+done
+cp real/docExp1_1.txt real/docExp1_2.txt queries/
+
+fail() {
+  echo "FAIL: $*" >&2
+  exit 1
+}
+
+for tool in bucketing forest; do
+  run="$bin/jaccardLSH$tool real 2 100 20 0.5"
+  result="results/real/$tool/${tool}QuerySimilarities_k2_t100_b20_threshold0.5.csv"
+
+  $run --seed 1 --save-signatures store.sig >/dev/null 2>&1 ||
+    fail "$tool: cannot save the store"
+
+  $run --signatures store.sig --queries queries >/dev/null 2>&1 ||
+    fail "$tool: query without --seed failed"
+  [ "$(wc -l <"$result")" -gt 1 ] ||
+    fail "$tool: no matches for queries without --seed"
+  cp "$result" withoutSeed.csv
+
+  $run --signatures store.sig --queries queries --seed 1 >/dev/null 2>&1 ||
+    fail "$tool: query with the store's --seed failed"
+  cmp -s "$result" withoutSeed.csv ||
+    fail "$tool: results differ with and without the store's --seed"
+
+  if $run --signatures store.sig --queries queries --seed 2 >/dev/null 2>&1; then
+    fail "$tool: a --seed other than the store's was accepted"
+  fi
+
+  # The server signs incoming documents with the store's seed too, and its
+  # stdout carries nothing but the answers
+  served="$(echo "QUERY real/docExp1_1.txt" |
+    $run --signatures store.sig --serve 2>/dev/null | head -n 1)"
+  case "$served" in
+  "OK 0 "* | "") fail "$tool: no matches served without --seed ($served)" ;;
+  "ERR "*) fail "$tool: $served" ;;
+  "OK "*) ;;
+  *) fail "$tool: stdout does not start with the answer: $served" ;;
+  esac
+
+  # A store of the other hashing mode (--word-ids) is refused
+  $run --seed 1 --word-ids --save-signatures words.sig >/dev/null 2>&1 ||
+    fail "$tool: cannot save a --word-ids store"
+  if $run --signatures words.sig >/dev/null 2>&1; then
+    fail "$tool: a --word-ids store was loaded without --word-ids"
+  fi
+
+  rm -f store.sig words.sig
+  echo "ok: $tool"
+done
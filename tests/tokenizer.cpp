@@ -0,0 +1,113 @@
+// forEachWord against the loops it replaced: `stringstream >> word` with
+// normalize() (letters only, lowercased), the same after remove_punctuation()
+// for kSplitOnPunctuation, and lowercasing whole tokens for kKeepNonAlpha.
+// Every prefix of a fixed text is tokenized so that words end at every
+// offset of the 64-byte blocks. The scalar, SSE2 and AVX2 classifiers are
+// also compared block by block on random bytes. Run by make check.
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../common/tokenizer.hpp"
+
+using namespace std;
+
+// The old text processing, as the engines had it
+string remove_punctuation(const string &text) {
+  string newtext;
+  for (char c : text) newtext += ispunct(static_cast<unsigned char>(c)) ? ' ' : c;
+  return newtext;
+}
+
+string normalize(const string &word) {
+  string result;
+  for (char c : word) {
+    if (isalpha(static_cast<unsigned char>(c))) result += tolower(c);
+  }
+  return result;
+}
+
+vector<string> legacyWords(const string &text, unsigned flags) {
+  stringstream ss(flags & kSplitOnPunctuation ? remove_punctuation(text) : text);
+  vector<string> words;
+  string word;
+  while (ss >> word) {
+    if (flags & kKeepNonAlpha) {
+      for (char &c : word) c = tolower(static_cast<unsigned char>(c));
+      words.push_back(word);
+    } else {
+      words.push_back(normalize(word));
+    }
+  }
+  return words;
+}
+
+vector<string> tokenizedWords(const string &text, unsigned flags) {
+  vector<string> words;
+  forEachWord(text, [&](const string &word) { words.push_back(word); }, flags);
+  return words;
+}
+
+bool sameBlock(const tokenizer_detail::Block &a,
+               const tokenizer_detail::Block &b) {
+  return a.alpha == b.alpha && a.space == b.space && a.punct == b.punct &&
+         memcmp(a.lowered, b.lowered, 64) == 0;
+}
+
+int main() {
+  // Mixed case, digits, punctuation inside and around words, every kind of
+  // whitespace, runs of it, letter-less tokens and UTF-8 bytes
+  string text =
+      "The QUICK brown-fox, jumped over 12 lazy dogs! Isn't it... "
+      "\"quoted\" (words) [and] {braces}\tTAB\nnew\vline\fform\rreturn  "
+      "double  spaces --- 42 3.14 e-mail@host.com caf\xc3\xa9 na\xc3\xafve "
+      "x y z A1B2C3 ~!@#$%^&*()_+ end.  "
+      "AnotherSentenceWithoutSpacesThatIsLongerThanSixtyFourBytesForSure!!";
+  text += text;
+
+  const unsigned flagSets[] = {0, kSplitOnPunctuation, kKeepNonAlpha};
+  size_t cases = 0;
+  for (unsigned flags : flagSets) {
+    for (size_t len = 0; len <= text.size(); len++) {
+      string prefix = text.substr(0, len);
+      if (tokenizedWords(prefix, flags) != legacyWords(prefix, flags)) {
+        printf("FAIL: tokenizer flags=%u, first %zu bytes of the text\n", flags,
+               len);
+        return 1;
+      }
+      cases++;
+    }
+  }
+
+  // The classifiers agree on every byte value
+  mt19937 gen(2024);
+  uniform_int_distribution<int> byte(0, 255);
+  for (int round = 0; round < 2000; round++) {
+    char block[64];
+    for (char &c : block) c = static_cast<char>(byte(gen));
+    tokenizer_detail::Block scalar, simd;
+    tokenizer_detail::classifyScalar(block, scalar);
+#ifdef TOKENIZER_X86
+    tokenizer_detail::classifySSE2(block, simd);
+    if (!sameBlock(scalar, simd)) {
+      printf("FAIL: tokenizer SSE2 classifier differs from the scalar one\n");
+      return 1;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+      tokenizer_detail::classifyAVX2(block, simd);
+      if (!sameBlock(scalar, simd)) {
+        printf("FAIL: tokenizer AVX2 classifier differs from the scalar one\n");
+        return 1;
+      }
+    }
+#endif
+    cases++;
+  }
+  printf("ok: tokenizer (%zu cases)\n", cases);
+  return 0;
+}
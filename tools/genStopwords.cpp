@@ -0,0 +1,88 @@
+// Build step: turns a JSON stopword list into common/stopwordsTable.hpp, a
+// constexpr minimal perfect hash table checked at compile time.
+//
+//   genStopwords stopwords-en.json > common/stopwordsTable.hpp
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../common/perfectHash.hpp"
+#include "../deps/nlohmann/json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    cerr << "Usage: " << argv[0] << " <stopwords.json>" << endl;
+    return 1;
+  }
+
+  ifstream file(argv[1]);
+  if (!file.is_open()) {
+    cerr << "Error opening file: " << argv[1] << endl;
+    return 1;
+  }
+
+  vector<string> words;
+  try {
+    json j;
+    file >> j;
+    for (const auto &word : j) {
+      words.push_back(word.get<string>());
+    }
+  } catch (const exception &e) {
+    cerr << "Error parsing stopwords file: " << e.what() << endl;
+    return 1;
+  }
+
+  PerfectHashSet table(words);
+  const vector<uint32_t> &displacement = table.displacements();
+  const vector<string> &keys = table.slotKeys();
+
+  cout << "// Generated by tools/genStopwords.cpp from " << argv[1]
+       << ". Do not edit.\n"
+       << "#ifndef COMMON_STOPWORDS_TABLE_HPP\n"
+       << "#define COMMON_STOPWORDS_TABLE_HPP\n\n"
+       << "#include <cstddef>\n#include <cstdint>\n#include <string_view>\n\n"
+       << "#include \"perfectHash.hpp\"\n\n"
+       << "constexpr size_t kBuiltinStopwordCount = " << keys.size() << ";\n"
+       << "constexpr size_t kBuiltinStopwordBuckets = "
+       << max<size_t>(1, displacement.size()) << ";\n\n"
+       << "constexpr uint32_t kBuiltinStopwordDisplacement[] = {";
+  if (displacement.empty()) cout << "0";
+  for (size_t i = 0; i < displacement.size(); i++) {
+    cout << (i % 6 == 0 ? "\n    " : " ") << displacement[i] << "u"
+         << (i + 1 < displacement.size() ? "," : "");
+  }
+  cout << "};\n\n"
+       << "constexpr std::string_view kBuiltinStopwords[] = {";
+  if (keys.empty()) cout << "\"\"";
+  for (size_t i = 0; i < keys.size(); i++) {
+    string escaped;
+    for (char c : keys[i]) {
+      if (c == '"' || c == '\\') escaped += '\\';
+      escaped += c;
+    }
+    cout << "\n    \"" << escaped << "\"" << (i + 1 < keys.size() ? "," : "");
+  }
+  cout << "};\n\n"
+       << "// Every key must land on its own slot\n"
+       << "constexpr bool builtinStopwordsConsistent() {\n"
+       << "  for (size_t i = 0; i < kBuiltinStopwordCount; i++) {\n"
+       << "    const std::string_view key = kBuiltinStopwords[i];\n"
+       << "    if (perfectHashSlot(key.data(), key.size(),\n"
+       << "                        kBuiltinStopwordDisplacement,\n"
+       << "                        kBuiltinStopwordBuckets,\n"
+       << "                        kBuiltinStopwordCount) != i) {\n"
+       << "      return false;\n"
+       << "    }\n"
+       << "  }\n"
+       << "  return true;\n"
+       << "}\n"
+       << "static_assert(builtinStopwordsConsistent(),\n"
+       << "              \"stopword table is not a perfect hash\");\n\n"
+       << "#endif\n";
+  return 0;
+}